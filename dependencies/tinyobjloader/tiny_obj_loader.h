@@ -45,6 +45,10 @@
 #include <vector>
 #include <map>
 
+// Bytes before and after a buffer that the memory loaders may read when it is
+// passed with `padded` set. Numbers are then scanned with vector loads.
+#define TINYOBJ_PARSE_PADDING (32)
+
 namespace tinyobj {
 
 typedef struct {
@@ -95,8 +99,24 @@ typedef struct {
 typedef struct {
   std::string name;
   mesh_t mesh;
+  unsigned int group; // Number of g and o lines before the shape.
+  // Smallest and largest v, vt and vn record referenced by the faces, -1 if
+  // there are none.
+  int min_index[3];
+  int max_index[3];
 } shape_t;
 
+// Part of an .obj file from a g or o line up to the next one, see
+// ScanObjGroups.
+typedef struct {
+  size_t offset; // byte range in the buffer
+  size_t size;
+  size_t v_base; // v, vn and vt records before the group
+  size_t vn_base;
+  size_t vt_base;
+  std::string material; // usemtl in effect at the start of the group
+} group_t;
+
 class MaterialReader {
 public:
   MaterialReader() {}
@@ -145,6 +165,107 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
              std::istream &inStream, MaterialReader &readMatFn,
              bool triangulate = true, bool generateNormals = true);
 
+/// Loads .obj from a memory-mapped file. Lines are tokenized in place from
+/// the mapped bytes, avoiding the per-line copies of the std::istream path.
+/// Returns true when loading .obj become success.
+/// Returns warning and error message into `err`
+bool LoadObjMapped(std::vector<shape_t> &shapes,       // [output]
+                   std::vector<material_t> &materials, // [output]
+                   std::string &err,                   // [output]
+                   const char *filename, const char *mtl_basepath = NULL,
+                   bool triangulate = true, bool generateNormals = true);
+
+/// Loads object from `size` bytes of .obj data at `buf`, uses readMatFn to
+/// retrieve materials. `buf` does not need to be null terminated.
+/// Set `padded` when TINYOBJ_PARSE_PADDING bytes before and after `buf` can
+/// be read, or when `buf` is the data of a MappedFile, whose pages can be
+/// read as a whole.
+bool LoadObjFromMemory(std::vector<shape_t> &shapes,       // [output]
+                       std::vector<material_t> &materials, // [output]
+                       std::string &err,                   // [output]
+                       const char *buf, size_t size, MaterialReader &readMatFn,
+                       bool triangulate = true, bool generateNormals = true,
+                       bool padded = false);
+
+/// Loads .obj from a memory-mapped file using `numThreads` worker threads
+/// (0 uses one per hardware thread). The file is split at line boundaries,
+/// vertex and face records are parsed concurrently and the results are merged
+/// in file order, so the output is the same as LoadObj.
+bool LoadObjParallel(std::vector<shape_t> &shapes,       // [output]
+                     std::vector<material_t> &materials, // [output]
+                     std::string &err,                   // [output]
+                     const char *filename, const char *mtl_basepath = NULL,
+                     unsigned numThreads = 0, bool triangulate = true,
+                     bool generateNormals = true);
+
+/// Parallel version of LoadObjFromMemory, see LoadObjParallel.
+bool LoadObjFromMemoryParallel(std::vector<shape_t> &shapes,       // [output]
+                               std::vector<material_t> &materials, // [output]
+                               std::string &err,                   // [output]
+                               const char *buf, size_t size,
+                               MaterialReader &readMatFn,
+                               unsigned numThreads = 0,
+                               bool triangulate = true,
+                               bool generateNormals = true,
+                               bool padded = false);
+
+/// Splits .obj data into groups starting at every g or o line, group 0
+/// holds everything before the first one. `shape_t::group` of shapes loaded
+/// from the same data is an index into `groups`.
+void ScanObjGroups(std::vector<group_t> &groups, // [output]
+                   const char *buf, size_t size);
+
+/// Loads the shapes of one group found by ScanObjGroups on its own.
+/// `material_map` maps material names to ids as a load of the whole file
+/// would have. Face indices are made relative to the group, loading fails if
+/// a face references a vertex record outside of it or the group has mtllib.
+/// `padded` is as in LoadObjFromMemory, for all of `buf`.
+bool LoadObjGroupFromMemory(std::vector<shape_t> &shapes, // [output]
+                            std::string &err,             // [output]
+                            const char *buf, const group_t &group,
+                            unsigned int groupIndex,
+                            const std::map<std::string, int> &material_map,
+                            bool triangulate = true,
+                            bool generateNormals = true, bool padded = false);
+
+/// Parses the decimal number at `token` the way the .obj loader parses
+/// coordinates and sets `end` past it. `padded` is the loaders' flag for the
+/// buffer holding the number, see LoadObjFromMemory.
+float ParseFloat(const char *token, const char **end, bool padded);
+
+/// Flattens the face groups of `size` bytes of .obj data into shapes with
+/// vertex_cache, or with the std::map per face group the loader used before
+/// it when `mapVertexCache` is set. Only the flattening is timed, in
+/// `seconds`. Meant to benchmark the two caches against each other, so
+/// materials are not loaded and no normals are generated.
+bool FlattenObjFaceGroups(std::vector<shape_t> &shapes, // [output]
+                          std::string &err,             // [output]
+                          const char *buf, size_t size, bool mapVertexCache,
+                          double &seconds, bool triangulate = true);
+
+/// Read-only memory mapping of a whole file. `data` can be passed to the
+/// memory loaders with `padded` set.
+class MappedFile {
+public:
+  MappedFile();
+  ~MappedFile();
+  bool open(const char *filename);
+  void close();
+
+  const char *data;
+  size_t size;
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+#ifdef _WIN32
+  void *file;
+  void *mapping;
+#else
+  int fd;
+#endif
+};
+
 /// Loads materials into std::map
 void LoadMtl(std::map<std::string, int> &material_map, // [output]
              std::vector<material_t> &materials,       // [output]
@@ -164,6 +285,38 @@ void LoadMtl(std::map<std::string, int> &material_map, // [output]
 #include <map>
 #include <fstream>
 #include <sstream>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define TINYOBJ_USE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define TINYOBJ_USE_AVX2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "tiny_obj_loader.h"
 
@@ -188,17 +341,117 @@ struct tag_sizes {
   int num_strings;
 };
 
-// for std::map
-static inline bool operator<(const vertex_index &a, const vertex_index &b) {
-  if (a.v_idx != b.v_idx)
-    return (a.v_idx < b.v_idx);
-  if (a.vn_idx != b.vn_idx)
-    return (a.vn_idx < b.vn_idx);
-  if (a.vt_idx != b.vt_idx)
-    return (a.vt_idx < b.vt_idx);
+// Open addressing hash table from a (v, vt, vn) triple to the index of the
+// flattened vertex. Entries are stamped with a generation, so clear() is O(1)
+// and one table can be reused for every face group.
+class vertex_cache {
+public:
+  vertex_cache() : count_(0), generation_(1) {}
+
+  void clear() {
+    count_ = 0;
+    if (++generation_ == 0) {
+      // Stamps wrapped around, start over.
+      for (size_t i = 0; i < slots_.size(); i++) {
+        slots_[i].generation = 0;
+      }
+      generation_ = 1;
+    }
+  }
 
-  return false;
-}
+  // Looks up key. Returns true and sets *value to its slot if found,
+  // otherwise inserts key and sets *value to the new (unset) slot.
+  // The slot is valid until the next call.
+  bool find_or_insert(const vertex_index &key, unsigned int **value) {
+    if ((count_ + 1) * 2 > slots_.size()) {
+      grow();
+    }
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+      slot &s = slots_[i];
+      if (s.generation != generation_) {
+        s.v_idx = key.v_idx;
+        s.vt_idx = key.vt_idx;
+        s.vn_idx = key.vn_idx;
+        s.generation = generation_;
+        count_++;
+        *value = &s.value;
+        return false;
+      }
+      if (s.v_idx == key.v_idx && s.vt_idx == key.vt_idx &&
+          s.vn_idx == key.vn_idx) {
+        *value = &s.value;
+        return true;
+      }
+    }
+  }
+
+private:
+  struct slot {
+    int v_idx, vt_idx, vn_idx;
+    unsigned int value;
+    unsigned int generation;
+  };
+
+  static size_t hash(const vertex_index &key) {
+    unsigned long long h =
+        static_cast<unsigned int>(key.v_idx) * 0x9E3779B97F4A7C15ULL;
+    h ^= static_cast<unsigned int>(key.vt_idx) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= static_cast<unsigned int>(key.vn_idx) * 0x165667B19E3779F9ULL;
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+
+  void grow() {
+    std::vector<slot> old;
+    old.swap(slots_);
+    slot empty;
+    empty.generation = 0;
+    slots_.assign(old.empty() ? 64 : old.size() * 2, empty);
+    unsigned int current = generation_;
+    generation_ = 1;
+    count_ = 0;
+    for (size_t i = 0; i < old.size(); i++) {
+      if (old[i].generation == current) {
+        unsigned int *value;
+        find_or_insert(
+            vertex_index(old[i].v_idx, old[i].vt_idx, old[i].vn_idx), &value);
+        *value = old[i].value;
+      }
+    }
+  }
+
+  std::vector<slot> slots_;
+  size_t count_;
+  unsigned int generation_;
+};
+
+// The std::map from a (v, vt, vn) triple to its flattened vertex that every
+// face group built before vertex_cache, kept as a reference to benchmark and
+// check it against.
+class map_vertex_cache {
+public:
+  void clear() { map_.clear(); }
+
+  bool find_or_insert(const vertex_index &key, unsigned int **value) {
+    std::pair<std::map<vertex_index, unsigned int, less>::iterator, bool> it =
+        map_.insert(std::make_pair(key, 0u));
+    *value = &it.first->second;
+    return !it.second;
+  }
+
+private:
+  struct less {
+    bool operator()(const vertex_index &a, const vertex_index &b) const {
+      if (a.v_idx != b.v_idx)
+        return (a.v_idx < b.v_idx);
+      if (a.vn_idx != b.vn_idx)
+        return (a.vn_idx < b.vn_idx);
+      return (a.vt_idx < b.vt_idx);
+    }
+  };
+
+  std::map<vertex_index, unsigned int, less> map_;
+};
 
 struct obj_shape {
   std::vector<float> v;
@@ -212,10 +465,11 @@ static inline bool isNewLine(const char c) {
   return (c == '\r') || (c == '\n') || (c == '\0');
 }
 
-// Make index zero-base, and also support relative index.
-static inline int fixIndex(int idx, int n) {
+// Make index zero-base, and also support relative index. Absolute indices
+// are offset by the records before `base`.
+static inline int fixIndex(int idx, int n, int base = 0) {
   if (idx > 0)
-    return idx - 1;
+    return idx - 1 - base;
   if (idx == 0)
     return 0;
   return n + idx; // negative value = relative
@@ -224,207 +478,348 @@ static inline int fixIndex(int idx, int n) {
 static inline std::string parseString(const char *&token) {
   std::string s;
   token += strspn(token, " \t");
-  size_t e = strcspn(token, " \t\r");
+  size_t e = strcspn(token, " \t\r\n");
   s = std::string(token, &token[e]);
   token += e;
   return s;
 }
 
-static inline int parseInt(const char *&token) {
-  token += strspn(token, " \t");
-  int i = atoi(token);
-  token += strcspn(token, " \t\r");
-  return i;
+static inline unsigned countTrailingZeros(unsigned x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return static_cast<unsigned>(i);
+#else
+  return static_cast<unsigned>(__builtin_ctz(x));
+#endif
 }
 
-// Tries to parse a floating point number located at s.
-//
-// s_end should be a location in the string where reading should absolutely
-// stop. For example at the end of the string, to prevent buffer overflows.
+// True if n bytes starting at p lie in a single memory page. Vector loads are
+// only issued in padded buffers and when this holds, so reading past the end
+// of a token in a mapped file can never touch an unmapped page.
+static inline bool inSamePage(const char *p, size_t n) {
+  return (reinterpret_cast<size_t>(p) & 4095) + n <= 4096;
+}
+
+// Copy of a line with TINYOBJ_PARSE_PADDING zero bytes on each side, so the
+// copy is terminated and can be parsed as a padded buffer.
+class padded_line {
+public:
+  const char *assign(const char *line, size_t size) {
+    buf_.assign(size + 2 * TINYOBJ_PARSE_PADDING, '\0');
+    memcpy(&buf_[TINYOBJ_PARSE_PADDING], line, size);
+    return &buf_[TINYOBJ_PARSE_PADDING];
+  }
+
+private:
+  std::vector<char> buf_;
+};
+
+// Returns the number of consecutive decimal digits at p. Vector loads read up
+// to 31 bytes past them, so they need a padded buffer.
+static inline size_t countDigits(const char *p, bool padded) {
+  size_t n = 0;
+#if defined(TINYOBJ_USE_AVX2)
+  const __m256i below = _mm256_set1_epi8('0' - 1);
+  const __m256i above = _mm256_set1_epi8('9' + 1);
+  while (padded && inSamePage(p + n, 32)) {
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + n));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, below),
+                                     _mm256_cmpgt_epi8(above, c));
+    unsigned other = ~static_cast<unsigned>(_mm256_movemask_epi8(digit));
+    if (other != 0) {
+      return n + countTrailingZeros(other);
+    }
+    n += 32;
+  }
+#elif defined(TINYOBJ_USE_SSE2)
+  const __m128i below = _mm_set1_epi8('0' - 1);
+  const __m128i above = _mm_set1_epi8('9' + 1);
+  while (padded && inSamePage(p + n, 16)) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + n));
+    __m128i digit =
+        _mm_and_si128(_mm_cmpgt_epi8(c, below), _mm_cmpgt_epi8(above, c));
+    unsigned other = ~static_cast<unsigned>(_mm_movemask_epi8(digit)) & 0xFFFF;
+    if (other != 0) {
+      return n + countTrailingZeros(other);
+    }
+    n += 16;
+  }
+#else
+  (void)padded;
+#endif
+  while (p[n] >= '0' && p[n] <= '9') {
+    n++;
+  }
+  return n;
+}
+
+#ifdef TINYOBJ_USE_SSE2
+// Byte i of (kDigitMask + n) is 0xFF when i >= 16 - n.
+static const unsigned char kDigitMask[32] = {
+    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    0,    0,    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+#endif
+
+// Returns the value of the n <= 16 decimal digits at p. The vector load reads
+// up to 15 bytes before them, so it needs a padded buffer.
+static inline unsigned long long digitsToInt(const char *p, size_t n,
+                                             bool padded) {
+#ifdef TINYOBJ_USE_SSE2
+  if (padded && n > 0 && inSamePage(p + n - 16, 16)) {
+    // Load the 16 bytes ending at the last digit so the digits are right
+    // aligned, clear the bytes in front of them and reduce with pairwise
+    // multiply-adds: 1 -> 2 -> 4 -> 8 digit lanes.
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + n - 16));
+    __m128i d = _mm_subs_epu8(c, _mm_set1_epi8('0'));
+    d = _mm_and_si128(
+        d, _mm_loadu_si128(reinterpret_cast<const __m128i *>(kDigitMask + n)));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(d, zero),
+                                _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1));
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(d, zero),
+                                _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1));
+    __m128i v = _mm_madd_epi16(_mm_packs_epi32(lo, hi),
+                               _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    v = _mm_madd_epi16(_mm_packs_epi32(v, v),
+                       _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+    unsigned long long upper =
+        static_cast<unsigned int>(_mm_cvtsi128_si32(v));
+    unsigned long long lower =
+        static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(v, 4)));
+    return upper * 100000000ULL + lower;
+  }
+#else
+  (void)padded;
+#endif
+  unsigned long long value = 0;
+  for (size_t i = 0; i < n; i++) {
+    value = value * 10 + static_cast<unsigned long long>(p[i] - '0');
+  }
+  return value;
+}
+
+// Parses a signed decimal integer at token like atoi, and advances token
+// past it.
+static inline int parseIntDigits(const char *&token, bool padded) {
+  const char *p = token;
+  bool negative = false;
+  if (*p == '+' || *p == '-') {
+    negative = (*p == '-');
+    p++;
+  }
+  size_t n = countDigits(p, padded);
+  if (n == 0) {
+    return 0;
+  }
+  int value =
+      (n <= 16) ? static_cast<int>(digitsToInt(p, n, padded)) : atoi(p);
+  token = p + n;
+  return negative ? -value : value;
+}
+
+// Parses a floating point number located at s.
 //
-// Parses the following EBNF grammar:
+// Accepts the following EBNF grammar:
 //   sign    = "+" | "-" ;
-//   END     = ? anything not in digit ?
 //   digit   = "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9" ;
-//   integer = [sign] , digit , {digit} ;
-//   decimal = integer , ["." , integer] ;
-//   float   = ( decimal , END ) | ( decimal , ("E" | "e") , integer , END ) ;
-//
-//  Valid strings are for example:
-//   -0	 +3.1417e+2  -0.0E-3  1.0324  -1.41   11e2
-//
-// If the parsing is a success, result is set to the parsed value and true
-// is returned.
+//   decimal = [sign] , ( digit , {digit} , ["." , {digit}]
+//                      | "." , digit , {digit} ) ;
+//   float   = decimal , [("E" | "e") , [sign] , digit , {digit}] ;
 //
-// The function is greedy and will parse until any of the following happens:
-//  - a non-conforming character is encountered.
-//  - s_end is reached.
+// Digit runs are scanned and converted with SSE2/AVX2 when available and s is
+// in a padded buffer, see TINYOBJ_PARSE_PADDING. When
+// the mantissa has at most 19 digits and fits in 53 bits, and the decimal
+// exponent is within [-22, 22], both the mantissa and the power of ten are
+// exact doubles and a single multiply or divide gives the correctly rounded
+// result. Everything else goes to strtod, so the returned value is always
+// identical to strtod(s).
 //
-// The following situations triggers a failure:
-//  - s >= s_end.
-//  - parse failure.
-//
-static bool tryParseDouble(const char *s, const char *s_end, double *result) {
-  if (s >= s_end) {
+// Returns false if no number was found at s. *end is set to the first
+// character after the number.
+static bool parseDouble(const char *s, const char **end, double *result,
+                        bool padded) {
+  static const double kPow10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  static const unsigned long long kPow10Int[] = {
+      1ULL,
+      10ULL,
+      100ULL,
+      1000ULL,
+      10000ULL,
+      100000ULL,
+      1000000ULL,
+      10000000ULL,
+      100000000ULL,
+      1000000000ULL,
+      10000000000ULL,
+      100000000000ULL,
+      1000000000000ULL,
+      10000000000000ULL,
+      100000000000000ULL,
+      1000000000000000ULL,
+      10000000000000000ULL};
+
+  const char *p = s;
+  bool negative = false;
+  if (*p == '+' || *p == '-') {
+    negative = (*p == '-');
+    p++;
+  }
+
+  const char *intDigits = p;
+  size_t intLen = countDigits(p, padded);
+  p += intLen;
+
+  const char *fracDigits = p;
+  size_t fracLen = 0;
+  if (*p == '.') {
+    fracDigits = p + 1;
+    fracLen = countDigits(fracDigits, padded);
+    if (intLen + fracLen > 0) {
+      p = fracDigits + fracLen;
+    }
+  }
+
+  if (intLen + fracLen == 0) {
     return false;
   }
 
-  double mantissa = 0.0;
-  // This exponent is base 2 rather than 10.
-  // However the exponent we parse is supposed to be one of ten,
-  // thus we must take care to convert the exponent/and or the
-  // mantissa to a * 2^E, where a is the mantissa and E is the
-  // exponent.
-  // To get the final double we will use ldexp, it requires the
-  // exponent to be in base 2.
-  int exponent = 0;
+  bool exact = (intLen <= 16) && (fracLen <= 16) && (intLen + fracLen <= 19);
 
-  // NOTE: THESE MUST BE DECLARED HERE SINCE WE ARE NOT ALLOWED
-  // TO JUMP OVER DEFINITIONS.
-  char sign = '+';
-  char exp_sign = '+';
-  char const *curr = s;
-
-  // How many characters were read in a loop.
-  int read = 0;
-  // Tells whether a loop terminated due to reaching s_end.
-  bool end_not_reached = false;
-
-  /*
-          BEGIN PARSING.
-  */
-
-  // Find out what sign we've got.
-  if (*curr == '+' || *curr == '-') {
-    sign = *curr;
-    curr++;
-  } else if (isdigit(*curr)) { /* Pass through. */
-  } else {
-    goto fail;
-  }
-
-  // Read the integer part.
-  while ((end_not_reached = (curr != s_end)) && isdigit(*curr)) {
-    mantissa *= 10;
-    mantissa += static_cast<int>(*curr - 0x30);
-    curr++;
-    read++;
-  }
-
-  // We must make sure we actually got something.
-  if (read == 0)
-    goto fail;
-  // We allow numbers of form "#", "###" etc.
-  if (!end_not_reached)
-    goto assemble;
-
-  // Read the decimal part.
-  if (*curr == '.') {
-    curr++;
-    read = 1;
-    while ((end_not_reached = (curr != s_end)) && isdigit(*curr)) {
-      // NOTE: Don't use powf here, it will absolutely murder precision.
-      mantissa += static_cast<int>(*curr - 0x30) * pow(10.0, -read);
-      read++;
-      curr++;
+  int exponent = 0;
+  if (*p == 'e' || *p == 'E') {
+    const char *e = p + 1;
+    bool expNegative = false;
+    if (*e == '+' || *e == '-') {
+      expNegative = (*e == '-');
+      e++;
+    }
+    // "1e" and "1e+" end before the 'e', like strtod.
+    size_t expLen = countDigits(e, padded);
+    if (expLen > 0) {
+      if (expLen <= 4) {
+        exponent = static_cast<int>(digitsToInt(e, expLen, padded));
+        exponent = expNegative ? -exponent : exponent;
+      } else {
+        exact = false;
+      }
+      p = e + expLen;
     }
-  } else if (*curr == 'e' || *curr == 'E') {
-  } else {
-    goto assemble;
   }
 
-  if (!end_not_reached)
-    goto assemble;
+  *end = p;
 
-  // Read the exponent part.
-  if (*curr == 'e' || *curr == 'E') {
-    curr++;
-    // Figure out if a sign is present and if it is.
-    if ((end_not_reached = (curr != s_end)) && (*curr == '+' || *curr == '-')) {
-      exp_sign = *curr;
-      curr++;
-    } else if (isdigit(*curr)) { /* Pass through. */
-    } else {
-      // Empty E is not allowed.
-      goto fail;
-    }
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD != 0)
+  // Extended precision intermediates (x87) break the exact fast path.
+  exact = false;
+#endif
+
+  if (exact) {
+    unsigned long long mantissa =
+        digitsToInt(intDigits, intLen, padded) * kPow10Int[fracLen] +
+        digitsToInt(fracDigits, fracLen, padded);
+    exponent -= static_cast<int>(fracLen);
 
-    read = 0;
-    while ((end_not_reached = (curr != s_end)) && isdigit(*curr)) {
-      exponent *= 10;
-      exponent += static_cast<int>(*curr - 0x30);
-      curr++;
-      read++;
+    if (mantissa == 0) {
+      *result = negative ? -0.0 : 0.0;
+      return true;
+    }
+    if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+      double value = static_cast<double>(mantissa);
+      if (exponent < 0) {
+        value /= kPow10[-exponent];
+      } else {
+        value *= kPow10[exponent];
+      }
+      *result = negative ? -value : value;
+      return true;
     }
-    exponent *= (exp_sign == '+' ? 1 : -1);
-    if (read == 0)
-      goto fail;
   }
 
-assemble:
-  *result =
-      (sign == '+' ? 1 : -1) * ldexp(mantissa * pow(5.0, exponent), exponent);
+  // Slow path, strtod needs a terminated copy of the number.
+  size_t len = static_cast<size_t>(p - s);
+  char buf[64];
+  if (len < sizeof(buf)) {
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *result = strtod(buf, NULL);
+  } else {
+    std::string str(s, len);
+    *result = strtod(str.c_str(), NULL);
+  }
   return true;
-fail:
-  return false;
 }
-static inline float parseFloat(const char *&token) {
+
+static inline int parseInt(const char *&token, bool padded) {
+  token += strspn(token, " \t");
+  int i = parseIntDigits(token, padded);
+  token += strcspn(token, " \t\r\n");
+  return i;
+}
+
+static inline float parseFloat(const char *&token, bool padded) {
   token += strspn(token, " \t");
 #ifdef TINY_OBJ_LOADER_OLD_FLOAT_PARSER
+  (void)padded;
   float f = (float)atof(token);
-  token += strcspn(token, " \t\r");
+  token += strcspn(token, " \t\r\n");
 #else
-  const char *end = token + strcspn(token, " \t\r");
+  const char *end = token;
   double val = 0.0;
-  tryParseDouble(token, end, &val);
+  parseDouble(token, &end, &val, padded);
   float f = static_cast<float>(val);
-  token = end;
+  token = end + strcspn(end, " \t\r\n");
 #endif
   return f;
 }
 
-static inline void parseFloat2(float &x, float &y, const char *&token) {
-  x = parseFloat(token);
-  y = parseFloat(token);
+static inline void parseFloat2(float &x, float &y, const char *&token,
+                               bool padded) {
+  x = parseFloat(token, padded);
+  y = parseFloat(token, padded);
 }
 
 static inline void parseFloat3(float &x, float &y, float &z,
-                               const char *&token) {
-  x = parseFloat(token);
-  y = parseFloat(token);
-  z = parseFloat(token);
+                               const char *&token, bool padded) {
+  x = parseFloat(token, padded);
+  y = parseFloat(token, padded);
+  z = parseFloat(token, padded);
 }
 
 static tag_sizes parseTagTriple(const char *&token) {
   tag_sizes ts;
 
   ts.num_ints = atoi(token);
-  token += strcspn(token, "/ \t\r");
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return ts;
   }
   token++;
 
   ts.num_floats = atoi(token);
-  token += strcspn(token, "/ \t\r");
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return ts;
   }
   token++;
 
   ts.num_strings = atoi(token);
-  token += strcspn(token, "/ \t\r") + 1;
+  token += strcspn(token, "/ \t\r\n");
 
   return ts;
 }
 
 // Parse triples: i, i/j/k, i//k, i/j
-static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
-                                int vtsize) {
+static vertex_index parseTriple(const char *&token, bool padded, int vsize,
+                                int vnsize, int vtsize, int vbase = 0,
+                                int vnbase = 0, int vtbase = 0) {
   vertex_index vi(-1);
 
-  vi.v_idx = fixIndex(atoi(token), vsize);
-  token += strcspn(token, "/ \t\r");
+  vi.v_idx = fixIndex(parseIntDigits(token, padded), vsize, vbase);
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return vi;
   }
@@ -433,37 +828,36 @@ static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
   // i//k
   if (token[0] == '/') {
     token++;
-    vi.vn_idx = fixIndex(atoi(token), vnsize);
-    token += strcspn(token, "/ \t\r");
+    vi.vn_idx = fixIndex(parseIntDigits(token, padded), vnsize, vnbase);
+    token += strcspn(token, "/ \t\r\n");
     return vi;
   }
 
   // i/j/k or i/j
-  vi.vt_idx = fixIndex(atoi(token), vtsize);
-  token += strcspn(token, "/ \t\r");
+  vi.vt_idx = fixIndex(parseIntDigits(token, padded), vtsize, vtbase);
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return vi;
   }
 
   // i/j/k
   token++; // skip '/'
-  vi.vn_idx = fixIndex(atoi(token), vnsize);
-  token += strcspn(token, "/ \t\r");
+  vi.vn_idx = fixIndex(parseIntDigits(token, padded), vnsize, vnbase);
+  token += strcspn(token, "/ \t\r\n");
   return vi;
 }
 
+template <class VertexCache>
 static unsigned int
-updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
-             std::vector<float> &positions, std::vector<float> &normals,
-             std::vector<float> &texcoords,
+updateVertex(VertexCache &vertexCache, std::vector<float> &positions,
+             std::vector<float> &normals, std::vector<float> &texcoords,
              const std::vector<float> &in_positions,
              const std::vector<float> &in_normals,
              const std::vector<float> &in_texcoords, const vertex_index &i) {
-  const std::map<vertex_index, unsigned int>::iterator it = vertexCache.find(i);
-
-  if (it != vertexCache.end()) {
+  unsigned int *cached;
+  if (vertexCache.find_or_insert(i, &cached)) {
     // found cache
-    return it->second;
+    return *cached;
   }
 
   assert(in_positions.size() > static_cast<unsigned int>(3 * i.v_idx + 2));
@@ -486,7 +880,7 @@ updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
   }
 
   unsigned int idx = static_cast<unsigned int>(positions.size() / 3 - 1);
-  vertexCache[i] = idx;
+  *cached = idx;
 
   return idx;
 }
@@ -514,18 +908,37 @@ static void InitMaterial(material_t &material) {
   material.unknown_parameter.clear();
 }
 
+template <class VertexCache>
 static bool exportFaceGroupToShape(
-    shape_t &shape, std::map<vertex_index, unsigned int> vertexCache,
+    shape_t &shape, VertexCache &vertexCache,
     const std::vector<float> &in_positions,
     const std::vector<float> &in_normals,
     const std::vector<float> &in_texcoords,
     const std::vector<std::vector<vertex_index> > &faceGroup,
     std::vector<tag_t> &tags, const int material_id, const std::string &name,
-    bool clearCache, bool triangulate) {
+    unsigned int group, bool clearCache, bool triangulate) {
   if (faceGroup.empty()) {
     return false;
   }
 
+  for (int k = 0; k < 3; k++) {
+    shape.min_index[k] = shape.max_index[k] = -1;
+  }
+  for (size_t i = 0; i < faceGroup.size(); i++) {
+    for (size_t k = 0; k < faceGroup[i].size(); k++) {
+      const vertex_index &vi = faceGroup[i][k];
+      int idx[3] = {vi.v_idx, vi.vt_idx, vi.vn_idx};
+      for (int c = 0; c < 3; c++) {
+        if (idx[c] < 0)
+          continue;
+        if (shape.min_index[c] < 0 || idx[c] < shape.min_index[c])
+          shape.min_index[c] = idx[c];
+        if (idx[c] > shape.max_index[c])
+          shape.max_index[c] = idx[c];
+      }
+    }
+  }
+
   // Flatten vertices and indices
   for (size_t i = 0; i < faceGroup.size(); i++) {
     const std::vector<vertex_index> &face = faceGroup[i];
@@ -577,6 +990,7 @@ static bool exportFaceGroupToShape(
   }
 
   shape.name = name;
+  shape.group = group;
   shape.mesh.tags.swap(tags);
 
   if (clearCache)
@@ -594,28 +1008,25 @@ void LoadMtl(std::map<std::string, int> &material_map,
 
   size_t maxchars = 8192;          // Alloc enough size.
   std::vector<char> buf(maxchars); // Alloc enough size.
+  padded_line linebuf;
   while (inStream.peek() != -1) {
     inStream.getline(&buf[0], static_cast<std::streamsize>(maxchars));
 
-    std::string linebuf(&buf[0]);
+    size_t len = strlen(&buf[0]);
 
     // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
-    }
+    if (len > 0 && buf[len - 1] == '\n')
+      len--;
+    if (len > 0 && buf[len - 1] == '\r')
+      len--;
 
     // Skip if empty line.
-    if (linebuf.empty()) {
+    if (len == 0) {
       continue;
     }
 
     // Skip leading space.
-    const char *token = linebuf.c_str();
+    const char *token = linebuf.assign(&buf[0], len);
     token += strspn(token, " \t");
 
     assert(token);
@@ -653,7 +1064,7 @@ void LoadMtl(std::map<std::string, int> &material_map,
     if (token[0] == 'K' && token[1] == 'a' && isSpace((token[2]))) {
       token += 2;
       float r, g, b;
-      parseFloat3(r, g, b, token);
+      parseFloat3(r, g, b, token, true);
       material.ambient[0] = r;
       material.ambient[1] = g;
       material.ambient[2] = b;
@@ -664,7 +1075,7 @@ void LoadMtl(std::map<std::string, int> &material_map,
     if (token[0] == 'K' && token[1] == 'd' && isSpace((token[2]))) {
       token += 2;
       float r, g, b;
-      parseFloat3(r, g, b, token);
+      parseFloat3(r, g, b, token, true);
       material.diffuse[0] = r;
       material.diffuse[1] = g;
       material.diffuse[2] = b;
@@ -675,7 +1086,7 @@ void LoadMtl(std::map<std::string, int> &material_map,
     if (token[0] == 'K' && token[1] == 's' && isSpace((token[2]))) {
       token += 2;
       float r, g, b;
-      parseFloat3(r, g, b, token);
+      parseFloat3(r, g, b, token, true);
       material.specular[0] = r;
       material.specular[1] = g;
       material.specular[2] = b;
@@ -686,7 +1097,7 @@ void LoadMtl(std::map<std::string, int> &material_map,
     if (token[0] == 'K' && token[1] == 't' && isSpace((token[2]))) {
       token += 2;
       float r, g, b;
-      parseFloat3(r, g, b, token);
+      parseFloat3(r, g, b, token, true);
       material.transmittance[0] = r;
       material.transmittance[1] = g;
       material.transmittance[2] = b;
@@ -696,7 +1107,7 @@ void LoadMtl(std::map<std::string, int> &material_map,
     // ior(index of refraction)
     if (token[0] == 'N' && token[1] == 'i' && isSpace((token[2]))) {
       token += 2;
-      material.ior = parseFloat(token);
+      material.ior = parseFloat(token, true);
       continue;
     }
 
@@ -704,7 +1115,7 @@ void LoadMtl(std::map<std::string, int> &material_map,
     if (token[0] == 'K' && token[1] == 'e' && isSpace(token[2])) {
       token += 2;
       float r, g, b;
-      parseFloat3(r, g, b, token);
+      parseFloat3(r, g, b, token, true);
       material.emission[0] = r;
       material.emission[1] = g;
       material.emission[2] = b;
@@ -714,27 +1125,27 @@ void LoadMtl(std::map<std::string, int> &material_map,
     // shininess
     if (token[0] == 'N' && token[1] == 's' && isSpace(token[2])) {
       token += 2;
-      material.shininess = parseFloat(token);
+      material.shininess = parseFloat(token, true);
       continue;
     }
 
     // illum model
     if (0 == strncmp(token, "illum", 5) && isSpace(token[5])) {
       token += 6;
-      material.illum = parseInt(token);
+      material.illum = parseInt(token, true);
       continue;
     }
 
     // dissolve
     if ((token[0] == 'd' && isSpace(token[1]))) {
       token += 1;
-      material.dissolve = parseFloat(token);
+      material.dissolve = parseFloat(token, true);
       continue;
     }
     if (token[0] == 'T' && token[1] == 'r' && isSpace(token[2])) {
       token += 2;
       // Invert value of Tr(assume Tr is in range [0, 1])
-      material.dissolve = 1.0f - parseFloat(token);
+      material.dissolve = 1.0f - parseFloat(token, true);
       continue;
     }
 
@@ -861,11 +1272,20 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
   return LoadObj(shapes, materials, err, ifs, matFileReader, trianglulate, generateNormals);
 }
 
-bool LoadObj(std::vector<shape_t> &shapes,       // [output]
-             std::vector<material_t> &materials, // [output]
-             std::string &err, std::istream &inStream,
-             MaterialReader &readMatFn, bool triangulate, bool generateNormals) {
-  std::stringstream errss;
+// Face group waiting to be exported to a shape.
+struct pending_group {
+  std::vector<std::vector<vertex_index> > faceGroup;
+  std::vector<tag_t> tags;
+  int material;
+  std::string name;
+  unsigned int group;
+};
+
+// Parser state shared by the stream and memory-mapped OBJ loaders.
+struct obj_parse_state {
+  obj_parse_state()
+      : material(-1), group(0), v_base(0), vn_base(0), vt_base(0),
+        group_only(false), deferred(NULL) {}
 
   std::vector<float> v;
   std::vector<float> vn;
@@ -876,74 +1296,660 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
 
   // material
   std::map<std::string, int> material_map;
-  std::map<vertex_index, unsigned int> vertexCache;
-  int material = -1;
+  vertex_cache vertexCache;
+  int material;
+  unsigned int group; // g and o lines seen so far
+
+  // Records before the buffer when loading a single group. Faces must then
+  // only reference records of the group.
+  int v_base, vn_base, vt_base;
+  bool group_only;
 
   shape_t shape;
 
+  // When set, face groups are queued here instead of being exported.
+  std::vector<pending_group> *deferred;
+};
+
+// Copies the whitespace delimited name at token into namebuf.
+// Used in place of sscanf("%s"), which may scan to the end of a mapped
+// buffer looking for a terminating '\0'.
+static inline void parseName(char *namebuf, size_t bufsize,
+                             const char *token) {
+  token += strspn(token, " \t");
+  size_t len = strcspn(token, " \t\r\n");
+  if (len >= bufsize) {
+    len = bufsize - 1;
+  }
+  memcpy(namebuf, token, len);
+  namebuf[len] = '\0';
+}
+
+// Flush the pending face group of st into a new shape.
+static void exportCurrentGroup(obj_parse_state &st,
+                               std::vector<shape_t> &shapes,
+                               bool triangulate) {
+  if (st.deferred) {
+    if (!st.faceGroup.empty()) {
+      st.deferred->push_back(pending_group());
+      pending_group &group = st.deferred->back();
+      group.faceGroup.swap(st.faceGroup);
+      group.tags.swap(st.tags);
+      group.material = st.material;
+      group.name = st.name;
+      group.group = st.group;
+    }
+    st.shape = shape_t();
+    st.faceGroup.clear();
+    return;
+  }
+
+  bool ret = exportFaceGroupToShape(st.shape, st.vertexCache, st.v, st.vn,
+                                    st.vt, st.faceGroup, st.tags, st.material,
+                                    st.name, st.group, true, triangulate);
+  if (ret) {
+    shapes.push_back(st.shape);
+  }
+  st.shape = shape_t();
+  st.faceGroup.clear();
+}
+
+// Parses a single line of .obj data. The line at token ends at the first
+// '\n', '\r' or '\0', so it may point straight into a larger buffer, which is
+// padded if `padded` is set. Returns false when loading must stop.
+static bool parseObjLine(obj_parse_state &st, const char *token, bool padded,
+                         std::vector<shape_t> &shapes,
+                         std::vector<material_t> &materials, std::string &err,
+                         MaterialReader &readMatFn, bool triangulate) {
+  // Skip leading space.
+  token += strspn(token, " \t");
+
+  assert(token);
+  if (isNewLine(token[0]))
+    return true; // empty line
+
+  if (token[0] == '#')
+    return true; // comment line
+
+  // vertex
+  if (token[0] == 'v' && isSpace((token[1]))) {
+    token += 2;
+    float x, y, z;
+    parseFloat3(x, y, z, token, padded);
+    st.v.push_back(x);
+    st.v.push_back(y);
+    st.v.push_back(z);
+    return true;
+  }
+
+  // normal
+  if (token[0] == 'v' && token[1] == 'n' && isSpace((token[2]))) {
+    token += 3;
+    float x, y, z;
+    parseFloat3(x, y, z, token, padded);
+    st.vn.push_back(x);
+    st.vn.push_back(y);
+    st.vn.push_back(z);
+    return true;
+  }
+
+  // texcoord
+  if (token[0] == 'v' && token[1] == 't' && isSpace((token[2]))) {
+    token += 3;
+    float x, y;
+    parseFloat2(x, y, token, padded);
+    st.vt.push_back(x);
+    st.vt.push_back(y);
+    return true;
+  }
+
+  // face
+  if (token[0] == 'f' && isSpace((token[1]))) {
+    token += 2;
+    token += strspn(token, " \t");
+
+    std::vector<vertex_index> face;
+    int vsize = static_cast<int>(st.v.size() / 3);
+    int vnsize = static_cast<int>(st.vn.size() / 3);
+    int vtsize = static_cast<int>(st.vt.size() / 2);
+    while (!isNewLine(token[0])) {
+      vertex_index vi = parseTriple(token, padded, vsize, vnsize, vtsize,
+                                    st.v_base, st.vn_base, st.vt_base);
+      if (st.group_only &&
+          (vi.v_idx < 0 || vi.v_idx >= vsize || vi.vn_idx >= vnsize ||
+           vi.vt_idx >= vtsize || vi.vn_idx < -1 || vi.vt_idx < -1)) {
+        err += "Face references a vertex outside of its group.\n";
+        return false;
+      }
+      face.push_back(vi);
+      size_t n = strspn(token, " \t\r");
+      token += n;
+    }
+
+    st.faceGroup.push_back(face);
+
+    return true;
+  }
+
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6)) && isSpace((token[6]))) {
+
+    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    token += 7;
+    parseName(namebuf, sizeof(namebuf), token);
+
+    // Create face group per material.
+    exportCurrentGroup(st, shapes, triangulate);
+
+    if (st.material_map.find(namebuf) != st.material_map.end()) {
+      st.material = st.material_map[namebuf];
+    } else {
+      // { error!! material not found }
+      st.material = -1;
+    }
+
+    return true;
+  }
+
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && isSpace((token[6]))) {
+    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    token += 7;
+    parseName(namebuf, sizeof(namebuf), token);
+
+    std::string err_mtl;
+    bool ok = readMatFn(namebuf, materials, st.material_map, err_mtl);
+    err += err_mtl;
+
+    if (!ok) {
+      st.faceGroup.clear(); // for safety
+      return false;
+    }
+
+    return true;
+  }
+
+  // group name
+  if (token[0] == 'g' && isSpace((token[1]))) {
+
+    // flush previous face group.
+    exportCurrentGroup(st, shapes, triangulate);
+    st.group++;
+
+    // material = -1;
+
+    std::vector<std::string> names;
+    while (!isNewLine(token[0])) {
+      std::string str = parseString(token);
+      names.push_back(str);
+      token += strspn(token, " \t\r"); // skip tag
+    }
+
+    assert(names.size() > 0);
+
+    // names[0] must be 'g', so skip the 0th element.
+    if (names.size() > 1) {
+      st.name = names[1];
+    } else {
+      st.name = "";
+    }
+
+    return true;
+  }
+
+  // object name
+  if (token[0] == 'o' && isSpace((token[1]))) {
+
+    // flush previous face group.
+    exportCurrentGroup(st, shapes, triangulate);
+    st.group++;
+
+    // material = -1;
+
+    // @todo { multiple object name? }
+    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    token += 2;
+    parseName(namebuf, sizeof(namebuf), token);
+    st.name = std::string(namebuf);
+
+    return true;
+  }
+
+  if (token[0] == 't' && isSpace(token[1])) {
+    tag_t tag;
+
+    char namebuf[4096];
+    token += 2;
+    parseName(namebuf, sizeof(namebuf), token);
+    tag.name = std::string(namebuf);
+
+    // The mmap, parallel and group loaders parse in place, so every advance
+    // stops at the end of the line instead of running into the next one.
+    token += strspn(token, " \t");
+    token += strcspn(token, " \t\r\n");
+    token += strspn(token, " \t");
+    tag_sizes ts;
+    if (!isNewLine(token[0])) {
+      ts = parseTagTriple(token);
+    }
+
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints > 0 ? ts.num_ints : 0));
+    for (size_t i = 0; i < tag.intValues.size(); ++i) {
+      token += strspn(token, " \t");
+      if (isNewLine(token[0])) break;
+      tag.intValues[i] = atoi(token);
+      token += strcspn(token, "/ \t\r\n");
+      if (token[0] == '/') token++;
+    }
+
+    tag.floatValues.resize(static_cast<size_t>(ts.num_floats > 0 ? ts.num_floats : 0));
+    for (size_t i = 0; i < tag.floatValues.size(); ++i) {
+      token += strspn(token, " \t");
+      if (isNewLine(token[0])) break;
+      tag.floatValues[i] = parseFloat(token, padded);
+      token += strcspn(token, "/ \t\r\n");
+      if (token[0] == '/') token++;
+    }
+
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings > 0 ? ts.num_strings : 0));
+    for (size_t i = 0; i < tag.stringValues.size(); ++i) {
+      char stringValueBuffer[4096];
+
+      token += strspn(token, " \t");
+      if (isNewLine(token[0])) break;
+      parseName(stringValueBuffer, sizeof(stringValueBuffer), token);
+      tag.stringValues[i] = stringValueBuffer;
+      token += strcspn(token, " \t\r\n");
+    }
+
+    st.tags.push_back(tag);
+  }
+
+  // Ignore unknown command.
+  return true;
+}
+
+// Append a face normal for every vertex of shape.
+static void generateShapeNormals(shape_t &shape) {
+	  assert((shape.mesh.positions.size() % 3) == 0);
+	  float nx, ny, nz = 0.0f; // normal for current triangle
+	  float vx1, vx2, vx3 = 0.f; // vertex 1
+	  float vy1, vy2, vy3 = 0.f; // vertex 2
+	  float vz1, vz2, vz3 = 0.f; // vertex 3
+	  for (size_t v = 0; v < shape.mesh.positions.size() / 3; v++) {
+		  float x = shape.mesh.positions[3.f*v];
+		  float y = shape.mesh.positions[3.f*v+1];
+		  float z = shape.mesh.positions[3.f*v+2];
+		  switch(v % 3) {
+		  case 0:
+			  vx1 = x;
+			  vy1 = y;
+			  vz1 = z;
+			  break;
+			  // Defining first point in triangle
+		  case 1:
+			  // Defining second point in triangle
+			  vx2 = x;
+			  vy2 = y;
+			  vz2 = z;
+			  break;
+		  case 2:
+			  // Defining third point in a triangle
+			  vx3 = x;
+			  vy3 = y;
+			  vz3 = z;
+			  float qx, qy, qz, px, py, pz;
+			  // Calculate q vector
+			  qx = vx2 - vx1;
+			  qy = vy2 - vy1;
+			  qz = vz2 - vz1;
+			  // Calculate p vector
+			  px = vx3 - vx1;
+			  py = vy3 - vy1;
+			  pz = vz3 - vz1;
+			  // Calculate normal
+			  nx = py * qz - pz * qy;
+			  ny = pz * qx - px * qz;
+			  nz = px * qy - py * qx;
+
+			  // Scale to unit vector
+			  float s = sqrt(nx*nx + ny*ny + nz*nz);
+			  nx /= s;
+			  ny /= s;
+			  nz /= s;
+
+			  // Add the normal 3 times (once for each vertex)
+			  for(int j=0; j<3; j++) {
+				  shape.mesh.normals.push_back(nx);
+				  shape.mesh.normals.push_back(ny);
+				  shape.mesh.normals.push_back(nz);
+			  }
+			  break;
+		  }
+	  }
+}
+
+// Flush the last face group and optionally generate normals.
+static void finishObj(obj_parse_state &st, std::vector<shape_t> &shapes,
+                      bool triangulate, bool generateNormals) {
+  exportCurrentGroup(st, shapes, triangulate);
+
+  if(generateNormals) {
+	  // Ensure there are no normals loaded
+	  st.vn.clear();
+	  for (size_t i = 0; i < shapes.size(); i++) {
+		  generateShapeNormals(shapes[i]);
+	  }
+  }
+}
+
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err, std::istream &inStream,
+             MaterialReader &readMatFn, bool triangulate, bool generateNormals) {
+  std::stringstream errss;
+
+  obj_parse_state st;
+
   int maxchars = 8192;                                  // Alloc enough size.
   std::vector<char> buf(static_cast<size_t>(maxchars)); // Alloc enough size.
+  padded_line linebuf;
   while (inStream.peek() != -1) {
     inStream.getline(&buf[0], maxchars);
 
-    std::string linebuf(&buf[0]);
+    size_t len = strlen(&buf[0]);
 
     // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
-    }
+    if (len > 0 && buf[len - 1] == '\n')
+      len--;
+    if (len > 0 && buf[len - 1] == '\r')
+      len--;
 
     // Skip if empty line.
-    if (linebuf.empty()) {
+    if (len == 0) {
       continue;
     }
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
+    if (!parseObjLine(st, linebuf.assign(&buf[0], len), true, shapes,
+                      materials, err, readMatFn, triangulate)) {
+      return false;
+    }
+  }
+
+  finishObj(st, shapes, triangulate, generateNormals);
+
+  err += errss.str();
+
+  return true;
+}
+
+// Parses every line of `size` bytes at buf into st.
+static bool parseObjBuffer(obj_parse_state &st, const char *buf, size_t size,
+                           bool padded, std::vector<shape_t> &shapes,
+                           std::vector<material_t> &materials,
+                           std::string &err, MaterialReader &readMatFn,
+                           bool triangulate) {
+  const char *p = buf;
+  const char *end = buf + size;
+  while (p < end) {
+    const char *eol =
+        static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (eol == NULL) {
+      // The last line is not terminated, so the tokenizer could read past the
+      // end of the buffer. Copy just this line to terminate it.
+      padded_line tail;
+      if (!parseObjLine(st, tail.assign(p, static_cast<size_t>(end - p)), true,
+                        shapes, materials, err, readMatFn, triangulate)) {
+        return false;
+      }
+      break;
+    }
+
+    if (!parseObjLine(st, p, padded, shapes, materials, err, readMatFn,
+                      triangulate)) {
+      return false;
+    }
+    p = eol + 1;
+  }
+  return true;
+}
+
+bool LoadObjFromMemory(std::vector<shape_t> &shapes,       // [output]
+                       std::vector<material_t> &materials, // [output]
+                       std::string &err, const char *buf, size_t size,
+                       MaterialReader &readMatFn, bool triangulate,
+                       bool generateNormals, bool padded) {
+  obj_parse_state st;
+
+  if (!parseObjBuffer(st, buf, size, padded, shapes, materials, err, readMatFn,
+                      triangulate)) {
+    return false;
+  }
+
+  finishObj(st, shapes, triangulate, generateNormals);
+
+  return true;
+}
+
+void ScanObjGroups(std::vector<group_t> &groups, const char *buf,
+                   size_t size) {
+  groups.clear();
+  groups.push_back(group_t());
+  groups.back().offset = 0;
+  groups.back().v_base = groups.back().vn_base = groups.back().vt_base = 0;
+
+  size_t v = 0, vn = 0, vt = 0;
+  std::string material;
+  const char *p = buf;
+  const char *end = buf + size;
+  while (p < end) {
+    const char *eol =
+        static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    const char *next = eol ? eol + 1 : end;
+
+    // Same line classification as parseObjLine. The unterminated last line
+    // is copied so the checks can't read past the end of the buffer.
+    std::string tail;
+    const char *token = p;
+    if (eol == NULL) {
+      tail.assign(p, end);
+      token = tail.c_str();
+    }
     token += strspn(token, " \t");
 
-    assert(token);
-    if (token[0] == '\0')
-      continue; // empty line
+    if (token[0] == 'v') {
+      if (isSpace(token[1]))
+        v++;
+      else if (token[1] == 'n' && isSpace(token[2]))
+        vn++;
+      else if (token[1] == 't' && isSpace(token[2]))
+        vt++;
+    } else if ((token[0] == 'g' || token[0] == 'o') && isSpace(token[1])) {
+      groups.back().size = static_cast<size_t>(p - buf) - groups.back().offset;
+      groups.push_back(group_t());
+      group_t &group = groups.back();
+      group.offset = static_cast<size_t>(p - buf);
+      group.v_base = v;
+      group.vn_base = vn;
+      group.vt_base = vt;
+      group.material = material;
+    } else if ((0 == strncmp(token, "usemtl", 6)) && isSpace((token[6]))) {
+      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+      parseName(namebuf, sizeof(namebuf), token + 7);
+      material = namebuf;
+    }
+    p = next;
+  }
+  groups.back().size = size - groups.back().offset;
+}
 
-    if (token[0] == '#')
-      continue; // comment line
+// Refuses to load materials, a single group is loaded with the materials of
+// the whole file.
+class GroupMaterialReader : public MaterialReader {
+public:
+  virtual bool operator()(const std::string &matId,
+                          std::vector<material_t> &materials,
+                          std::map<std::string, int> &matMap,
+                          std::string &err) {
+    (void)materials;
+    (void)matMap;
+    err += "Group loads mtllib " + matId + ".\n";
+    return false;
+  }
+};
+
+bool LoadObjGroupFromMemory(std::vector<shape_t> &shapes, std::string &err,
+                            const char *buf, const group_t &group,
+                            unsigned int groupIndex,
+                            const std::map<std::string, int> &material_map,
+                            bool triangulate, bool generateNormals,
+                            bool padded) {
+  obj_parse_state st;
+  st.material_map = material_map;
+  std::map<std::string, int>::const_iterator it =
+      material_map.find(group.material);
+  st.material = it != material_map.end() ? it->second : -1;
+  // Every group but the first starts with the g or o line that counts it.
+  st.group = groupIndex > 0 ? groupIndex - 1 : 0;
+  st.v_base = static_cast<int>(group.v_base);
+  st.vn_base = static_cast<int>(group.vn_base);
+  st.vt_base = static_cast<int>(group.vt_base);
+  st.group_only = true;
+
+  std::vector<material_t> materials;
+  GroupMaterialReader readMatFn;
+  if (!parseObjBuffer(st, buf + group.offset, group.size, padded, shapes,
+                      materials, err, readMatFn, triangulate)) {
+    return false;
+  }
+
+  finishObj(st, shapes, triangulate, generateNormals);
+
+  return true;
+}
+
+// Runs fn(i, worker) for i in [0, count) on up to numThreads threads, where
+// worker in [0, numThreads) identifies the calling thread.
+template <typename Fn>
+static void parallelFor(size_t count, unsigned numThreads, const Fn &fn) {
+  if (numThreads > count) {
+    numThreads = static_cast<unsigned>(count);
+  }
+  std::atomic<size_t> next(0);
+  auto worker = [&](unsigned id) {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i, id);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < numThreads; t++) {
+    threads.push_back(std::thread(worker, t));
+  }
+  worker(0);
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+// Byte range of whole lines handled by one task of LoadObjFromMemoryParallel.
+struct obj_chunk {
+  const char *begin;
+  const char *end;
+  bool padded;      // whether the buffer holding begin and end is padded
+  padded_line tail; // copy of an unterminated last line
+
+  // Number of v, vn and vt records in this chunk and in all chunks before it.
+  size_t vCount, vnCount, vtCount;
+  size_t vBase, vnBase, vtBase;
+
+  std::vector<float> v;
+  std::vector<float> vn;
+  std::vector<float> vt;
+  std::vector<std::vector<vertex_index> > faces;
+
+  // Lines which update parser state (g, o, usemtl, mtllib, t) in file order.
+  // NULL entries stand for the next face in `faces`.
+  std::vector<const char *> records;
+};
+
+// Calls fn(line, padded) for every line of chunk. The unterminated last line
+// of a buffer is copied into chunk.tail first.
+template <typename Fn>
+static void forEachChunkLine(obj_chunk &chunk, const Fn &fn) {
+  const char *p = chunk.begin;
+  while (p < chunk.end) {
+    const char *eol = static_cast<const char *>(
+        memchr(p, '\n', static_cast<size_t>(chunk.end - p)));
+    if (eol == NULL) {
+      fn(chunk.tail.assign(p, static_cast<size_t>(chunk.end - p)), true);
+      return;
+    }
+    fn(p, chunk.padded);
+    p = eol + 1;
+  }
+}
+
+// First pass: count v, vn and vt records so that every chunk knows the
+// global index of its first vertex.
+static void countChunkVertices(obj_chunk &chunk) {
+  chunk.vCount = chunk.vnCount = chunk.vtCount = 0;
+  forEachChunkLine(chunk, [&chunk](const char *token, bool) {
+    token += strspn(token, " \t");
+    if (token[0] != 'v')
+      return;
+    if (isSpace(token[1]))
+      chunk.vCount++;
+    else if (token[1] == 'n' && isSpace(token[2]))
+      chunk.vnCount++;
+    else if (token[1] == 't' && isSpace(token[2]))
+      chunk.vtCount++;
+  });
+}
+
+// Second pass: parse vertex and face records of a chunk. Face indices are
+// made zero-based against the global vertex counts, so relative (negative)
+// indices may refer to vertices of earlier chunks.
+static void parseChunk(obj_chunk &chunk) {
+  chunk.v.reserve(chunk.vCount * 3);
+  chunk.vn.reserve(chunk.vnCount * 3);
+  chunk.vt.reserve(chunk.vtCount * 2);
+
+  forEachChunkLine(chunk, [&chunk](const char *line, bool padded) {
+    const char *token = line + strspn(line, " \t");
+
+    if (isNewLine(token[0]) || token[0] == '#')
+      return;
 
     // vertex
     if (token[0] == 'v' && isSpace((token[1]))) {
       token += 2;
       float x, y, z;
-      parseFloat3(x, y, z, token);
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
-      continue;
+      parseFloat3(x, y, z, token, padded);
+      chunk.v.push_back(x);
+      chunk.v.push_back(y);
+      chunk.v.push_back(z);
+      return;
     }
 
     // normal
     if (token[0] == 'v' && token[1] == 'n' && isSpace((token[2]))) {
       token += 3;
       float x, y, z;
-      parseFloat3(x, y, z, token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
+      parseFloat3(x, y, z, token, padded);
+      chunk.vn.push_back(x);
+      chunk.vn.push_back(y);
+      chunk.vn.push_back(z);
+      return;
     }
 
     // texcoord
     if (token[0] == 'v' && token[1] == 't' && isSpace((token[2]))) {
       token += 3;
       float x, y;
-      parseFloat2(x, y, token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
+      parseFloat2(x, y, token, padded);
+      chunk.vt.push_back(x);
+      chunk.vt.push_back(y);
+      return;
     }
 
     // face
@@ -951,249 +1957,343 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
       token += 2;
       token += strspn(token, " \t");
 
-      std::vector<vertex_index> face;
+      chunk.faces.push_back(std::vector<vertex_index>());
+      std::vector<vertex_index> &face = chunk.faces.back();
+      int vsize = static_cast<int>(chunk.vBase + chunk.v.size() / 3);
+      int vnsize = static_cast<int>(chunk.vnBase + chunk.vn.size() / 3);
+      int vtsize = static_cast<int>(chunk.vtBase + chunk.vt.size() / 2);
       while (!isNewLine(token[0])) {
-        vertex_index vi = parseTriple(token, static_cast<int>(v.size() / 3),
-                                      static_cast<int>(vn.size() / 3),
-                                      static_cast<int>(vt.size() / 2));
-        face.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
+        face.push_back(parseTriple(token, padded, vsize, vnsize, vtsize));
+        token += strspn(token, " \t\r");
       }
+      chunk.records.push_back(NULL);
+      return;
+    }
 
-      faceGroup.push_back(face);
+    // Everything else is replayed in order by parseObjLine.
+    chunk.records.push_back(line);
+  });
+}
 
-      continue;
-    }
+// Appends the parsed vertex arrays of all chunks to st and frees them.
+static void mergeChunkVertices(obj_parse_state &st,
+                               std::vector<obj_chunk> &chunks) {
+  const obj_chunk &last = chunks.back();
+  st.v.reserve((last.vBase + last.vCount) * 3);
+  st.vn.reserve((last.vnBase + last.vnCount) * 3);
+  st.vt.reserve((last.vtBase + last.vtCount) * 2);
+  for (size_t i = 0; i < chunks.size(); i++) {
+    st.v.insert(st.v.end(), chunks[i].v.begin(), chunks[i].v.end());
+    st.vn.insert(st.vn.end(), chunks[i].vn.begin(), chunks[i].vn.end());
+    st.vt.insert(st.vt.end(), chunks[i].vt.begin(), chunks[i].vt.end());
+    std::vector<float>().swap(chunks[i].v);
+    std::vector<float>().swap(chunks[i].vn);
+    std::vector<float>().swap(chunks[i].vt);
+  }
+}
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6)) && isSpace((token[6]))) {
+bool LoadObjFromMemoryParallel(std::vector<shape_t> &shapes,       // [output]
+                               std::vector<material_t> &materials, // [output]
+                               std::string &err, const char *buf, size_t size,
+                               MaterialReader &readMatFn, unsigned numThreads,
+                               bool triangulate, bool generateNormals,
+                               bool padded) {
+  if (numThreads == 0) {
+    numThreads = std::thread::hardware_concurrency();
+  }
+  if (numThreads <= 1) {
+    return LoadObjFromMemory(shapes, materials, err, buf, size, readMatFn,
+                             triangulate, generateNormals, padded);
+  }
 
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
+  // Split the buffer into chunks of whole lines. Use more chunks than
+  // threads so uneven chunks still balance.
+  const size_t minChunkSize = 64 * 1024;
+  size_t numChunks = numThreads * 4;
+  if (size / minChunkSize < numChunks) {
+    numChunks = size / minChunkSize;
+  }
+  if (numChunks == 0) {
+    numChunks = 1;
+  }
 
-      // Create face group per material.
-      bool ret =
-          exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                                 material, name, true, triangulate);
-      if (ret) {
-        shapes.push_back(shape);
+  const char *end = buf + size;
+  std::vector<obj_chunk> chunks(numChunks);
+  const char *begin = buf;
+  for (size_t i = 0; i < numChunks; i++) {
+    const char *chunkEnd = end;
+    if (i + 1 < numChunks) {
+      chunkEnd = buf + (size / numChunks) * (i + 1);
+      if (chunkEnd < begin) {
+        chunkEnd = begin;
       }
-      shape = shape_t();
-      faceGroup.clear();
-
-      if (material_map.find(namebuf) != material_map.end()) {
-        material = material_map[namebuf];
-      } else {
-        // { error!! material not found }
-        material = -1;
+      if (chunkEnd > buf && chunkEnd[-1] != '\n') {
+        const char *eol = static_cast<const char *>(
+            memchr(chunkEnd, '\n', static_cast<size_t>(end - chunkEnd)));
+        chunkEnd = eol ? eol + 1 : end;
       }
-
-      continue;
     }
+    chunks[i].begin = begin;
+    chunks[i].end = chunkEnd;
+    chunks[i].padded = padded;
+    begin = chunkEnd;
+  }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && isSpace((token[6]))) {
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
-
-      std::string err_mtl;
-      bool ok = readMatFn(namebuf, materials, material_map, err_mtl);
-      err += err_mtl;
+  parallelFor(numChunks, numThreads,
+              [&chunks](size_t i, unsigned) { countChunkVertices(chunks[i]); });
+
+  size_t vBase = 0, vnBase = 0, vtBase = 0;
+  for (size_t i = 0; i < numChunks; i++) {
+    chunks[i].vBase = vBase;
+    chunks[i].vnBase = vnBase;
+    chunks[i].vtBase = vtBase;
+    vBase += chunks[i].vCount;
+    vnBase += chunks[i].vnCount;
+    vtBase += chunks[i].vtCount;
+  }
 
-      if (!ok) {
-        faceGroup.clear(); // for safety
+  parallelFor(numChunks, numThreads,
+              [&chunks](size_t i, unsigned) { parseChunk(chunks[i]); });
+
+  obj_parse_state st;
+  mergeChunkVertices(st, chunks);
+
+  // Replay state changes in file order to build the face groups. Exporting
+  // is deferred so that groups can be flattened in parallel below.
+  std::vector<pending_group> pending;
+  st.deferred = &pending;
+  for (size_t i = 0; i < numChunks; i++) {
+    size_t face = 0;
+    for (size_t r = 0; r < chunks[i].records.size(); r++) {
+      const char *line = chunks[i].records[r];
+      if (line == NULL) {
+        st.faceGroup.push_back(std::vector<vertex_index>());
+        st.faceGroup.back().swap(chunks[i].faces[face++]);
+      } else if (!parseObjLine(st, line, chunks[i].padded, shapes, materials,
+                               err, readMatFn, triangulate)) {
         return false;
       }
-
-      continue;
     }
+    std::vector<std::vector<vertex_index> >().swap(chunks[i].faces);
+  }
+  exportCurrentGroup(st, shapes, triangulate);
+
+  size_t firstShape = shapes.size();
+  shapes.resize(firstShape + pending.size());
+  std::vector<vertex_cache> vertexCaches(numThreads);
+  parallelFor(pending.size(), numThreads, [&](size_t i, unsigned worker) {
+    pending_group &group = pending[i];
+    exportFaceGroupToShape(shapes[firstShape + i], vertexCaches[worker], st.v,
+                           st.vn, st.vt, group.faceGroup, group.tags,
+                           group.material, group.name, group.group, true,
+                           triangulate);
+    std::vector<std::vector<vertex_index> >().swap(group.faceGroup);
+    if (generateNormals) {
+      generateShapeNormals(shapes[firstShape + i]);
+    }
+  });
 
-    // group name
-    if (token[0] == 'g' && isSpace((token[1]))) {
-
-      // flush previous face group.
-      bool ret =
-          exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                                 material, name, true, triangulate);
-      if (ret) {
-        shapes.push_back(shape);
-      }
-
-      shape = shape_t();
-
-      // material = -1;
-      faceGroup.clear();
-
-      std::vector<std::string> names;
-      while (!isNewLine(token[0])) {
-        std::string str = parseString(token);
-        names.push_back(str);
-        token += strspn(token, " \t\r"); // skip tag
-      }
+  return true;
+}
 
-      assert(names.size() > 0);
+float ParseFloat(const char *token, const char **end, bool padded) {
+  float f = parseFloat(token, padded);
+  *end = token;
+  return f;
+}
 
-      // names[0] must be 'g', so skip the 0th element.
-      if (names.size() > 1) {
-        name = names[1];
-      } else {
-        name = "";
-      }
+namespace {
+// Skips mtllib, FlattenObjFaceGroups doesn't need materials.
+class NullMaterialReader : public MaterialReader {
+public:
+  virtual bool operator()(const std::string &, std::vector<material_t> &,
+                          std::map<std::string, int> &, std::string &) {
+    return true;
+  }
+};
+}
 
-      continue;
+bool FlattenObjFaceGroups(std::vector<shape_t> &shapes, std::string &err,
+                          const char *buf, size_t size, bool mapVertexCache,
+                          double &seconds, bool triangulate) {
+  obj_parse_state st;
+  std::vector<pending_group> pending;
+  st.deferred = &pending;
+  std::vector<material_t> materials;
+  NullMaterialReader readMatFn;
+  if (!parseObjBuffer(st, buf, size, false, shapes, materials, err, readMatFn,
+                      triangulate)) {
+    return false;
+  }
+  exportCurrentGroup(st, shapes, triangulate);
+
+  size_t firstShape = shapes.size();
+  shapes.resize(firstShape + pending.size());
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  vertex_cache hashCache;
+  map_vertex_cache mapCache;
+  for (size_t i = 0; i < pending.size(); i++) {
+    pending_group &group = pending[i];
+    if (mapVertexCache) {
+      exportFaceGroupToShape(shapes[firstShape + i], mapCache, st.v, st.vn,
+                             st.vt, group.faceGroup, group.tags,
+                             group.material, group.name, group.group, true,
+                             triangulate);
+    } else {
+      exportFaceGroupToShape(shapes[firstShape + i], hashCache, st.v, st.vn,
+                             st.vt, group.faceGroup, group.tags,
+                             group.material, group.name, group.group, true,
+                             triangulate);
     }
+  }
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          start)
+                .count();
+  return true;
+}
 
-    // object name
-    if (token[0] == 'o' && isSpace((token[1]))) {
-
-      // flush previous face group.
-      bool ret =
-          exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                                 material, name, true, triangulate);
-      if (ret) {
-        shapes.push_back(shape);
-      }
-
-      // material = -1;
-      faceGroup.clear();
-      shape = shape_t();
-
-      // @todo { multiple object name? }
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 2;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+MappedFile::MappedFile()
+    : data(NULL), size(0)
+#ifdef _WIN32
+      , file(INVALID_HANDLE_VALUE), mapping(NULL)
 #else
-      sscanf(token, "%s", namebuf);
+      , fd(-1)
 #endif
-      name = std::string(namebuf);
+{
+}
 
-      continue;
-    }
+MappedFile::~MappedFile() { close(); }
 
-    if (token[0] == 't' && isSpace(token[1])) {
-      tag_t tag;
+bool MappedFile::open(const char *filename) {
+  close();
+#ifdef _WIN32
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(static_cast<HANDLE>(file), &fileSize)) {
+    close();
+    return false;
+  }
+  size = static_cast<size_t>(fileSize.QuadPart);
+  if (size == 0) {
+    return true;
+  }
+  mapping = CreateFileMappingA(static_cast<HANDLE>(file), NULL,
+                               PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    close();
+    return false;
+  }
+  data = static_cast<const char *>(
+      MapViewOfFile(static_cast<HANDLE>(mapping), FILE_MAP_READ, 0, 0, 0));
+#else
+  fd = ::open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    close();
+    return false;
+  }
+  size = static_cast<size_t>(sb.st_size);
+  if (size == 0) {
+    return true;
+  }
+  void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    close();
+    return false;
+  }
+  // The parser reads the file front to back exactly once.
+  madvise(addr, size, MADV_SEQUENTIAL);
+  data = static_cast<const char *>(addr);
+#endif
+  if (data == NULL) {
+    close();
+    return false;
+  }
+  return true;
+}
 
-      char namebuf[4096];
-      token += 2;
-      sscanf(token, "%s", namebuf);
-      tag.name = std::string(namebuf);
+void MappedFile::close() {
+#ifdef _WIN32
+  if (data != NULL)
+    UnmapViewOfFile(data);
+  if (mapping != NULL)
+    CloseHandle(static_cast<HANDLE>(mapping));
+  if (file != INVALID_HANDLE_VALUE)
+    CloseHandle(static_cast<HANDLE>(file));
+  mapping = NULL;
+  file = INVALID_HANDLE_VALUE;
+#else
+  if (data != NULL)
+    munmap(const_cast<char *>(data), size);
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+#endif
+  data = NULL;
+  size = 0;
+}
 
-      token += tag.name.size() + 1;
+bool LoadObjMapped(std::vector<shape_t> &shapes,       // [output]
+                   std::vector<material_t> &materials, // [output]
+                   std::string &err, const char *filename,
+                   const char *mtl_basepath, bool triangulate,
+                   bool generateNormals) {
 
-      tag_sizes ts = parseTagTriple(token);
+  shapes.clear();
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+  std::stringstream errss;
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = atoi(token);
-        token += strcspn(token, "/ \t\r") + 1;
-      }
+  MappedFile mappedFile;
+  if (!mappedFile.open(filename)) {
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    err = errss.str();
+    return false;
+  }
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
-        tag.floatValues[i] = parseFloat(token);
-        token += strcspn(token, "/ \t\r") + 1;
-      }
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  MaterialFileReader matFileReader(basePath);
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        char stringValueBuffer[4096];
+  return LoadObjFromMemory(shapes, materials, err, mappedFile.data,
+                           mappedFile.size, matFileReader, triangulate,
+                           generateNormals, true);
+}
+bool LoadObjParallel(std::vector<shape_t> &shapes,       // [output]
+                     std::vector<material_t> &materials, // [output]
+                     std::string &err, const char *filename,
+                     const char *mtl_basepath, unsigned numThreads,
+                     bool triangulate, bool generateNormals) {
 
-        sscanf(token, "%s", stringValueBuffer);
-        tag.stringValues[i] = stringValueBuffer;
-        token += tag.stringValues[i].size() + 1;
-      }
+  shapes.clear();
 
-      tags.push_back(tag);
-    }
+  std::stringstream errss;
 
-    // Ignore unknown command.
+  MappedFile mappedFile;
+  if (!mappedFile.open(filename)) {
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    err = errss.str();
+    return false;
   }
 
-  bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup,
-                                    tags, material, name, true, triangulate);
-  if (ret) {
-    shapes.push_back(shape);
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
   }
-  faceGroup.clear(); // for safety
-
-  err += errss.str();
+  MaterialFileReader matFileReader(basePath);
 
-  if(generateNormals) {
-	  // Ensure there are no normals loaded
-	  vn.clear();
-	  for (size_t i = 0; i < shapes.size(); i++) {
-		  assert((shapes[i].mesh.positions.size() % 3) == 0);
-		  float nx, ny, nz = 0.0f; // normal for current triangle
-		  float vx1, vx2, vx3 = 0.f; // vertex 1
-		  float vy1, vy2, vy3 = 0.f; // vertex 2
-		  float vz1, vz2, vz3 = 0.f; // vertex 3
-		  for (size_t v = 0; v < shapes[i].mesh.positions.size() / 3; v++) {
-			  float x = shapes[i].mesh.positions[3.f*v];
-			  float y = shapes[i].mesh.positions[3.f*v+1];
-			  float z = shapes[i].mesh.positions[3.f*v+2];
-			  switch(v % 3) {
-			  case 0:
-				  vx1 = x;
-				  vy1 = y;
-				  vz1 = z;
-				  break;
-				  // Defining first point in triangle
-			  case 1:
-				  // Defining second point in triangle
-				  vx2 = x;
-				  vy2 = y;
-				  vz2 = z;
-				  break;
-			  case 2:
-				  // Defining third point in a triangle
-				  vx3 = x;
-				  vy3 = y;
-				  vz3 = z;
-				  float qx, qy, qz, px, py, pz;
-				  // Calculate q vector
-				  qx = vx2 - vx1;
-				  qy = vy2 - vy1;
-				  qz = vz2 - vz1;
-				  // Calculate p vector
-				  px = vx3 - vx1;
-				  py = vy3 - vy1;
-				  pz = vz3 - vz1;
-				  // Calculate normal
-				  nx = py * qz - pz * qy;
-				  ny = pz * qx - px * qz;
-				  nz = px * qy - py * qx;
-
-				  // Scale to unit vector
-				  float s = sqrt(nx*nx + ny*ny + nz*nz);
-				  nx /= s;
-				  ny /= s;
-				  nz /= s;
-
-				  // Add the normal 3 times (once for each vertex)
-				  for(int j=0; j<3; j++) {
-					  shapes[i].mesh.normals.push_back(nx);
-					  shapes[i].mesh.normals.push_back(ny);
-					  shapes[i].mesh.normals.push_back(nz);
-				  }
-				  break;
-			  }
-		  }
-	  }
-  }
-  return true;
+  return LoadObjFromMemoryParallel(shapes, materials, err, mappedFile.data,
+                                   mappedFile.size, matFileReader, numThreads,
+                                   triangulate, generateNormals, true);
 }
 
 } // namespace
@@ -0,0 +1,34 @@
+#ifndef _BOUNDING_VOLUME_HIERARCHY_H_
+#define _BOUNDING_VOLUME_HIERARCHY_H_
+
+#include "Common.h"
+#include "Frustum.h"
+#include "SceneCache.h"
+
+#include <stdint.h>
+
+// Binary tree of boxes over bounding spheres, built with binned SAH splits. Culling accepts or rejects whole
+// subtrees, and stops testing a plane below a box that is completely inside of it.
+class BoundingVolumeHierarchy
+{
+public:
+	BoundingVolumeHierarchy();
+	void build(const SphereBounds&);
+	// Use a hierarchy read from a scene cache, returns false if it is corrupt or was built over a different number
+	// of spheres
+	bool load(const SceneCacheBvhNode*, size_t, const uint32_t*, size_t, size_t);
+	// Write the indices of the spheres at least partially inside, like Frustum::spheresPartiallyInFrustum but in
+	// hierarchy order, returns how many there are. The list needs room for every sphere.
+	size_t cull(Frustum&, const SphereBounds&, uint32_t*);
+	const std::vector<SceneCacheBvhNode>& getNodes();
+	// Sphere indices the node ranges point into
+	const std::vector<uint32_t>& getSpheres();
+	// Hierarchy nodes tested by the last cull
+	size_t getNodesVisited();
+private:
+	std::vector<SceneCacheBvhNode> nodes; // the root first, empty without spheres
+	std::vector<uint32_t> spheres;
+	size_t nodesVisited;
+};
+
+#endif // _BOUNDING_VOLUME_HIERARCHY_H_
@@ -3,11 +3,19 @@
 
 #include "Common.h"
 
+#include <stdint.h>
+
 typedef struct
 {
     float x, y, z;
 } Point;
 
+// Bounding spheres as a structure of arrays, so that batches of them can be tested against the planes at once
+typedef struct
+{
+    std::vector<float> x, y, z, radius;
+} SphereBounds;
+
 class Frustum
 {
 public:
@@ -16,6 +24,14 @@ public:
     bool sphereInFrustum( float x, float y, float z, float radius );
     float sphereInFrustumDistance( float x, float y, float z, float radius );
     int spherePartiallyInFrustum( float x, float y, float z, float radius );
+    // Write the indices of the spheres at least partially inside in ascending order, returns how many there are.
+    // The list needs room for every sphere.
+    size_t spheresPartiallyInFrustum( const SphereBounds& bounds, uint32_t* visible );
+    // Test an axis aligned box against the planes set in the mask, planes it is completely inside of are cleared.
+    // Returns 0 if the box is outside, 2 if it is inside every plane, 1 otherwise
+    int boxPartiallyInFrustum( const float* min, const float* max, unsigned& planes );
+    // spherePartiallyInFrustum returning non zero, testing only the planes set in the mask
+    bool sphereInPlanes( float x, float y, float z, float radius, unsigned planes );
     bool cubeInFrustum( float x, float y, float z, float size );
     int cubePartiallyInFrustum( float x, float y, float z, float size );
     bool polygonInFrustum(int numpoints, Point* pointlist);
@@ -4,11 +4,18 @@
 #include "Common.h"
 #include "Shader.h"
 
+// Index of a uniform in its program's UniformLoader, resolved once when the uniform is added
+typedef int UniformHandle;
+
 class Uniform {
 protected:
 	GLuint location;
+	bool dirty; // set since it was last loaded
+	virtual void upload() = 0;
 public:
-	virtual void load() = 0;
+	Uniform();
+	// Send the value to the program in use if it changed since the last load
+	void load();
 	GLuint getLocation();
 	void setLocation(GLuint);
 	virtual ~Uniform();
@@ -17,40 +24,61 @@ public:
 class UniformMat4 : public Uniform {
 private:
 	glm::mat4 matrix;
+	void upload();
 public:
-	UniformMat4(glm::mat4&);
-	void load();
-	void set(glm::mat4&);
+	UniformMat4(const glm::mat4&);
+	void set(const glm::mat4&);
 };
 
 class UniformVec3 : public Uniform {
 private:
 	glm::vec3 vector;
+	void upload();
 public:
-	UniformVec3(glm::vec3&);
-	void load();
-	void set(glm::vec3&);
+	UniformVec3(const glm::vec3&);
+	void set(const glm::vec3&);
 };
 
 class UniformInt : public Uniform {
 private:
 	GLint i;
+	void upload();
 public:
 	UniformInt(int);
-	void load();
 	void set(GLint);
 };
 
 class UniformLoader {
 private:
 	GLuint programId;
-	std::map<std::string, Uniform*> uniforms;
+	std::vector<Uniform*> uniforms; // indexed by handle
+	std::map<std::string, UniformHandle> handles;
 public:
 	UniformLoader(GLuint);
 	~UniformLoader();
-	void addUniform(const char*, Uniform*);
-	Uniform* get(const char*);
+	// Add a uniform, replacing one with the same name, and return its handle
+	UniformHandle addUniform(const char*, Uniform*);
+	// Handle of an added uniform by name, resolve it once outside of the render loop
+	UniformHandle getHandle(const char*);
+	Uniform* get(UniformHandle);
+	// Send the uniforms set since the last load, the program must be in use
+	void load();
+};
+
+// A std140 uniform block bound to a binding point that programs share, sent only when its data changed
+class UniformBuffer {
+private:
+	GLuint id, binding;
+	std::vector<unsigned char> data;
+	bool dirty;
+public:
+	UniformBuffer(GLuint, size_t);
+	~UniformBuffer();
+	// Copy the whole block, laid out as std140
+	void set(const void*);
+	// Send the block if it changed since the last load
 	void load();
+	GLuint getBinding();
 };
 
 class GpuProgram
@@ -60,6 +88,8 @@ public:
 	~GpuProgram();
 	GLuint getId();
 	void attachShader(Shader& _shader);
+	// Read a uniform block of the linked program from a binding point, blocks the program doesn't use are ignored
+	void bindUniformBlock(const char*, GLuint);
 	void use();
 	UniformLoader *uniformLoader;
 private:
@@ -0,0 +1,15 @@
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include <cstddef>
+
+// LZ4 block format, compatible with LZ4_compress_default and LZ4_decompress_safe
+
+// Largest compressed size of a block of the given size
+size_t lz4CompressBound(size_t);
+// Compress a block into dst which must hold lz4CompressBound(srcSize) bytes, returns the compressed size
+size_t lz4Compress(const unsigned char*, size_t, unsigned char*);
+// Decompress a block that expands to exactly dstSize bytes, returns false on corrupt input
+bool lz4Decompress(const unsigned char*, size_t, unsigned char*, size_t);
+
+#endif // _LZ4_H_
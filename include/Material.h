@@ -29,6 +29,8 @@ typedef struct
 	unsigned width, height;
 	unsigned bpp;
 	int mode;
+	unsigned levels; // mip levels stored one after another in data, 1 for just the base image
+	unsigned compression; // TextureCompression of the levels, 0 for raw pixels
 	unsigned char* data;
 } Texture;
 
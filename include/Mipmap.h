@@ -0,0 +1,25 @@
+#ifndef _MIPMAP_H_
+#define _MIPMAP_H_
+
+#include "Material.h"
+
+#include <cstddef>
+
+enum MipFilter {
+	MIP_FILTER_NONE = 0, // only the base image
+	MIP_FILTER_BOX, // 2x2 average
+	MIP_FILTER_KAISER // Kaiser windowed sinc, sharper than the box filter without ringing much
+};
+
+// Levels of a full mip chain down to 1x1
+unsigned mipLevelCount(unsigned, unsigned);
+// Bytes of a chain of tightly packed levels, level n is max(width >> n, 1) by max(height >> n, 1)
+size_t mipChainSize(unsigned, unsigned, unsigned, unsigned);
+// Downsample a tightly packed image to half its width and height
+void downsampleBox(const unsigned char*, unsigned, unsigned, unsigned, unsigned char*);
+void downsampleKaiser(const unsigned char*, unsigned, unsigned, unsigned, unsigned char*);
+// Fill texture.data with a new[] allocated, uncompressed mip chain of an image with the texture's width, height
+// and bpp and the given row pitch. Images larger than the max size are halved until they fit first, 0 for no limit.
+void buildMipChain(const unsigned char*, size_t, MipFilter, unsigned, Texture&);
+
+#endif // _MIPMAP_H_
@@ -0,0 +1,68 @@
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+
+#include "Common.h"
+
+#include <stdint.h>
+
+// Passes in the order they are submitted
+enum RenderPass {
+	RENDER_PASS_SHADOW = 0,
+	RENDER_PASS_SCENE
+};
+
+// A draw of a scene node, submitted in the order of its key
+typedef struct {
+	uint64_t key; // pass, program, texture array, depth bucket and layer from the most to the least significant bits
+	GLuint node; // index in the renderer's scene nodes
+} DrawPacket;
+
+// Layout of the commands glMultiDrawElementsIndirect reads
+typedef struct {
+	GLuint count, instanceCount, firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance; // index of the draw's entry in the per draw data
+} DrawElementsIndirectCommand;
+
+// Consecutive packets sharing their state and geometry buffers, submitted with one indirect draw
+typedef struct {
+	uint64_t key; // of the first packet
+	GLuint node; // first node, binds the page of paged scenes
+	size_t page; // of paged scenes
+	size_t firstCommand, commands;
+} IndirectBatch;
+
+// GL state last set by the submitter, compared against the keys of the packets
+typedef struct {
+	unsigned pass, program;
+	GLuint texture, layer;
+} RenderQueueState;
+
+// Draws and state changes made submitting a frame's queue
+typedef struct {
+	size_t draws, drawCalls, passes, programs, textures, layers;
+	double submitSeconds; // CPU time spent submitting
+} RenderQueueStats;
+
+// Draw packets emitted by culling, sorted so that draws sharing state are submitted together
+class RenderQueue
+{
+public:
+	// Pack the state of a draw into a sort key, depth is 0 at the eye and 1 at the far plane
+	static uint64_t makeKey(unsigned, unsigned, GLuint, float, GLuint);
+	static unsigned getPass(uint64_t);
+	static unsigned getProgram(uint64_t);
+	// Pass, program and texture array, the state draws of one indirect batch share
+	static uint64_t getState(uint64_t);
+	static GLuint getTexture(uint64_t);
+	static GLuint getLayer(uint64_t);
+	void clear();
+	void push(uint64_t, GLuint);
+	// Radix sort by key, draws with equal keys keep the order they were pushed in
+	void sort();
+	std::vector<DrawPacket>& getPackets();
+private:
+	std::vector<DrawPacket> packets, scratch; // storage is reused every frame
+};
+
+#endif // _RENDER_QUEUE_H_
@@ -1,12 +1,22 @@
 #ifndef _RENDERER_H_
 #define _RENDERER_H_
 
+#include "BoundingVolumeHierarchy.h"
 #include "Camera.h"
 #include "Common.h"
 #include "Frustum.h"
 #include "GpuProgram.h"
 #include "Material.h"
+#include "Mipmap.h"
+#include "RenderQueue.h"
+#include "SceneCache.h"
 #include "SceneNode.h"
+#include "ScenePager.h"
+#include "TextureCompression.h"
+#include "TextureRegistry.h"
+#include "TextureResidency.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
 
 #include <SDL_image.h>
 #include <SDL_thread.h>
@@ -47,6 +57,46 @@ public:
 	friend std::ostream& operator<<(std::ostream& os, ConfigLoader* dt); // used for debugging
 };
 
+// Uniforms that change every frame, laid out like the std140 FrameData block of the shaders
+typedef struct {
+	glm::mat4 projection, view, lightSpaceMatrix;
+	glm::vec4 lightPos, viewPos; // w is unused
+} FrameUniforms;
+
+// Uniforms that only change with the settings, laid out like the std140 ProgramData block of the shaders
+typedef struct {
+	glm::mat4 model;
+	GLint shadows;
+	GLint padding[3];
+} ProgramUniforms;
+
+// A group of a changed .obj source imported on its own, waiting to be spliced into the scene
+typedef struct {
+	size_t group; // index in Renderer::sourceGroups
+	size_t objGroup; // index of the group in its file
+	SceneCacheGroup updated; // byte range, hash and vertex record bases in the changed file
+	std::vector<tinyobj::shape_t> shapes;
+	// Where spliceChangedGroups put the group's geometry and whether its size changed
+	size_t vertexStart, vertexEnd, indexStart, indexEnd;
+	bool resized;
+} ChangedObjGroup;
+
+enum DecodedTextureState {
+	TEXTURE_QUEUED = 0,
+	TEXTURE_DECODING,
+	TEXTURE_DECODED
+};
+
+// A texture image decoded by a worker thread, or by the GL thread if it needs it before a worker got to it
+typedef struct {
+	std::string path;
+	SDL_atomic_t state;
+	MipFilter mipFilter;
+	unsigned maxTextureSize; // 0 for no limit
+	Texture texture; // data is 0 if the file couldn't be loaded or the texture was uploaded
+	double decodeSeconds, mipSeconds;
+} DecodedTexture;
+
 class Renderer
 {
 public:
@@ -54,17 +104,17 @@ public:
     ~Renderer();
     void addMaterial(Material*);
     void addSceneNode(SceneNode*);
-    void addTexture(const char*, GLuint*, SDL_Surface*);
-    void addTexture(const char*, GLuint*, Texture*);
-    void addTexture(const char*, GLuint*);
+    Texture* loadTexture(const char*);
+    Texture* loadBlankTexture();
+    void packTextureArrays(const std::vector<size_t>&);
     void addWavefront(const char*, glm::mat4);
     bool buildScene(Camera&, const char*); //TODO check if cam is needed
     bool buildScene(Camera&);
 
     void bufferToGpu(Camera&, bool);
     bool checkScene();
-    GLuint createShadowMap(Camera&);
     void render(Camera*);
+    void reloadChangedModels();
     void enableShadows();
     void disableShadows();
 	std::vector<Vertex> vertexData;
@@ -72,18 +122,83 @@ public:
     std::vector<GLuint> indices;
     std::map<std::string, Material> materials;
     std::map<std::string, Texture> textures;
+    TextureRegistry textureRegistry; // texture arrays the scene nodes share, registered under every file they hold
+    std::map<std::string, GLuint> textureLayers; // layer of each packed texture file in its array
     ConfigLoader* configLoader;
     std::string cacheFileName;
+    size_t trianglesDrawn, trianglesCulled; // counted by the last call to render
+    size_t bvhNodesVisited; // hierarchy nodes culling tested in the last call to render, 0 for a flat scan
+    RenderQueueStats renderStats; // draws and state changes of the last call to render
+    bool multiDrawIndirect; // submit the draws sharing their state with one glMultiDrawElementsIndirect, needs GL 4.3
+    bool bvhCulling; // cull by walking the bounding volume hierarchy instead of testing every node
+    std::vector<std::string> sourceFiles; // models, materials and textures the scene was built from
+    std::vector<SceneCacheGroup> sourceGroups; // g and o groups of the .obj sources and their scene nodes
+    BoundingVolumeHierarchy nodeHierarchy; // over the nodes' bounding spheres, built with the scene or read from its cache
+    ThreadPool* threadPool;
+    std::string textureCompression; // none, bc1 or bc7, applied to raw textures when the cache is written
+    TextureStreamer* textureStreamer; // streams the levels of texture arrays, 0 if they are uploaded at once
+    TextureResidency* textureResidency; // picks the levels to keep in VRAM, 0 without a streamer
+    ScenePager* scenePager; // streams the geometry of a paged cached scene, 0 if everything is uploaded at once
+    SceneCache* sceneCache; // mapped cache the scene was loaded from, if any
 private:
+    bool drawNode(size_t);
+    GLuint beginShadowPass();
+    void endShadowPass(const GLint*);
+    void setDrawState(uint64_t, const GLint*, bool);
+    void submitRenderQueue(const GLint*);
+    void submitIndirect(const GLint*);
+    void updateNodeBounds();
+    void buildNodeHierarchy();
+    void addShapes(std::vector<tinyobj::shape_t>&, const std::vector<std::string>&, const char*, glm::mat4, SceneCacheGroup*);
+    void computeBoundingSpheres(size_t, size_t);
+    void stampModel(size_t);
+    bool importChangedGroups(const std::vector<size_t>&, std::vector<ChangedObjGroup>&);
+    void appendNodes(const std::vector<SceneNode>&, size_t, size_t, const Vertex*, const GLuint*);
+    void spliceChangedGroups(std::vector<ChangedObjGroup>&);
+    void uploadChangedGroups(const std::vector<ChangedObjGroup>&);
+    void decodeTextures();
+    static void decodeTexture(DecodedTexture*);
+    bool isCompressionSupported(unsigned);
     bool shadowsEnabled;
     GLuint vao, vbo, ibo;
-    GLuint startPosition;
+    size_t numMaterialRuns; // scene nodes an unmerged import would have produced
+    size_t numClusteredNodes; // scene nodes added by splitting large nodes into clusters
+    // Geometry uploaded by bufferToGpu, either vertexData and indices or sections of the mapped cache
+    const Vertex* gpuVertices;
+    const GLuint* gpuIndices;
+    size_t gpuVertexCount, gpuIndexCount;
+    size_t vboCapacity, iboCapacity; // elements the GPU buffers have room for
+    bool rewriteCache; // the scene was loaded from a cache that had to be patched
+    std::map<size_t, std::pair<uint64_t, int64_t> > modelStamps; // size and mtime of .obj sources with groups
     GLuint shadowMap, depthMapFBO;
     glm::mat4 modelViewProjectionMatrix;
     GpuProgram *gpuProgram, *shadowProgram;
+    // Uniform blocks both programs read, filled on the CPU and sent once per frame if they changed
+    FrameUniforms frameUniforms;
+    ProgramUniforms programUniforms;
+    UniformBuffer *frameUniformBuffer, *programUniformBuffer;
+    UniformHandle diffuseLayerUniform;
     Frustum frustum;
+    SphereBounds nodeBounds; // bounding spheres of the scene nodes for batch culling
+    std::vector<uint32_t> visibleNodes; // filled by culling, room for every node
+    size_t sceneTriangles;
+    RenderQueue renderQueue; // draws of the current frame
+    RenderQueueState submitState;
+    // Indirect submission, the buffers are created on first use
+    GLuint indirectBuffer, drawLayerBuffer; // commands and the layer of each draw, read as an instanced attribute
+    std::vector<DrawElementsIndirectCommand> indirectCommands;
+    std::vector<GLuint> drawLayers;
+    std::vector<IndirectBatch> indirectBatches;
     int shadowWidth, shadowHeight;
     SDL_Thread *binCacheWriterThread;
+    std::map<std::string, DecodedTexture*> decodedTextures; // textures queued for decoding, kept until the workers are stopped
+    // Time the GL thread spent on textures in bufferToGpu
+    double textureDecodeSeconds, textureWaitSeconds, textureUploadSeconds;
+    MipFilter mipFilter; // used to build the mip chains of imported textures
+    unsigned maxTextureSize;
+    unsigned textureArraySize; // textures are resampled to at most this size when packed into arrays, 0 for no limit
+    std::set<GLenum> compressedFormats; // formats the driver can sample, queried on the first compressed upload
+    bool compressedFormatsQueried;
 };
 
 #endif
@@ -0,0 +1,208 @@
+#ifndef _SCENE_CACHE_H_
+#define _SCENE_CACHE_H_
+
+#include "Common.h"
+#include "ThreadPool.h"
+
+#include <stdint.h>
+
+/*	Scene cache file format (little endian, all fields fixed width):
+ * 	[---------header---------]	magic, version, section count, file size
+ * 	[------section table-----]	type, element size, offset, size and element count per section
+ * 	[--------section---------]	every section starts on a 64 byte boundary
+ * 	[--------section---------]
+ * 	[----------...-----------]
+ *
+ * 	Large sections can be LZ4 compressed in independent blocks of SCENE_CACHE_BLOCK_SIZE bytes, followed
+ * 	by a table of the compressed size of every block. A block that doesn't shrink is stored as is.
+ * 	Compressed sections are decompressed in parallel when first accessed, the rest are used in place.
+ *
+ * 	The pages section splits the scene into runs of nodes whose vertices and indices are contiguous in
+ * 	the vertex and index sections, so the geometry of each page can be read on its own.
+ *
+ * 	The sources section lists every file the scene was built from with its size, mtime and
+ * 	content hash, a cache is stale once any of them changed.
+ *
+ * 	The groups section splits every .obj source into its g and o groups with a hash of each
+ * 	group's bytes and the scene nodes it produced, so a stale cache can be patched by importing
+ * 	only the groups that changed.
+ *
+ * 	The bvh sections hold a bounding volume hierarchy over the nodes' bounding spheres for frustum
+ * 	culling, its nodes and the list of scene node indices their ranges point into. Both children of
+ * 	an inner node are stored next to each other after their parent.
+ *
+ * 	The vertex and index sections hold the final interleaved Vertex and GLuint arrays, so a
+ * 	mapped cache can be passed to glBufferData as is. Texture pixels are stored in one data
+ * 	section, each image 64 byte aligned and referenced from the texture table by offset. An image
+ * 	is followed by the rest of its mip chain, every level tightly packed.
+ */
+#define SCENE_CACHE_MAGIC 0x43534C47 // "GLSC"
+#define SCENE_CACHE_VERSION 8
+#define SCENE_CACHE_ALIGNMENT 64
+#define MAX_SOURCE_PATH_LENGTH 256
+#define SCENE_CACHE_BLOCK_SIZE (1024 * 1024)
+// Sections smaller than this are never compressed
+#define SCENE_CACHE_MIN_COMPRESSED_SIZE (64 * 1024)
+
+// Section flags
+#define SCENE_CACHE_LZ4 1
+
+enum SceneCacheSectionType {
+	SCENE_CACHE_MATERIALS = 1,
+	SCENE_CACHE_NODES,
+	SCENE_CACHE_VERTICES,
+	SCENE_CACHE_INDICES,
+	SCENE_CACHE_TEXTURES,
+	SCENE_CACHE_TEXTURE_DATA,
+	SCENE_CACHE_SOURCES,
+	SCENE_CACHE_PAGES,
+	SCENE_CACHE_GROUPS,
+	SCENE_CACHE_BVH_NODES,
+	SCENE_CACHE_BVH_SPHERES
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numSections;
+	uint32_t reserved;
+	uint64_t fileSize;
+} SceneCacheHeader;
+
+typedef struct {
+	uint32_t type;
+	uint32_t elementSize; // checked against the reader's struct size
+	uint32_t flags;
+	uint32_t blockSize; // uncompressed size of each compressed block
+	uint64_t offset;
+	uint64_t size; // uncompressed
+	uint64_t storedSize; // bytes in the file
+	uint64_t count;
+} SceneCacheSection;
+
+// SceneNode without pointers or GL object names
+typedef struct {
+	char name[MAX_NODE_NAME_STRING_LENGTH];
+	char material[MAX_MATERIAL_NAME_STRING_LENGTH];
+	float modelViewMatrix[16];
+	uint32_t startPosition;
+	uint32_t endPosition;
+	uint32_t indexStart;
+	uint32_t indexCount;
+	uint32_t primativeMode;
+	float boundingSphere;
+	float lx, ly, lz;
+} SceneCacheNode;
+
+typedef struct {
+	char name[MAX_MATERIAL_NAME_STRING_LENGTH];
+	uint32_t width, height;
+	uint32_t bpp;
+	int32_t mode;
+	uint32_t levels; // mip levels in the data, level n is max(width >> n, 1) by max(height >> n, 1)
+	uint32_t compression; // TextureCompression of the levels
+	uint64_t dataOffset; // relative to the texture data section
+	uint64_t dataSize; // of all levels
+} SceneCacheTexture;
+
+typedef struct {
+	char path[MAX_SOURCE_PATH_LENGTH];
+	uint64_t size;
+	int64_t mtime; // in the platform's native resolution
+	uint64_t hash;
+} SceneCacheSource;
+
+// A run of scene nodes sharing one vertex range and one contiguous index range, the unit of paging
+typedef struct {
+	uint32_t firstNode;
+	uint32_t numNodes;
+	uint32_t vertexStart;
+	uint32_t vertexCount;
+	uint32_t indexStart;
+	uint32_t indexCount;
+	float center[3]; // bounding sphere of the page's nodes
+	float radius;
+} SceneCachePage;
+
+// Group flags
+#define SCENE_CACHE_GROUP_LOCAL 1 // faces only reference vertex records of their own group
+
+// A g or o group of an .obj source and the consecutive scene nodes imported from it
+typedef struct {
+	uint32_t source; // index in the sources section
+	uint32_t flags;
+	uint32_t firstNode;
+	uint32_t numNodes;
+	uint64_t offset; // byte range in the source file
+	uint64_t size;
+	uint64_t hash; // of the group's bytes and the material in effect at its start
+	uint64_t vBase, vnBase, vtBase; // v, vn and vt records before the group
+	float modelViewMatrix[16]; // matrix the source was imported with
+} SceneCacheGroup;
+
+// A node of the bounding volume hierarchy over the scene nodes, boxes enclose the nodes' bounding spheres
+typedef struct {
+	float min[3], max[3];
+	uint32_t firstSphere, numSpheres; // range of scene node indices in the bvh spheres section
+	uint32_t firstChild; // left child, the right one follows it, 0 for leaves
+	uint32_t padding;
+} SceneCacheBvhNode;
+
+// 64 bit xxHash of a block of memory
+uint64_t xxHash64(const void*, size_t, uint64_t);
+// Size and modification time of a file without opening it
+bool statSourceFile(const char*, uint64_t&, int64_t&);
+// Fill in the size, mtime and content hash of a file, hashing chunks of it in parallel
+bool describeSourceFile(const char*, SceneCacheSource&, ThreadPool*);
+// Check a recorded source against the file on disk, the content is only hashed if the mtime changed
+bool isSourceFileCurrent(const SceneCacheSource&, ThreadPool*);
+// Move a complete cache file over another one, which is replaced as a whole even if the process dies meanwhile
+bool replaceSceneCacheFile(const char*, const char*);
+
+// Read only view of a memory mapped scene cache
+class SceneCache
+{
+public:
+	SceneCache();
+	~SceneCache();
+	// The thread pool is used to decompress sections
+	bool open(const char*, ThreadPool*);
+	void close();
+	const SceneCacheSection* getSection(uint32_t);
+	// Returns a pointer to the section's elements or 0 if it is missing, corrupt or has a different element size
+	const void* getSectionData(uint32_t, size_t, size_t&);
+	size_t getFileSize();
+private:
+	bool decompressSection(const SceneCacheSection*, std::vector<unsigned char>&);
+	tinyobj::MappedFile file;
+	const SceneCacheHeader* header;
+	const SceneCacheSection* sections;
+	ThreadPool* threadPool;
+	std::map<uint32_t, std::vector<unsigned char> > decompressed;
+};
+
+// Collects sections and writes them out as a scene cache
+class SceneCacheWriter
+{
+public:
+	SceneCacheWriter();
+	// Start a new section, data added to it with addSectionData
+	void addSection(uint32_t, size_t, size_t);
+	// Append data to the last section and pad it to SCENE_CACHE_ALIGNMENT, returns its offset in the section
+	uint64_t addSectionData(const void*, size_t);
+	// Write to a temporary file and rename it over filename once complete, compressing with the pool if enabled
+	bool write(const char*, ThreadPool*, bool);
+	uint64_t getRawSize();
+	uint64_t getFileSize();
+private:
+	typedef struct {
+		SceneCacheSection section;
+		std::vector<std::pair<const void*, size_t> > parts;
+	} PendingSection;
+	void copySectionRange(const PendingSection&, uint64_t, size_t, unsigned char*);
+	bool writeCompressedSection(std::ofstream&, PendingSection&, ThreadPool*);
+	std::vector<PendingSection> sections;
+	uint64_t rawSize, fileSize;
+};
+
+#endif // _SCENE_CACHE_H_
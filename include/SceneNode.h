@@ -14,15 +14,16 @@ typedef struct {
 typedef struct {
 	char name[MAX_NODE_NAME_STRING_LENGTH];
     char material[MAX_MATERIAL_NAME_STRING_LENGTH];
-	Vertex* vertexData;
-	size_t vertexDataSize;
     glm::mat4 modelViewMatrix;
-    GLuint startPosition;
-    GLuint endPosition;
+    GLuint startPosition; // first vertex, used as the base vertex when drawing
+    GLuint endPosition; // one past the last vertex
+    GLuint indexStart; // first index in the renderer's index buffer, indices are relative to startPosition
+    GLuint indexCount;
     GLenum primativeMode;
 
     GLuint ambientTextureId;
-    GLuint diffuseTextureId;
+    GLuint diffuseTextureId; // 2D texture array holding the diffuse texture
+    GLuint diffuseLayer; // layer of the diffuse texture in its array
     GLuint normalTextureId;
     GLuint specularTextureId;
 
@@ -0,0 +1,66 @@
+#ifndef _SCENE_PAGER_H_
+#define _SCENE_PAGER_H_
+
+#include "Common.h"
+#include "Frustum.h"
+#include "SceneCache.h"
+#include "SceneNode.h"
+#include "ThreadPool.h"
+
+enum ScenePageState {
+	PAGE_ON_DISK = 0,
+	PAGE_LOADING,
+	PAGE_IN_RAM
+};
+
+typedef struct {
+	SceneCachePage info;
+	SDL_atomic_t state;
+	std::vector<unsigned char> ram; // vertices followed by indices, filled by a worker thread
+	GLuint vbo, ibo; // 0 unless the page is resident in VRAM
+	float distance; // from the camera to the bounding sphere
+	bool visible, wantRam, wantVram;
+	Uint64 requestTime; // when the page was first wanted in VRAM, 0 if not waiting
+} ScenePage;
+
+// Keeps the geometry of the pages closest to the camera in RAM and VRAM within fixed budgets,
+// reading pages from the mapped scene cache on worker threads and uploading them on the GL thread
+class ScenePager
+{
+public:
+	ScenePager(const SceneCachePage*, size_t, const Vertex*, const GLuint*, size_t, ThreadPool*, size_t, size_t, size_t);
+	~ScenePager();
+	// Pick the pages to keep resident for this camera, start loads and upload finished ones
+	void update(Frustum&, glm::vec3&);
+	// Bind the node's page buffers, returns false if the page is not in VRAM
+	bool bindNode(size_t);
+	// Forget the bound page, other passes may have changed the buffer bindings
+	void beginPass();
+	// Whether a node's page is in VRAM, and its index, draws batched together must share a page
+	bool isNodeResident(size_t);
+	size_t getNodePage(size_t);
+	// Index buffer offset and base vertex of a node within its page
+	GLuint getIndexOffset(SceneNode&, size_t);
+	GLint getBaseVertex(SceneNode&, size_t);
+	void printStats(std::ostream&);
+private:
+	static void loadPage(ScenePage*, const Vertex*, const GLuint*);
+	size_t pageBytes(ScenePage&);
+	void evictFromVram(ScenePage&);
+	std::vector<ScenePage> pages;
+	// Pages by priority, a scratch list of update sized once so frames don't allocate
+	std::vector<ScenePage*> sorted;
+	std::vector<size_t> nodePages;
+	const Vertex* vertices;
+	const GLuint* indices;
+	ThreadPool* threadPool;
+	size_t ramBudget, vramBudget, uploadBudget;
+	size_t ramBytes, vramBytes;
+	SDL_atomic_t loadsInFlight;
+	ScenePage* boundPage;
+	// Page-in latency since the last printStats
+	double latencySum, latencyMax;
+	size_t latencyCount;
+};
+
+#endif // _SCENE_PAGER_H_
@@ -0,0 +1,38 @@
+#ifndef _TEXTURE_COMPRESSION_H_
+#define _TEXTURE_COMPRESSION_H_
+
+#include "Material.h"
+#include "ThreadPool.h"
+
+// S3TC isn't in the generated loader, the formats are part of EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Block compression formats, every 4x4 block of pixels is encoded on its own
+enum TextureCompression {
+	TEXTURE_COMPRESSION_NONE = 0,
+	TEXTURE_COMPRESSION_BC1, // RGB, 8 bytes per block
+	TEXTURE_COMPRESSION_BC3, // RGBA, BC1 color with a separate alpha block, 16 bytes per block
+	TEXTURE_COMPRESSION_BC7 // RGBA, 16 bytes per block, only mode 6 is written or read
+};
+
+// GL internal format of a compression format
+GLenum compressionInternalFormat(unsigned);
+// Bytes of one level of a texture's data and of all its levels, compressed or not
+size_t textureLevelSize(const Texture&, unsigned);
+size_t textureDataSize(const Texture&);
+// Compress every level of a texture with raw RGB or RGBA pixels, blocks of each level are encoded in parallel
+// on the pool. The compressed texture keeps the size and mode, its data points into the vector.
+void compressTexture(const Texture&, unsigned, ThreadPool*, Texture&, std::vector<unsigned char>&);
+// Decompress a level into tightly packed pixels with the texture's bpp
+void decompressLevel(const Texture&, unsigned, unsigned char*);
+// Decompress a whole chain into raw pixels, for drivers that can't sample the format
+void decompressTexture(const Texture&, std::vector<unsigned char>&);
+// Peak signal to noise ratio in dB of two tightly packed images of the same size
+double computePsnr(const unsigned char*, const unsigned char*, size_t);
+
+#endif // _TEXTURE_COMPRESSION_H_
@@ -0,0 +1,28 @@
+#ifndef _TEXTURE_REGISTRY_H_
+#define _TEXTURE_REGISTRY_H_
+
+#include "Common.h"
+
+// GL texture objects shared by every scene node using the same image file, deleted with their last reference.
+// A texture array is registered under every file packed into it.
+class TextureRegistry
+{
+public:
+	~TextureRegistry();
+	// Add a reference to the texture object of a file, returns false if it isn't uploaded yet
+	bool acquire(const std::string&, GLuint*);
+	// Register a texture object under a file, a new object starts with the caller's reference.
+	// Several files can share one object, e.g. missing textures all use the blank texture.
+	void add(const std::string&, GLuint);
+	// Whether a file has a texture object, without adding a reference
+	bool contains(const std::string&);
+	// Drop a reference, ids that were never registered are deleted right away. Returns true if the object was deleted.
+	bool release(GLuint);
+	size_t getNumTextures();
+	size_t getNumReferences();
+private:
+	std::map<std::string, GLuint> ids;
+	std::map<GLuint, unsigned> references;
+};
+
+#endif // _TEXTURE_REGISTRY_H_
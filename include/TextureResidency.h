@@ -0,0 +1,54 @@
+#ifndef _TEXTURE_RESIDENCY_H_
+#define _TEXTURE_RESIDENCY_H_
+
+#include "Common.h"
+#include "Material.h"
+#include "TextureStreamer.h"
+
+// A texture array whose mip levels are streamed in and out, levels baseLevel and below are in VRAM
+typedef struct {
+	std::vector<Texture> layers; // pixels of every layer, all with the same size, levels and format
+	std::vector<std::vector<unsigned char> > pixels; // decompressed layers point into these
+	unsigned baseLevel; // finest level sampled, the number of levels while none is resident
+	unsigned loadingLevel; // level being streamed in, baseLevel if none
+	unsigned wantedLevel; // finest level the visible nodes need this frame
+	float footprint; // largest screen size in pixels of a visible node this frame
+	size_t lastVisibleFrame;
+} ResidentTexture;
+
+// Keeps the mip levels of texture arrays in VRAM that the visible nodes' screen footprints need, within a budget.
+// Levels are streamed in from the smallest one up, the finest levels of the least recently visible textures are
+// evicted first to make room.
+class TextureResidency
+{
+public:
+	TextureResidency(TextureStreamer*, size_t);
+	// Manage a texture array with parameters set but no storage, and the decompressed pixels its layers point into
+	void addTexture(GLuint, const std::vector<Texture>&, std::vector<std::vector<unsigned char> >&);
+	// Forget a deleted texture
+	void removeTexture(GLuint);
+	// Whether a texture has a level to sample, textures that aren't managed always do
+	bool isDrawable(GLuint);
+	// A node using a texture is visible and covers the given pixels on screen
+	void markVisible(GLuint, float);
+	// Finish loads, then start loading and evict levels for the footprints marked since the last update
+	void update();
+	size_t getResidentBytes();
+	// Levels evicted to stay inside the budget since the start
+	size_t getEvictions();
+	void printStats(std::ostream&);
+private:
+	size_t levelBytes(ResidentTexture&, unsigned);
+	size_t evictableBytes(ResidentTexture&);
+	bool evictLevel(GLuint);
+	std::map<GLuint, ResidentTexture> textures;
+	// Scratch lists of update, kept to reuse their storage every frame
+	std::vector<std::pair<int, GLuint> > wanted;
+	std::vector<std::pair<size_t, GLuint> > victims;
+	TextureStreamer* streamer;
+	size_t budget; // 0 for no limit
+	size_t residentBytes, frame;
+	size_t evictions, loads; // levels since the start
+};
+
+#endif // _TEXTURE_RESIDENCY_H_
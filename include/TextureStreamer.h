@@ -0,0 +1,59 @@
+#ifndef _TEXTURE_STREAMER_H_
+#define _TEXTURE_STREAMER_H_
+
+#include "Common.h"
+#include "Material.h"
+
+#include <deque>
+
+// A mip level of a texture waiting to be copied into a layer of a texture array
+typedef struct {
+	GLuint texture, layer;
+	unsigned level, width, height;
+	GLenum format; // internal format of compressed levels, pixel format of raw ones
+	bool compressed;
+	size_t rowBytes; // of a row of pixels, or of 4x4 blocks for compressed levels
+	unsigned rowHeight; // pixel rows in a row, 4 for compressed levels
+	unsigned rows, nextRow; // rows of the level and the first one not copied yet
+	const unsigned char* data;
+} TextureUpload;
+
+// Pixel buffer object a frame's uploads are copied into, reused once the GPU has read it
+typedef struct {
+	GLuint pbo;
+	GLsync fence; // 0 if the buffer is free
+	std::vector<GLuint> levelsDone; // texture of each layer's level finished by this buffer
+} TextureUploadBuffer;
+
+// Uploads mip levels of texture array layers through pixel buffer objects within a per frame byte and time budget.
+// A level is resident once the fence after its last rows is signaled.
+class TextureStreamer
+{
+public:
+	TextureStreamer(size_t, double);
+	~TextureStreamer();
+	// Queue a level of a texture for upload into a layer of a texture array, the level's storage must be allocated
+	void queueLevel(GLuint, GLuint, unsigned, const Texture&);
+	// Drop the uploads of a deleted texture
+	void cancel(GLuint);
+	// Retire finished uploads and start the next ones, called once per frame on the GL thread
+	void update();
+	// Whether levels queued for a texture haven't all been uploaded yet
+	bool isUploading(GLuint);
+	// 1x1 grey texture array drawn in place of textures without a resident level
+	GLuint getPlaceholder();
+	void printStats(std::ostream&);
+private:
+	std::deque<TextureUpload> queue;
+	std::vector<TextureUploadBuffer> buffers;
+	std::vector<TextureUpload> chunks; // rows copied by the last update, kept to reuse its storage
+	std::map<GLuint, unsigned> pendingLevels; // layer levels of each texture not uploaded yet
+	size_t byteBudget;
+	double timeBudget; // seconds
+	GLuint placeholder;
+	// Uploads since the last printStats
+	size_t bytesUploaded, levelsUploaded, framesUploading;
+	double maxFrameSeconds;
+};
+
+#endif // _TEXTURE_STREAMER_H_
@@ -0,0 +1,30 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include "Common.h"
+
+#include <deque>
+#include <functional>
+#include <SDL_thread.h>
+
+// Fixed set of SDL worker threads shared by the loaders
+class ThreadPool
+{
+public:
+	// 0 starts one worker per logical CPU
+	ThreadPool(unsigned);
+	~ThreadPool();
+	void enqueue(const std::function<void()>&);
+	// Call fn(i) for every i < count and return once all calls finished, the calling thread helps out
+	void parallelFor(size_t, const std::function<void(size_t)>&);
+	unsigned getNumThreads();
+private:
+	static int workerMain(void*);
+	std::vector<SDL_Thread*> threads;
+	std::deque<std::function<void()> > tasks;
+	SDL_mutex* mutex;
+	SDL_cond* taskAvailable;
+	bool stopping;
+};
+
+#endif // _THREAD_POOL_H_
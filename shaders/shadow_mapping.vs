@@ -2,6 +2,7 @@
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoords;
+layout (location = 3) in uint drawLayer; // per draw layer of indirect draws, 0 otherwise
 
 out vec2 TexCoords;
 
@@ -12,10 +13,20 @@ out VS_OUT {
     vec4 FragPosLightSpace;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
-uniform mat4 lightSpaceMatrix;
+flat out uint DrawLayer;
+
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec4 lightPos;
+    vec4 viewPos;
+};
+
+layout (std140) uniform ProgramData {
+    mat4 model;
+    int shadows;
+};
 
 void main()
 {
@@ -24,4 +35,5 @@ void main()
     vs_out.Normal = transpose(inverse(mat3(model))) * normal;
     vs_out.TexCoords = texCoords;
     vs_out.FragPosLightSpace = lightSpaceMatrix * vec4(vs_out.FragPos, 1.0);
+    DrawLayer = drawLayer;
 }
\ No newline at end of file
@@ -1,8 +1,18 @@
 #version 330 core
 layout (location = 0) in vec3 position;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec4 lightPos;
+    vec4 viewPos;
+};
+
+layout (std140) uniform ProgramData {
+    mat4 model;
+    int shadows;
+};
 
 void main()
 {
@@ -0,0 +1,259 @@
+#include "BoundingVolumeHierarchy.h"
+
+#include <cfloat>
+
+// Spheres binned by their centers along the longest axis of a node, the split is picked between two bins
+#define BVH_BINS 16
+// Nodes with this many spheres or fewer become leaves
+#define BVH_MIN_LEAF_SIZE 4
+// Nodes with more spheres are split even if the surface area heuristic says a leaf is cheaper
+#define BVH_MAX_LEAF_SIZE 16
+// Deeper nodes become leaves, which bounds the traversal stack
+#define BVH_MAX_DEPTH 48
+
+typedef struct {
+	float min[3], max[3];
+	size_t count;
+} BvhBin;
+
+// A sphere while building, partitioned with its node's range so every level reads memory in order
+typedef struct {
+	float center[3];
+	float radius;
+	uint32_t index;
+} BvhSphere;
+
+static void emptyBox(float* min, float* max)
+{
+	for(int a = 0; a < 3; a++) {
+		min[a] = FLT_MAX;
+		max[a] = -FLT_MAX;
+	}
+}
+
+static void growBox(float* min, float* max, const float* otherMin, const float* otherMax)
+{
+	for(int a = 0; a < 3; a++) {
+		min[a] = std::min(min[a], otherMin[a]);
+		max[a] = std::max(max[a], otherMax[a]);
+	}
+}
+
+// Half the surface area, the heuristic only compares areas
+static float boxArea(const float* min, const float* max)
+{
+	float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+	return x * y + y * z + z * x;
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy()
+{
+	nodesVisited = 0;
+}
+
+void BoundingVolumeHierarchy::build(const SphereBounds& bounds)
+{
+	size_t numBounds = bounds.x.size();
+	nodes.clear();
+	spheres.resize(numBounds);
+	if(numBounds == 0) return;
+	std::vector<BvhSphere> items(numBounds);
+	for(size_t i = 0; i < numBounds; i++) {
+		items[i].center[0] = bounds.x[i];
+		items[i].center[1] = bounds.y[i];
+		items[i].center[2] = bounds.z[i];
+		items[i].radius = bounds.radius[i];
+		items[i].index = (uint32_t) i;
+	}
+
+	SceneCacheBvhNode root;
+	memset(&root, 0, sizeof(SceneCacheBvhNode));
+	root.numSpheres = (uint32_t) numBounds;
+	nodes.push_back(root);
+
+	// Nodes waiting to be split and their depth
+	std::vector<std::pair<uint32_t, unsigned> > pending(1, std::make_pair(0u, 0u));
+	while(!pending.empty()) {
+		uint32_t index = pending.back().first;
+		unsigned depth = pending.back().second;
+		pending.pop_back();
+		uint32_t first = nodes[index].firstSphere, count = nodes[index].numSpheres;
+		BvhSphere* begin = &items[0] + first;
+		BvhSphere* end = begin + count;
+
+		// Box around the spheres, and around their centers to place the bins
+		float min[3], max[3], centerMin[3], centerMax[3];
+		emptyBox(min, max);
+		emptyBox(centerMin, centerMax);
+		for(BvhSphere* it = begin; it != end; ++it) {
+			float r = it->radius;
+			float sphereMin[3] = {it->center[0] - r, it->center[1] - r, it->center[2] - r};
+			float sphereMax[3] = {it->center[0] + r, it->center[1] + r, it->center[2] + r};
+			growBox(min, max, sphereMin, sphereMax);
+			growBox(centerMin, centerMax, it->center, it->center);
+		}
+		memcpy(nodes[index].min, min, sizeof(min));
+		memcpy(nodes[index].max, max, sizeof(max));
+		if(count <= BVH_MIN_LEAF_SIZE || depth >= BVH_MAX_DEPTH) continue;
+
+		int axis = 0;
+		for(int a = 1; a < 3; a++) {
+			if(centerMax[a] - centerMin[a] > centerMax[axis] - centerMin[axis]) axis = a;
+		}
+		float extent = centerMax[axis] - centerMin[axis];
+		// Every center is in the same place, no split separates them
+		if(extent <= 0.f) continue;
+		float scale = BVH_BINS / extent;
+		float origin = centerMin[axis];
+		auto binOf = [&](const BvhSphere& sphere) {
+			return std::min((int) ((sphere.center[axis] - origin) * scale), BVH_BINS - 1);
+		};
+
+		BvhBin bins[BVH_BINS];
+		for(int b = 0; b < BVH_BINS; b++) {
+			emptyBox(bins[b].min, bins[b].max);
+			bins[b].count = 0;
+		}
+		for(BvhSphere* it = begin; it != end; ++it) {
+			float r = it->radius;
+			float sphereMin[3] = {it->center[0] - r, it->center[1] - r, it->center[2] - r};
+			float sphereMax[3] = {it->center[0] + r, it->center[1] + r, it->center[2] + r};
+			BvhBin& bin = bins[binOf(*it)];
+			growBox(bin.min, bin.max, sphereMin, sphereMax);
+			bin.count++;
+		}
+
+		// Cost of the spheres right of every split, then sweep from the left for the cheapest one.
+		// The first and last bin hold the extreme centers, so both sides of any split are non empty.
+		float rightCost[BVH_BINS];
+		float sideMin[3], sideMax[3];
+		size_t sideCount = 0;
+		emptyBox(sideMin, sideMax);
+		for(int b = BVH_BINS - 1; b > 0; b--) {
+			if(bins[b].count > 0) growBox(sideMin, sideMax, bins[b].min, bins[b].max);
+			sideCount += bins[b].count;
+			rightCost[b] = sideCount > 0 ? boxArea(sideMin, sideMax) * sideCount : 0.f;
+		}
+		int split = 0;
+		float splitCost = FLT_MAX;
+		sideCount = 0;
+		emptyBox(sideMin, sideMax);
+		for(int b = 0; b < BVH_BINS - 1; b++) {
+			if(bins[b].count > 0) growBox(sideMin, sideMax, bins[b].min, bins[b].max);
+			sideCount += bins[b].count;
+			float cost = (sideCount > 0 ? boxArea(sideMin, sideMax) * sideCount : 0.f) + rightCost[b + 1];
+			if(cost < splitCost) {
+				splitCost = cost;
+				split = b;
+			}
+		}
+		if(count <= BVH_MAX_LEAF_SIZE && splitCost >= boxArea(min, max) * count) continue;
+
+		uint32_t middle = first + (uint32_t) (std::partition(begin, end,
+				[&](const BvhSphere& sphere) { return binOf(sphere) <= split; }) - begin);
+		SceneCacheBvhNode child;
+		memset(&child, 0, sizeof(SceneCacheBvhNode));
+		nodes[index].firstChild = (uint32_t) nodes.size();
+		child.firstSphere = first;
+		child.numSpheres = middle - first;
+		nodes.push_back(child);
+		child.firstSphere = middle;
+		child.numSpheres = first + count - middle;
+		nodes.push_back(child);
+		pending.push_back(std::make_pair(nodes[index].firstChild + 1, depth + 1));
+		pending.push_back(std::make_pair(nodes[index].firstChild, depth + 1));
+	}
+	for(size_t i = 0; i < numBounds; i++) spheres[i] = items[i].index;
+}
+
+bool BoundingVolumeHierarchy::load(const SceneCacheBvhNode* cachedNodes, size_t numNodes, const uint32_t* cachedSpheres,
+		size_t numSpheres, size_t count)
+{
+	if(numSpheres != count || (numNodes == 0) != (count == 0)) return false;
+	if(numNodes > 0 && (cachedNodes[0].firstSphere != 0 || cachedNodes[0].numSpheres != count)) return false;
+
+	// Every sphere once, every node but the root the child of one node, after it, with the children splitting its
+	// range. Culling relies on this to stay inside the visible list and its stack.
+	std::vector<bool> seen(count, false);
+	for(size_t i = 0; i < count; i++) {
+		if(cachedSpheres[i] >= count || seen[cachedSpheres[i]]) return false;
+		seen[cachedSpheres[i]] = true;
+	}
+	std::vector<unsigned> depth(numNodes, 0);
+	std::vector<bool> isChild(numNodes, false);
+	for(size_t i = 0; i < numNodes; i++) {
+		const SceneCacheBvhNode& node = cachedNodes[i];
+		if((uint64_t) node.firstSphere + node.numSpheres > count) return false;
+		if(node.firstChild == 0) continue;
+		if(node.firstChild <= i || (size_t) node.firstChild + 1 >= numNodes) return false;
+		const SceneCacheBvhNode& left = cachedNodes[node.firstChild];
+		const SceneCacheBvhNode& right = cachedNodes[node.firstChild + 1];
+		if(isChild[node.firstChild] || isChild[node.firstChild + 1] || left.firstSphere != node.firstSphere
+				|| right.firstSphere != left.firstSphere + left.numSpheres
+				|| (uint64_t) right.firstSphere + right.numSpheres != (uint64_t) node.firstSphere + node.numSpheres) {
+			return false;
+		}
+		isChild[node.firstChild] = isChild[node.firstChild + 1] = true;
+		depth[node.firstChild] = depth[node.firstChild + 1] = depth[i] + 1;
+		if(depth[i] + 1 > BVH_MAX_DEPTH) return false;
+	}
+
+	nodes.assign(cachedNodes, cachedNodes + numNodes);
+	spheres.assign(cachedSpheres, cachedSpheres + numSpheres);
+	return true;
+}
+
+size_t BoundingVolumeHierarchy::cull(Frustum& frustum, const SphereBounds& bounds, uint32_t* visible)
+{
+	size_t n = 0;
+	nodesVisited = 0;
+	if(nodes.empty()) return 0;
+
+	// Depth first with the right child pushed first, a node is at most one entry per level above it
+	uint32_t stackNodes[BVH_MAX_DEPTH + 2];
+	unsigned stackPlanes[BVH_MAX_DEPTH + 2];
+	int top = 0;
+	stackNodes[0] = 0;
+	stackPlanes[0] = 0x3f;
+	while(top >= 0) {
+		const SceneCacheBvhNode& node = nodes[stackNodes[top]];
+		unsigned planes = stackPlanes[top];
+		top--;
+		nodesVisited++;
+
+		// Planes the parent was inside of aren't tested again
+		if(frustum.boxPartiallyInFrustum(node.min, node.max, planes) == 0) continue;
+		const uint32_t* nodeSpheres = &spheres[0] + node.firstSphere;
+		if(planes == 0) {
+			memcpy(visible + n, nodeSpheres, sizeof(uint32_t) * node.numSpheres);
+			n += node.numSpheres;
+		} else if(node.firstChild == 0) {
+			for(uint32_t s = 0; s < node.numSpheres; s++) {
+				uint32_t i = nodeSpheres[s];
+				visible[n] = i;
+				n += frustum.sphereInPlanes(bounds.x[i], bounds.y[i], bounds.z[i], bounds.radius[i], planes);
+			}
+		} else {
+			stackNodes[++top] = node.firstChild + 1;
+			stackPlanes[top] = planes;
+			stackNodes[++top] = node.firstChild;
+			stackPlanes[top] = planes;
+		}
+	}
+	return n;
+}
+
+const std::vector<SceneCacheBvhNode>& BoundingVolumeHierarchy::getNodes()
+{
+	return nodes;
+}
+
+const std::vector<uint32_t>& BoundingVolumeHierarchy::getSpheres()
+{
+	return spheres;
+}
+
+size_t BoundingVolumeHierarchy::getNodesVisited()
+{
+	return nodesVisited;
+}
@@ -1,5 +1,13 @@
 #include "Frustum.h"
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE2
+#endif
+
 
 void Frustum::extractFrustum(glm::mat4& modelViewMatrix, glm::mat4& projectionMatrix)
 {
@@ -192,6 +200,116 @@ int Frustum::spherePartiallyInFrustum( float x, float y, float z, float radius )
     return (c == 6) ? 2 : 1;
 }
 
+// Same test as spherePartiallyInFrustum returning non zero, on 8 spheres at a time with AVX or 4 with SSE2.
+// Lanes are appended to the list unconditionally and the count only advances past the visible ones, so the
+// compaction has no branches. A lane's slot never lies past its own index, which keeps the writes in the list.
+size_t Frustum::spheresPartiallyInFrustum( const SphereBounds& bounds, uint32_t* visible )
+{
+    size_t count = bounds.x.size();
+    size_t n = 0;
+    size_t i = 0;
+    if( count == 0 )
+        return 0;
+    const float* xs = &bounds.x[0];
+    const float* ys = &bounds.y[0];
+    const float* zs = &bounds.z[0];
+    const float* rs = &bounds.radius[0];
+
+#if defined(FRUSTUM_AVX)
+    __m256 planes[6][4];
+    for( int p = 0; p < 6; p++ )
+        for( int c = 0; c < 4; c++ )
+            planes[p][c] = _mm256_set1_ps( frustum[p][c] );
+    for( ; i + 8 <= count; i += 8 )
+    {
+        __m256 x = _mm256_loadu_ps( xs + i );
+        __m256 y = _mm256_loadu_ps( ys + i );
+        __m256 z = _mm256_loadu_ps( zs + i );
+        __m256 negativeR = _mm256_sub_ps( _mm256_setzero_ps(), _mm256_loadu_ps( rs + i ) );
+        __m256 inside = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+        for( int p = 0; p < 6; p++ )
+        {
+            __m256 d = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( planes[p][0], x ), _mm256_mul_ps( planes[p][1], y ) ),
+                    _mm256_mul_ps( planes[p][2], z ) ), planes[p][3] );
+            inside = _mm256_and_ps( inside, _mm256_cmp_ps( d, negativeR, _CMP_GT_OQ ) );
+        }
+        int mask = _mm256_movemask_ps( inside );
+        for( int lane = 0; lane < 8; lane++ )
+        {
+            visible[n] = (uint32_t) (i + lane);
+            n += (mask >> lane) & 1;
+        }
+    }
+#elif defined(FRUSTUM_SSE2)
+    __m128 planes[6][4];
+    for( int p = 0; p < 6; p++ )
+        for( int c = 0; c < 4; c++ )
+            planes[p][c] = _mm_set1_ps( frustum[p][c] );
+    for( ; i + 4 <= count; i += 4 )
+    {
+        __m128 x = _mm_loadu_ps( xs + i );
+        __m128 y = _mm_loadu_ps( ys + i );
+        __m128 z = _mm_loadu_ps( zs + i );
+        __m128 negativeR = _mm_sub_ps( _mm_setzero_ps(), _mm_loadu_ps( rs + i ) );
+        __m128 inside = _mm_castsi128_ps( _mm_set1_epi32( -1 ) );
+        for( int p = 0; p < 6; p++ )
+        {
+            __m128 d = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( planes[p][0], x ), _mm_mul_ps( planes[p][1], y ) ),
+                    _mm_mul_ps( planes[p][2], z ) ), planes[p][3] );
+            inside = _mm_and_ps( inside, _mm_cmpgt_ps( d, negativeR ) );
+        }
+        int mask = _mm_movemask_ps( inside );
+        for( int lane = 0; lane < 4; lane++ )
+        {
+            visible[n] = (uint32_t) (i + lane);
+            n += (mask >> lane) & 1;
+        }
+    }
+#endif
+
+    // Spheres left over from the batches, or all of them without SIMD
+    for( ; i < count; i++ )
+    {
+        int p;
+        for( p = 0; p < 6; p++ )
+        {
+            if( frustum[p][0] * xs[i] + frustum[p][1] * ys[i] + frustum[p][2] * zs[i] + frustum[p][3] <= -rs[i] )
+                break;
+        }
+        visible[n] = (uint32_t) i;
+        n += p == 6;
+    }
+    return n;
+}
+
+int Frustum::boxPartiallyInFrustum( const float* min, const float* max, unsigned& planes )
+{
+    float cx = ( min[0] + max[0] ) * 0.5f, cy = ( min[1] + max[1] ) * 0.5f, cz = ( min[2] + max[2] ) * 0.5f;
+    float ex = ( max[0] - min[0] ) * 0.5f, ey = ( max[1] - min[1] ) * 0.5f, ez = ( max[2] - min[2] ) * 0.5f;
+
+    for( int p = 0; p < 6; p++ )
+    {
+        if( !( planes & ( 1u << p ) ) )
+            continue;
+        // Distance of the center and the box's extent along the plane normal
+        float d = frustum[p][0] * cx + frustum[p][1] * cy + frustum[p][2] * cz + frustum[p][3];
+        float r = fabsf( frustum[p][0] ) * ex + fabsf( frustum[p][1] ) * ey + fabsf( frustum[p][2] ) * ez;
+        if( d <= -r )
+            return 0;
+        if( d >= r )
+            planes &= ~( 1u << p );
+    }
+    return planes == 0 ? 2 : 1;
+}
+
+bool Frustum::sphereInPlanes( float x, float y, float z, float radius, unsigned planes )
+{
+    for( int p = 0; p < 6; p++ )
+        if( ( planes & ( 1u << p ) ) && frustum[p][0] * x + frustum[p][1] * y + frustum[p][2] * z + frustum[p][3] <= -radius )
+            return false;
+    return true;
+}
+
 //returns 0 if the cube is totally outside, 1 if it's partially inside, and 2 if it's totally inside
 int Frustum::cubePartiallyInFrustum( float x, float y, float z, float size )
 {
@@ -1,13 +1,27 @@
 #include "Common.h"
 #include "GpuProgram.h"
 
+Uniform::Uniform()
+{
+	location = -1;
+	dirty = true;
+}
+
 Uniform::~Uniform() {
 
 }
 
+void Uniform::load()
+{
+	if(!dirty) return;
+	upload();
+	dirty = false;
+}
+
 void Uniform::setLocation(GLuint _location)
 {
 	location = _location;
+	dirty = true;
 }
 
 GLuint Uniform::getLocation()
@@ -15,34 +29,38 @@ GLuint Uniform::getLocation()
 	return location;
 }
 
-UniformMat4::UniformMat4(glm::mat4& mat)
+UniformMat4::UniformMat4(const glm::mat4& mat)
 {
 	matrix = mat;
 }
 
-void UniformMat4::load()
+void UniformMat4::upload()
 {
 	glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(matrix));
 }
 
-void UniformMat4::set(glm::mat4& mat)
+void UniformMat4::set(const glm::mat4& mat)
 {
+	if(mat == matrix) return;
 	matrix = mat;
+	dirty = true;
 }
 
-UniformVec3::UniformVec3(glm::vec3& vec)
+UniformVec3::UniformVec3(const glm::vec3& vec)
 {
 	vector = vec;
 }
 
-void UniformVec3::load()
+void UniformVec3::upload()
 {
 	glUniform3f(location, vector.x, vector.y, vector.z);
 }
 
-void UniformVec3::set(glm::vec3& vec)
+void UniformVec3::set(const glm::vec3& vec)
 {
+	if(vec == vector) return;
 	vector = vec;
+	dirty = true;
 }
 
 UniformInt::UniformInt(GLint _i)
@@ -50,14 +68,16 @@ UniformInt::UniformInt(GLint _i)
 	i = _i;
 }
 
-void UniformInt::load()
+void UniformInt::upload()
 {
 	glUniform1i(location, i);
 }
 
 void UniformInt::set(GLint _i)
 {
+	if(_i == i) return;
 	i = _i;
+	dirty = true;
 }
 
 UniformLoader::UniformLoader(GLuint _programId)
@@ -67,33 +87,86 @@ UniformLoader::UniformLoader(GLuint _programId)
 
 UniformLoader::~UniformLoader()
 {
-    for (std::map<std::string, Uniform*>::iterator it=uniforms.begin(); it!=uniforms.end(); ++it) {
-    	if(it->second != NULL) delete it->second;
-    }
+	for(size_t i = 0; i < uniforms.size(); i++) {
+		if(uniforms[i] != NULL) delete uniforms[i];
+	}
 }
 
-Uniform* UniformLoader::get(const char* lookup)
+UniformHandle UniformLoader::getHandle(const char* lookup)
 {
 	std::string lookupStr(lookup);
-	if(uniforms.find(lookupStr) == uniforms.end()) {
+	std::map<std::string, UniformHandle>::iterator it = handles.find(lookupStr);
+	if(it == handles.end()) {
 		std::cerr << "Uniform " << lookupStr << " does not exist." << std::endl;
 		exit(5);
 	}
-	return uniforms[lookupStr];
+	return it->second;
+}
+
+Uniform* UniformLoader::get(UniformHandle handle)
+{
+	return uniforms[handle];
 }
 
 void UniformLoader::load()
 {
-	for (std::map<std::string, Uniform*>::iterator it=uniforms.begin(); it!=uniforms.end(); ++it) {
-		it->second->load();
+	for(size_t i = 0; i < uniforms.size(); i++) {
+		uniforms[i]->load();
 	}
 }
 
-void UniformLoader::addUniform(const char* name, Uniform* uniform)
+UniformHandle UniformLoader::addUniform(const char* name, Uniform* uniform)
 {
 	std::string nameStr(name);
 	uniform->setLocation(glGetUniformLocation(programId, name));
-	uniforms[nameStr] = uniform;
+	std::map<std::string, UniformHandle>::iterator it = handles.find(nameStr);
+	if(it != handles.end()) {
+		delete uniforms[it->second];
+		uniforms[it->second] = uniform;
+		return it->second;
+	}
+	UniformHandle handle = (UniformHandle) uniforms.size();
+	uniforms.push_back(uniform);
+	handles[nameStr] = handle;
+	return handle;
+}
+
+UniformBuffer::UniformBuffer(GLuint _binding, size_t size)
+{
+	binding = _binding;
+	data.resize(size, 0);
+	dirty = true;
+	glGenBuffers(1, &id);
+	glBindBuffer(GL_UNIFORM_BUFFER, id);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, id);
+}
+
+UniformBuffer::~UniformBuffer()
+{
+	glDeleteBuffers(1, &id);
+}
+
+void UniformBuffer::set(const void* block)
+{
+	if(memcmp(&data[0], block, data.size()) == 0) return;
+	memcpy(&data[0], block, data.size());
+	dirty = true;
+}
+
+void UniformBuffer::load()
+{
+	if(!dirty) return;
+	glBindBuffer(GL_UNIFORM_BUFFER, id);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, data.size(), &data[0]);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	dirty = false;
+}
+
+GLuint UniformBuffer::getBinding()
+{
+	return binding;
 }
 
 GpuProgram::GpuProgram()
@@ -113,6 +186,12 @@ void GpuProgram::attachShader(Shader& _shader)
 	glAttachShader(id, _shader.getId());
 }
 
+void GpuProgram::bindUniformBlock(const char* name, GLuint binding)
+{
+	GLuint index = glGetUniformBlockIndex(id, name);
+	if(index != GL_INVALID_INDEX) glUniformBlockBinding(id, index, binding);
+}
+
 GLuint GpuProgram::getId()
 {
 	return id;
@@ -0,0 +1,181 @@
+#include "Lz4.h"
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the last bytes of a block are always literals
+#define LZ4_MF_LIMIT 12 // a match can't start within this many bytes of the end
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_LOG 16
+
+static inline uint32_t read32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t hashPosition(const unsigned char* p)
+{
+	return (read32(p) * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+// Number of equal bytes at ip and ref before ip reaches limit, compared 8 bytes at a time
+static inline size_t countMatch(const unsigned char* src, size_t ip, size_t ref, size_t limit)
+{
+	size_t start = ip;
+	while(ip + 8 <= limit) {
+		uint64_t a, b;
+		memcpy(&a, src + ip, sizeof(a));
+		memcpy(&b, src + ref, sizeof(b));
+		uint64_t diff = a ^ b;
+		if(diff) {
+			// little endian, the first differing byte is the lowest set one
+			unsigned equalBytes = 0;
+			while(!(diff & 0xff)) {
+				diff >>= 8;
+				equalBytes++;
+			}
+			return ip - start + equalBytes;
+		}
+		ip += 8;
+		ref += 8;
+	}
+	while(ip < limit && src[ip] == src[ref]) {
+		ip++;
+		ref++;
+	}
+	return ip - start;
+}
+
+// Write a length that didn't fit in the token as a run of 255s and a remainder
+static inline unsigned char* writeLength(unsigned char* op, size_t length)
+{
+	for(; length >= 255; length -= 255) *op++ = 255;
+	*op++ = (unsigned char) length;
+	return op;
+}
+
+static inline unsigned char* writeSequence(unsigned char* op, const unsigned char* literals, size_t numLiterals,
+		size_t offset, size_t matchLength)
+{
+	unsigned char* token = op++;
+	*token = (unsigned char) ((numLiterals >= 15 ? 15 : numLiterals) << 4);
+	if(numLiterals >= 15) op = writeLength(op, numLiterals - 15);
+	memcpy(op, literals, numLiterals);
+	op += numLiterals;
+
+	// The last sequence of a block only has literals
+	if(matchLength == 0) return op;
+
+	*op++ = (unsigned char) (offset & 0xff);
+	*op++ = (unsigned char) (offset >> 8);
+	matchLength -= LZ4_MIN_MATCH;
+	*token |= (unsigned char) (matchLength >= 15 ? 15 : matchLength);
+	if(matchLength >= 15) op = writeLength(op, matchLength - 15);
+	return op;
+}
+
+size_t lz4CompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t lz4Compress(const unsigned char* src, size_t srcSize, unsigned char* dst)
+{
+	unsigned char* op = dst;
+	size_t anchor = 0;
+
+	if(srcSize > LZ4_MF_LIMIT) {
+		// Greedy matching against the last position each 4 byte hash was seen at
+		std::vector<uint32_t> table(1 << LZ4_HASH_LOG, 0);
+		size_t matchStartLimit = srcSize - LZ4_MF_LIMIT;
+		size_t matchEndLimit = srcSize - LZ4_LAST_LITERALS;
+		size_t ip = 1;
+		unsigned misses = 0;
+
+		while(ip < matchStartLimit) {
+			uint32_t h = hashPosition(src + ip);
+			size_t ref = table[h];
+			table[h] = (uint32_t) ip;
+
+			if(ip - ref > LZ4_MAX_DISTANCE || read32(src + ref) != read32(src + ip)) {
+				// Skip ahead faster through data that doesn't compress
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			while(ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+				ip--;
+				ref--;
+			}
+			size_t length = countMatch(src, ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, matchEndLimit) + LZ4_MIN_MATCH;
+
+			op = writeSequence(op, src + anchor, ip - anchor, ip - ref, length);
+			ip += length;
+			anchor = ip;
+			if(ip - 2 < matchStartLimit) table[hashPosition(src + ip - 2)] = (uint32_t) (ip - 2);
+		}
+	}
+
+	op = writeSequence(op, src + anchor, srcSize - anchor, 0, 0);
+	return (size_t) (op - dst);
+}
+
+// Read the continuation of a length from the input, returns false if it runs past the end
+static inline bool readLength(const unsigned char*& ip, const unsigned char* end, size_t& length)
+{
+	unsigned char b;
+	do {
+		if(ip >= end) return false;
+		b = *ip++;
+		length += b;
+	} while(b == 255);
+	return true;
+}
+
+bool lz4Decompress(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize)
+{
+	const unsigned char* ip = src;
+	const unsigned char* end = src + srcSize;
+	size_t op = 0;
+
+	for(;;) {
+		if(ip >= end) return false;
+		unsigned token = *ip++;
+
+		size_t numLiterals = token >> 4;
+		if(numLiterals == 15 && !readLength(ip, end, numLiterals)) return false;
+		if(numLiterals > (size_t) (end - ip) || numLiterals > dstSize - op) return false;
+		memcpy(dst + op, ip, numLiterals);
+		ip += numLiterals;
+		op += numLiterals;
+
+		if(ip == end) break;
+
+		if(end - ip < 2) return false;
+		size_t offset = ip[0] | ((size_t) ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op) return false;
+
+		size_t length = token & 15;
+		if(length == 15 && !readLength(ip, end, length)) return false;
+		length += LZ4_MIN_MATCH;
+		if(length > dstSize - op) return false;
+
+		unsigned char* out = dst + op;
+		const unsigned char* match = out - offset;
+		if(offset >= length) {
+			memcpy(out, match, length);
+		} else {
+			// Overlapping copy repeats the last offset bytes
+			for(size_t i = 0; i < length; i++) out[i] = match[i];
+		}
+		op += length;
+	}
+
+	return op == dstSize;
+}
@@ -0,0 +1,224 @@
+#include "Mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAP_SSE2
+#endif
+
+// Kaiser filter support in destination pixels and its alpha, the taps cover twice as many source pixels
+#define KAISER_WIDTH 3
+#define KAISER_ALPHA 4.0
+#define KAISER_TAPS (4 * KAISER_WIDTH)
+
+unsigned mipLevelCount(unsigned width, unsigned height)
+{
+	unsigned levels = 1;
+	for(unsigned size = std::max(width, height); size > 1; size >>= 1) levels++;
+	return levels;
+}
+
+size_t mipChainSize(unsigned width, unsigned height, unsigned bpp, unsigned levels)
+{
+	size_t size = 0;
+	for(unsigned i = 0; i < levels; i++) {
+		size += (size_t) std::max(width >> i, 1u) * std::max(height >> i, 1u) * bpp;
+	}
+	return size;
+}
+
+void downsampleBox(const unsigned char* src, unsigned width, unsigned height, unsigned bpp, unsigned char* dst)
+{
+	unsigned dstWidth = std::max(width / 2, 1u);
+	unsigned dstHeight = std::max(height / 2, 1u);
+	size_t pitch = (size_t) width * bpp;
+
+	for(unsigned y = 0; y < dstHeight; y++) {
+		// A dimension of 1 averages the row or column with itself
+		const unsigned char* row0 = src + pitch * std::min(2 * y, height - 1);
+		const unsigned char* row1 = src + pitch * std::min(2 * y + 1, height - 1);
+		unsigned char* out = dst + (size_t) y * dstWidth * bpp;
+		unsigned x = 0;
+#ifdef MIPMAP_SSE2
+		if(bpp == 4) {
+			// Two output pixels from four source pixels of each row
+			__m128i zero = _mm_setzero_si128();
+			__m128i round = _mm_set1_epi16(2);
+			for(; 2 * x + 3 < width && x + 1 < dstWidth; x += 2) {
+				__m128i a = _mm_loadu_si128((const __m128i*) (row0 + 8 * x));
+				__m128i b = _mm_loadu_si128((const __m128i*) (row1 + 8 * x));
+				__m128i left = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				__m128i right = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				left = _mm_add_epi16(left, _mm_srli_si128(left, 8));
+				right = _mm_add_epi16(right, _mm_srli_si128(right, 8));
+				__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(left, right), round), 2);
+				_mm_storel_epi64((__m128i*) (out + 4 * x), _mm_packus_epi16(sum, zero));
+			}
+		}
+#endif
+		for(; x < dstWidth; x++) {
+			unsigned x0 = std::min(2 * x, width - 1) * bpp;
+			unsigned x1 = std::min(2 * x + 1, width - 1) * bpp;
+			for(unsigned c = 0; c < bpp; c++) {
+				out[x * bpp + c] = (unsigned char) ((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+			}
+		}
+	}
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double besselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for(int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if(term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+// Weights of the source pixels 2x - 2 * KAISER_WIDTH + 1 ... 2x + 2 * KAISER_WIDTH for destination pixel x
+struct KaiserWeights {
+	float weights[KAISER_TAPS];
+	KaiserWeights() {
+		double sum = 0.0;
+		double w[KAISER_TAPS];
+		for(int t = 0; t < KAISER_TAPS; t++) {
+			// Distance from the destination pixel center in destination pixels
+			double x = (t - KAISER_TAPS / 2 + 0.5) / 2.0;
+			double sinc = sin(M_PI * x) / (M_PI * x);
+			double r = x / KAISER_WIDTH;
+			double window = besselI0(KAISER_ALPHA * sqrt(std::max(1.0 - r * r, 0.0))) / besselI0(KAISER_ALPHA);
+			w[t] = sinc * window;
+			sum += w[t];
+		}
+		for(int t = 0; t < KAISER_TAPS; t++) weights[t] = (float) (w[t] / sum);
+	}
+};
+
+static const float* kaiserWeights()
+{
+	// Initialized once even with several workers building mip chains
+	static const KaiserWeights kaiser;
+	return kaiser.weights;
+}
+
+static inline int clampIndex(int i, int size)
+{
+	return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+void downsampleKaiser(const unsigned char* src, unsigned width, unsigned height, unsigned bpp, unsigned char* dst)
+{
+	const float* weights = kaiserWeights();
+	unsigned dstWidth = std::max(width / 2, 1u);
+	unsigned dstHeight = std::max(height / 2, 1u);
+	size_t rowFloats = (size_t) dstWidth * bpp;
+
+	// Horizontal pass into floats, edges are clamped
+	std::vector<float> horizontal(rowFloats * height);
+	std::vector<float> row((size_t) width * bpp);
+	for(unsigned y = 0; y < height; y++) {
+		const unsigned char* in = src + (size_t) y * width * bpp;
+		for(size_t i = 0; i < row.size(); i++) row[i] = in[i];
+		float* out = &horizontal[rowFloats * y];
+		for(unsigned x = 0; x < dstWidth; x++) {
+			int first = (int) (2 * x) - KAISER_TAPS / 2 + 1;
+#ifdef MIPMAP_SSE2
+			if(bpp == 4) {
+				__m128 acc = _mm_setzero_ps();
+				for(int t = 0; t < KAISER_TAPS; t++) {
+					__m128 pixel = _mm_loadu_ps(&row[4 * clampIndex(first + t, (int) width)]);
+					acc = _mm_add_ps(acc, _mm_mul_ps(pixel, _mm_set1_ps(weights[t])));
+				}
+				_mm_storeu_ps(out + 4 * x, acc);
+				continue;
+			}
+#endif
+			for(unsigned c = 0; c < bpp; c++) {
+				float sum = 0.f;
+				for(int t = 0; t < KAISER_TAPS; t++) sum += weights[t] * row[clampIndex(first + t, (int) width) * bpp + c];
+				out[x * bpp + c] = sum;
+			}
+		}
+	}
+
+	// Vertical pass over whole rows, rounded and clamped back to bytes
+	std::vector<float> sum(rowFloats);
+	for(unsigned y = 0; y < dstHeight; y++) {
+		int first = (int) (2 * y) - KAISER_TAPS / 2 + 1;
+		std::fill(sum.begin(), sum.end(), 0.f);
+		for(int t = 0; t < KAISER_TAPS; t++) {
+			const float* in = &horizontal[rowFloats * clampIndex(first + t, (int) height)];
+			float weight = weights[t];
+			size_t i = 0;
+#ifdef MIPMAP_SSE2
+			__m128 w = _mm_set1_ps(weight);
+			for(; i + 4 <= rowFloats; i += 4) {
+				_mm_storeu_ps(&sum[i], _mm_add_ps(_mm_loadu_ps(&sum[i]), _mm_mul_ps(_mm_loadu_ps(in + i), w)));
+			}
+#endif
+			for(; i < rowFloats; i++) sum[i] += weight * in[i];
+		}
+
+		unsigned char* out = dst + rowFloats * y;
+		size_t i = 0;
+#ifdef MIPMAP_SSE2
+		for(; i + 4 <= rowFloats; i += 4) {
+			__m128i v = _mm_cvtps_epi32(_mm_loadu_ps(&sum[i]));
+			v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+			int packed = _mm_cvtsi128_si32(v);
+			memcpy(out + i, &packed, 4);
+		}
+#endif
+		for(; i < rowFloats; i++) {
+			float v = sum[i] + 0.5f;
+			out[i] = (unsigned char) (v < 0.f ? 0.f : (v > 255.f ? 255.f : v));
+		}
+	}
+}
+
+static void downsample(const unsigned char* src, unsigned width, unsigned height, unsigned bpp, MipFilter filter,
+		unsigned char* dst)
+{
+	if(filter == MIP_FILTER_KAISER) downsampleKaiser(src, width, height, bpp, dst);
+	else downsampleBox(src, width, height, bpp, dst);
+}
+
+void buildMipChain(const unsigned char* pixels, size_t pitch, MipFilter filter, unsigned maxSize, Texture& texture)
+{
+	unsigned bpp = texture.bpp;
+
+	// Tightly packed copy of the image, halved until it fits the max size
+	std::vector<unsigned char> base((size_t) texture.width * texture.height * bpp);
+	for(unsigned y = 0; y < texture.height; y++) {
+		memcpy(&base[(size_t) y * texture.width * bpp], pixels + pitch * y, (size_t) texture.width * bpp);
+	}
+	while(maxSize > 0 && std::max(texture.width, texture.height) > maxSize) {
+		std::vector<unsigned char> half(mipChainSize(texture.width, texture.height, bpp, 2) - base.size());
+		downsample(&base[0], texture.width, texture.height, bpp, filter, &half[0]);
+		base.swap(half);
+		texture.width = std::max(texture.width / 2, 1u);
+		texture.height = std::max(texture.height / 2, 1u);
+	}
+
+	texture.levels = filter == MIP_FILTER_NONE ? 1 : mipLevelCount(texture.width, texture.height);
+	texture.compression = 0;
+	texture.data = new unsigned char[mipChainSize(texture.width, texture.height, bpp, texture.levels)];
+	memcpy(texture.data, &base[0], base.size());
+
+	// Every level is filtered from the one above it
+	unsigned char* level = texture.data;
+	for(unsigned i = 1; i < texture.levels; i++) {
+		unsigned width = std::max(texture.width >> (i - 1), 1u);
+		unsigned height = std::max(texture.height >> (i - 1), 1u);
+		unsigned char* next = level + (size_t) width * height * bpp;
+		downsample(level, width, height, bpp, filter, next);
+		level = next;
+	}
+}
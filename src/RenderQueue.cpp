@@ -0,0 +1,91 @@
+#include "Common.h"
+#include "RenderQueue.h"
+
+// Bits of each field of a sort key, texture array names and layers wrap around past them
+#define KEY_PASS_SHIFT 60
+#define KEY_PROGRAM_SHIFT 56
+#define KEY_TEXTURE_SHIFT 32
+#define KEY_DEPTH_SHIFT 16
+#define KEY_TEXTURE_MASK 0xFFFFFF
+#define KEY_DEPTH_MASK 0xFFFF
+#define KEY_LAYER_MASK 0xFFFF
+
+uint64_t RenderQueue::makeKey(unsigned pass, unsigned program, GLuint texture, float depth, GLuint layer)
+{
+	uint64_t bucket = (uint64_t) (std::min(std::max(depth, 0.f), 1.f) * KEY_DEPTH_MASK);
+	return ((uint64_t) (pass & 0xF) << KEY_PASS_SHIFT) | ((uint64_t) (program & 0xF) << KEY_PROGRAM_SHIFT)
+			| ((uint64_t) (texture & KEY_TEXTURE_MASK) << KEY_TEXTURE_SHIFT) | (bucket << KEY_DEPTH_SHIFT)
+			| (uint64_t) (layer & KEY_LAYER_MASK);
+}
+
+unsigned RenderQueue::getPass(uint64_t key)
+{
+	return (unsigned) (key >> KEY_PASS_SHIFT) & 0xF;
+}
+
+unsigned RenderQueue::getProgram(uint64_t key)
+{
+	return (unsigned) (key >> KEY_PROGRAM_SHIFT) & 0xF;
+}
+
+uint64_t RenderQueue::getState(uint64_t key)
+{
+	return key >> KEY_TEXTURE_SHIFT;
+}
+
+GLuint RenderQueue::getTexture(uint64_t key)
+{
+	return (GLuint) (key >> KEY_TEXTURE_SHIFT) & KEY_TEXTURE_MASK;
+}
+
+GLuint RenderQueue::getLayer(uint64_t key)
+{
+	return (GLuint) key & KEY_LAYER_MASK;
+}
+
+void RenderQueue::clear()
+{
+	packets.clear();
+}
+
+void RenderQueue::push(uint64_t key, GLuint node)
+{
+	DrawPacket packet;
+	packet.key = key;
+	packet.node = node;
+	packets.push_back(packet);
+}
+
+void RenderQueue::sort()
+{
+	size_t n = packets.size();
+	if(n < 2) return;
+	scratch.resize(n);
+	std::vector<DrawPacket>* from = &packets;
+	std::vector<DrawPacket>* to = &scratch;
+
+	// Least significant byte first, each pass is a stable counting sort
+	for(unsigned shift = 0; shift < 64; shift += 8) {
+		size_t counts[256] = {0};
+		for(size_t i = 0; i < n; i++) counts[((*from)[i].key >> shift) & 0xFF]++;
+		// Every key has the same byte here, the pass wouldn't move anything
+		if(counts[((*from)[0].key >> shift) & 0xFF] == n) continue;
+		size_t offset = 0;
+		for(unsigned b = 0; b < 256; b++) {
+			size_t count = counts[b];
+			counts[b] = offset;
+			offset += count;
+		}
+		for(size_t i = 0; i < n; i++) {
+			const DrawPacket& packet = (*from)[i];
+			(*to)[counts[(packet.key >> shift) & 0xFF]++] = packet;
+		}
+		std::swap(from, to);
+	}
+	if(from != &packets) packets.swap(scratch);
+}
+
+std::vector<DrawPacket>& RenderQueue::getPackets()
+{
+	return packets;
+}
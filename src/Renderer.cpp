@@ -1,6 +1,21 @@
 #include "Common.h"
 #include "Renderer.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+// Binding points of the uniform blocks the shaders share
+#define FRAME_UNIFORM_BINDING 0
+#define PROGRAM_UNIFORM_BINDING 1
+
+// Programs of the render queue's sort keys
+#define RENDER_PROGRAM_DEPTH 0
+#define RENDER_PROGRAM_SHADED 1
+
 void _checkForGLError(const char *file, int line)
 {
 	GLenum err (glGetError());
@@ -255,19 +270,62 @@ std::ostream& operator<<(std::ostream& os, ConfigLoader* dt)
 	return os;
 }
 
+// The cache a scene was loaded from stays mapped while the renderer runs, and Windows can't replace a mapped file.
+// Caches written meanwhile go next to it and are switched to once the mapping is released.
+static std::string pendingCacheFileName(const std::string& cacheFileName)
+{
+	return cacheFileName + ".next";
+}
+
+// Replace the cache with one written while it was mapped, if there is one
+static void switchToPendingCache(const std::string& cacheFileName)
+{
+	std::string pending = pendingCacheFileName(cacheFileName);
+	uint64_t size;
+	int64_t mtime;
+	if(statSourceFile(pending.c_str(), size, mtime)) replaceSceneCacheFile(pending.c_str(), cacheFileName.c_str());
+}
+
 Renderer::Renderer()
 {
-	startPosition = 0;
 	vao = vbo = ibo = 0;
+	numMaterialRuns = 0;
+	sceneCache = 0;
+	scenePager = 0;
+	textureStreamer = 0;
+	textureResidency = 0;
+	rewriteCache = false;
+	vboCapacity = iboCapacity = 0;
+	gpuVertices = 0;
+	gpuIndices = 0;
+	gpuVertexCount = gpuIndexCount = 0;
+	numClusteredNodes = 0;
+	trianglesDrawn = trianglesCulled = 0;
+	bvhNodesVisited = 0;
+	sceneTriangles = 0;
+	memset(&renderStats, 0, sizeof(renderStats));
+	indirectBuffer = drawLayerBuffer = 0;
 	gpuProgram = 0;
 	shadowProgram = 0;
+	frameUniformBuffer = programUniformBuffer = 0;
+	diffuseLayerUniform = -1;
 	depthMapFBO = 0;
 	shadowMap = 0;
 	configLoader = new ConfigLoader("renderer.cfg");
+	threadPool = new ThreadPool((unsigned) std::max(configLoader->getInt("renderer.workerThreads"), 0));
 	shadowsEnabled = configLoader->getBool("shadow.enabled");
 	shadowWidth = configLoader->getInt("shadow.width");
 	shadowHeight = configLoader->getInt("shadow.height");
+	multiDrawIndirect = configLoader->getBool("renderer.multiDrawIndirect");
+	bvhCulling = configLoader->getBool("renderer.bvhCulling");
 	binCacheWriterThread = 0;
+	textureDecodeSeconds = textureWaitSeconds = textureUploadSeconds = 0.0;
+	std::string& filter = configLoader->getVar("renderer.mipmapFilter");
+	mipFilter = filter == "kaiser" ? MIP_FILTER_KAISER : (filter == "box" ? MIP_FILTER_BOX : MIP_FILTER_NONE);
+	maxTextureSize = (unsigned) std::max(configLoader->getInt("renderer.maxTextureSize"), 0);
+	textureCompression = configLoader->getVar("renderer.textureCompression");
+	compressedFormatsQueried = false;
+	textureArraySize = (unsigned) std::max(configLoader->getInt("renderer.textureArraySize"), 0);
 
 	int flags = IMG_INIT_JPG | IMG_INIT_PNG | IMG_INIT_TIF;
 	int initted = IMG_Init(flags);
@@ -286,13 +344,20 @@ Renderer::~Renderer()
 		std::cerr << "Binary cache writer thread failed with status " << cacheWriterThreadStatus << std::endl;
 	}
 
+	// Frees page buffers and waits for page loads reading the cache mapping
+	if(scenePager != NULL) delete scenePager;
+	if(textureResidency != NULL) delete textureResidency;
+	if(textureStreamer != NULL) delete textureStreamer;
+
 	if(sceneNodes.size() > 0)
 	{
 		for(int i=0; i<sceneNodes.size(); i++) {
-			glDeleteTextures(1, &sceneNodes[i].diffuseTextureId);
+			textureRegistry.release(sceneNodes[i].diffuseTextureId);
 		}
 		glDeleteBuffers(1, &vbo);
 		glDeleteBuffers(1, &ibo);
+		if(indirectBuffer) glDeleteBuffers(1, &indirectBuffer);
+		if(drawLayerBuffer) glDeleteBuffers(1, &drawLayerBuffer);
 		glDeleteVertexArrays(1, &vao);
 	}
 
@@ -302,6 +367,18 @@ Renderer::~Renderer()
 	} */
 
 	IMG_Quit();
+	if(sceneCache != NULL) {
+		delete sceneCache;
+		switchToPendingCache(cacheFileName);
+	}
+	delete threadPool;
+	// Decode tasks point at these, free them once the workers are gone. Uploaded images belong to textures.
+	for(std::map<std::string, DecodedTexture*>::iterator it=decodedTextures.begin(); it!=decodedTextures.end(); ++it) {
+		if(it->second->texture.data) delete[] it->second->texture.data;
+		delete it->second;
+	}
+	if(frameUniformBuffer != NULL) delete frameUniformBuffer;
+	if(programUniformBuffer != NULL) delete programUniformBuffer;
 	if(shadowProgram != NULL) delete shadowProgram;
 	if(gpuProgram != NULL) delete gpuProgram;
 	delete configLoader;
@@ -367,72 +444,392 @@ Texture* textureFromSurface(SDL_Surface* image) {
 		 * */
 
 		texture->mode = getTextureMode(image);
+		texture->bpp = image->format->BytesPerPixel;
 		texture->width = image->w;
 		texture->height = image->h;
-		texture->data = (unsigned char*) image->pixels;
+		// Tightly packed copy, surface rows can be padded
+		buildMipChain((const unsigned char*) image->pixels, image->pitch, MIP_FILTER_NONE, 0, *texture);
 
 		return texture;
 }
 
-void Renderer::addTexture(const char* textureFileName, GLuint* textureId, SDL_Surface* image) {
-	Texture* texture = 0;
+// Whether the driver can sample a compression format, the formats are queried once
+bool Renderer::isCompressionSupported(unsigned compression)
+{
+	if(!compressedFormatsQueried) {
+		compressedFormatsQueried = true;
+		GLint numFormats = 0;
+		glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &numFormats);
+		if(numFormats > 0) {
+			std::vector<GLint> formats(numFormats);
+			glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &formats[0]);
+			compressedFormats.insert(formats.begin(), formats.end());
+		}
+		// Core profiles aren't required to list the formats, BPTC is core since 4.2 and S3TC is an extension
+		if(GLAD_GL_VERSION_4_2) compressedFormats.insert(GL_COMPRESSED_RGBA_BPTC_UNORM);
+		GLint numExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+		for(GLint i=0; i<numExtensions; i++) {
+			const char* extension = (const char*) glGetStringi(GL_EXTENSIONS, i);
+			if(extension && strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0) {
+				compressedFormats.insert(GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
+				compressedFormats.insert(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+			}
+		}
+	}
+	bool supported = compressedFormats.count(compressionInternalFormat(compression)) > 0;
+	if(!supported && configLoader->getBool("renderer.verbose")) {
+		std::cout << "Compressed texture format 0x" << std::hex << compressionInternalFormat(compression) << std::dec
+				<< " isn't supported, decompressing" << std::endl;
+	}
+	return supported;
+}
 
-	// If texture not loaded and image is null, try to load the default blank texture
-	if(!image)
-	{
-		//std::cerr << "Unable to load texture: " << textureFileName << std::endl;
+// The default blank texture, used for textures that couldn't be loaded
+Texture* Renderer::loadBlankTexture()
+{
+	std::string bfileNameStr(TEXTURE_DIRECTORY);
+	bfileNameStr += DIRECTORY_SEPARATOR;
+	bfileNameStr += std::string("DEFAULT_BLANK_TEXTURE.png");
+
+	// don't re-load the blank texture if it is already loaded
+	std::map<std::string, Texture>::iterator it = textures.find(bfileNameStr);
+	if(it != textures.end()) return &it->second;
+
+	SDL_Surface* image = IMG_Load(bfileNameStr.c_str());
+	if(!image) {
+		std::cerr << "Error loading default blank texture DEFAULT_BLANK_TEXTURE.png" << std::endl;
+		return 0;
+	}
+	sourceFiles.push_back(bfileNameStr);
+	std::cerr << "DEFAULT_BLANK_TEXTURE.png" << std::endl;
+	Texture* texture = textureFromSurface(image);
+	textures[bfileNameStr] = *texture;
+	delete texture;
+	SDL_FreeSurface(image);
+	return &textures[bfileNameStr];
+}
 
-		std::string bfileNameStr(TEXTURE_DIRECTORY);
-		bfileNameStr += DIRECTORY_SEPARATOR;
-		bfileNameStr += std::string("DEFAULT_BLANK_TEXTURE.png");
+// Pixels of a texture, decoded by the workers or loaded here if they didn't start on it, 0 if neither the file nor
+// the blank texture could be loaded
+Texture* Renderer::loadTexture(const char* textureFileName)
+{
+	std::string textureFileNameStr = std::string(textureFileName);
+	std::map<std::string, Texture>::iterator it = textures.find(textureFileNameStr);
+	if(it != textures.end()) return &it->second;
+
+	// if texture is not found in cache, load from file
+	std::string fileNameStr(TEXTURE_DIRECTORY);
+	fileNameStr += DIRECTORY_SEPARATOR;
+	fileNameStr += textureFileName;
+
+	// Use the image a worker decoded, decode it here if no worker started on it yet
+	DecodedTexture local;
+	DecodedTexture* decoded = &local;
+	double waitSeconds = 0.0;
+	std::map<std::string, DecodedTexture*>::iterator decoding = decodedTextures.find(textureFileNameStr);
+	Uint64 decodeStart = SDL_GetPerformanceCounter();
+	if(decoding != decodedTextures.end()) {
+		decoded = decoding->second;
+		if(SDL_AtomicCAS(&decoded->state, TEXTURE_QUEUED, TEXTURE_DECODING)) {
+			decodeTexture(decoded);
+		} else {
+			while(SDL_AtomicGet(&decoded->state) != TEXTURE_DECODED) SDL_Delay(1);
+			waitSeconds = (double)(SDL_GetPerformanceCounter() - decodeStart) / (double)SDL_GetPerformanceFrequency();
+		}
+	} else {
+		local.path = fileNameStr;
+		local.mipFilter = mipFilter;
+		local.maxTextureSize = maxTextureSize;
+		decodeTexture(&local);
+	}
+	textureDecodeSeconds += (double)(SDL_GetPerformanceCounter() - decodeStart) / (double)SDL_GetPerformanceFrequency() - waitSeconds;
+	textureWaitSeconds += waitSeconds;
+	if(configLoader->getBool("renderer.verbose")) {
+		std::cout << "texture " << textureFileNameStr << ": decoded in " << 1000.0 * decoded->decodeSeconds << " ms, "
+				<< decoded->texture.levels << " mip levels built in " << 1000.0 * decoded->mipSeconds << " ms" << std::endl;
+	}
+
+	// The pixels now belong to textures and go into the cache with their mip chain
+	if(!decoded->texture.data) return loadBlankTexture();
+	sourceFiles.push_back(fileNameStr);
+	textures[textureFileNameStr] = decoded->texture;
+	decoded->texture.data = 0;
+	return &textures[textureFileNameStr];
+}
+
+// Drop the largest mip levels of a texture until it fits the max size, textures without a mip chain are kept
+static Texture resampleTexture(const Texture& texture, unsigned maxSize)
+{
+	Texture resampled = texture;
+	while(maxSize > 0 && resampled.levels > 1 && std::max(resampled.width, resampled.height) > maxSize) {
+		resampled.data += textureLevelSize(resampled, 0);
+		resampled.width = std::max(resampled.width / 2, 1u);
+		resampled.height = std::max(resampled.height / 2, 1u);
+		resampled.levels--;
+	}
+	return resampled;
+}
 
-		if(textures.find(bfileNameStr) == textures.end()) {
-			image = IMG_Load(bfileNameStr.c_str());
-			if(!image) {
-				std::cerr << "Error loading default blank texture DEFAULT_BLANK_TEXTURE.png" << std::endl;
-				return;
+// Upload the diffuse textures of scene nodes as layers of 2D texture arrays. Textures with the same size, mip levels
+// and format after resampling share an array, so nodes using different images are drawn without rebinding.
+void Renderer::packTextureArrays(const std::vector<size_t>& nodes)
+{
+	std::string directory(TEXTURE_DIRECTORY);
+	directory += DIRECTORY_SEPARATOR;
+
+	// Textures that aren't uploaded yet and the files using them, missing files all use the blank texture
+	std::vector<Texture*> pending;
+	std::vector<std::vector<std::string> > pendingFiles;
+	std::map<Texture*, size_t> pendingIndex;
+	std::set<std::string> resolved;
+	for(size_t n=0; n<nodes.size(); n++) {
+		SceneNode& node = sceneNodes[nodes[n]];
+		std::map<std::string, Material>::iterator material = materials.find(node.material);
+		if(material == materials.end()) {
+			std::cerr << "Material " << node.material << " was not loaded" << std::endl;
+			continue;
+		}
+		const char* textureFileName = material->second.diffuseTexName;
+		std::string fileNameStr = directory + textureFileName;
+		if(strlen(textureFileName) == 0 || textureRegistry.contains(fileNameStr) || !resolved.insert(fileNameStr).second) continue;
+
+		Texture* texture = loadTexture(textureFileName);
+		if(!texture) continue;
+		std::map<Texture*, size_t>::iterator index = pendingIndex.find(texture);
+		if(index == pendingIndex.end()) {
+			index = pendingIndex.insert(std::make_pair(texture, pending.size())).first;
+			pending.push_back(texture);
+			pendingFiles.push_back(std::vector<std::string>());
+		}
+		pendingFiles[index->second].push_back(fileNameStr);
+	}
+
+	// Compressed textures the driver can't sample are decompressed first so they can share arrays with raw ones
+	Uint64 uploadStart = SDL_GetPerformanceCounter();
+	std::vector<Texture> layers(pending.size());
+	std::vector<std::vector<unsigned char> > decompressed(pending.size());
+	std::map<std::vector<unsigned>, std::vector<size_t> > groups;
+	for(size_t i=0; i<pending.size(); i++) {
+		layers[i] = resampleTexture(*pending[i], textureArraySize);
+		if(layers[i].compression != TEXTURE_COMPRESSION_NONE && !isCompressionSupported(layers[i].compression)) {
+			decompressTexture(layers[i], decompressed[i]);
+			layers[i].compression = TEXTURE_COMPRESSION_NONE;
+			layers[i].data = &decompressed[i][0];
+		}
+		unsigned format[] = {layers[i].width, layers[i].height, layers[i].levels, layers[i].compression, layers[i].bpp,
+				(unsigned) layers[i].mode};
+		groups[std::vector<unsigned>(format, format + 6)].push_back(i);
+	}
+
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	maxLayers = std::max(maxLayers, 256); // the minimum GL 3.3 guarantees
+	std::vector<GLuint> arrays;
+	for(std::map<std::vector<unsigned>, std::vector<size_t> >::iterator group=groups.begin(); group!=groups.end(); ++group) {
+		for(size_t first=0; first<group->second.size(); first+=maxLayers) {
+			size_t count = std::min(group->second.size() - first, (size_t) maxLayers);
+			const Texture& format = layers[group->second[first]];
+			GLuint textureId;
+			glGenTextures(1, &textureId);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, format.levels - 1);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, format.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			if(textureResidency) {
+				// Levels are streamed in as the nodes using them need them, decompressed pixels are kept for that
+				std::vector<Texture> arrayLayers;
+				std::vector<std::vector<unsigned char> > arrayPixels;
+				for(size_t layer=0; layer<count; layer++) {
+					size_t index = group->second[first + layer];
+					arrayLayers.push_back(layers[index]);
+					if(decompressed[index].empty()) continue;
+					arrayPixels.push_back(std::vector<unsigned char>());
+					arrayPixels.back().swap(decompressed[index]);
+				}
+				textureResidency->addTexture(textureId, arrayLayers, arrayPixels);
 			} else {
-				std::cerr << "DEFAULT_BLANK_TEXTURE.png" << std::endl;//
-				texture = textureFromSurface(image);
-				textures[textureFileName] = *texture;
-				textures[bfileNameStr] = *texture;
+				// Levels are tightly packed, rows of RGB levels aren't 4 byte aligned
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				size_t levelOffset = 0;
+				for(unsigned i=0; i<format.levels; i++) {
+					unsigned width = std::max(format.width >> i, 1u);
+					unsigned height = std::max(format.height >> i, 1u);
+					size_t levelSize = textureLevelSize(format, i);
+					GLenum internalFormat = compressionInternalFormat(format.compression);
+					if(format.compression != TEXTURE_COMPRESSION_NONE) {
+						glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, internalFormat, width, height, (GLsizei) count, 0,
+								(GLsizei) (levelSize * count), NULL);
+					} else {
+						glTexImage3D(GL_TEXTURE_2D_ARRAY, i, format.mode, width, height, (GLsizei) count, 0, format.mode,
+								GL_UNSIGNED_BYTE, NULL);
+					}
+					for(size_t layer=0; layer<count; layer++) {
+						const unsigned char* level = layers[group->second[first + layer]].data + levelOffset;
+						if(format.compression != TEXTURE_COMPRESSION_NONE) {
+							glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, (GLint) layer, width, height, 1, internalFormat,
+									(GLsizei) levelSize, level);
+						} else {
+							glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, (GLint) layer, width, height, 1, format.mode,
+									GL_UNSIGNED_BYTE, level);
+						}
+					}
+					levelOffset += levelSize;
+				}
 			}
-		} else {
-			// don't re-load the blank texture if it is already loaded
-			texture = &textures[bfileNameStr];
+
+			// Every file of a layer refers to the array, the array starts with one reference that is dropped below
+			for(size_t layer=0; layer<count; layer++) {
+				const std::vector<std::string>& files = pendingFiles[group->second[first + layer]];
+				for(size_t f=0; f<files.size(); f++) {
+					textureRegistry.add(files[f], textureId);
+					textureLayers[files[f]] = (GLuint) layer;
+				}
+			}
+			arrays.push_back(textureId);
 		}
-	} else {
-		// image != null
-		texture = textureFromSurface(image);
-		textures[textureFileName] = *texture;
 	}
+	textureUploadSeconds += (double)(SDL_GetPerformanceCounter() - uploadStart) / (double)SDL_GetPerformanceFrequency();
+
+	for(size_t n=0; n<nodes.size(); n++) {
+		SceneNode& node = sceneNodes[nodes[n]];
+		std::map<std::string, Material>::iterator material = materials.find(node.material);
+		if(material == materials.end() || strlen(material->second.diffuseTexName) == 0) continue;
+		std::string fileNameStr = directory + material->second.diffuseTexName;
+		if(textureRegistry.acquire(fileNameStr, &node.diffuseTextureId)) node.diffuseLayer = textureLayers[fileNameStr];
+	}
+	for(size_t i=0; i<arrays.size(); i++) textureRegistry.release(arrays[i]);
 
-	addTexture(textureFileName, textureId, texture);
+	if(configLoader->getBool("renderer.verbose") && !pending.empty()) {
+		std::cout << "packed " << pending.size() << " textures into " << arrays.size() << " texture arrays" << std::endl;
+	}
 }
 
-void Renderer::addTexture(const char* textureFileName, GLuint* textureId, Texture* texture)
+// Worker thread callback, decodes a queued texture image and builds its mip chain
+void Renderer::decodeTexture(DecodedTexture* decoded)
 {
-	glGenTextures(1, textureId);
-	glBindTexture(GL_TEXTURE_2D, *textureId);
-	glTexImage2D(GL_TEXTURE_2D, 0, texture->mode, texture->width, texture->height, 0, texture->mode, GL_UNSIGNED_BYTE, texture->data);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	Uint64 decodeStart = SDL_GetPerformanceCounter();
+	SDL_Surface* image = IMG_Load(decoded->path.c_str());
+	decoded->decodeSeconds = (double)(SDL_GetPerformanceCounter() - decodeStart) / (double)SDL_GetPerformanceFrequency();
+	decoded->mipSeconds = 0.0;
+	decoded->texture.data = 0;
+	decoded->texture.levels = 0;
+	if(image) {
+		Uint64 mipStart = SDL_GetPerformanceCounter();
+		decoded->texture.mode = getTextureMode(image);
+		decoded->texture.bpp = image->format->BytesPerPixel;
+		decoded->texture.width = image->w;
+		decoded->texture.height = image->h;
+		buildMipChain((const unsigned char*) image->pixels, image->pitch, decoded->mipFilter, decoded->maxTextureSize,
+				decoded->texture);
+		SDL_FreeSurface(image);
+		decoded->mipSeconds = (double)(SDL_GetPerformanceCounter() - mipStart) / (double)SDL_GetPerformanceFrequency();
+	}
+	SDL_AtomicSet(&decoded->state, TEXTURE_DECODED);
 }
 
-void Renderer::addTexture(const char* textureFileName, GLuint* textureId)
+// Start decoding the diffuse textures of all materials on the worker threads, bufferToGpu only uploads them
+void Renderer::decodeTextures()
 {
-	std::map<std::string, Texture>::iterator it = textures.find(std::string(textureFileName));
-	if(it == textures.end()) {
-		// if texture is not found in cache, load from file
-		std::string fileNameStr(TEXTURE_DIRECTORY);
-		std::string textureFileNameStr = std::string(textureFileName);
-		fileNameStr += DIRECTORY_SEPARATOR;
-		fileNameStr += textureFileName;
-		SDL_Surface* image = IMG_Load(fileNameStr.c_str());
-		addTexture(textureFileName, textureId, image);
-	} else {
-		addTexture(textureFileName, textureId, &it->second);
+	for(std::map<std::string, Material>::iterator it=materials.begin(); it!=materials.end(); ++it) {
+		std::string name(it->second.diffuseTexName);
+		if(name.empty() || textures.find(name) != textures.end() || decodedTextures.find(name) != decodedTextures.end()) continue;
+
+		DecodedTexture* decoded = new DecodedTexture;
+		decoded->path = std::string(TEXTURE_DIRECTORY) + DIRECTORY_SEPARATOR + name;
+		SDL_AtomicSet(&decoded->state, TEXTURE_QUEUED);
+		decoded->mipFilter = mipFilter;
+		decoded->maxTextureSize = maxTextureSize;
+		decoded->texture.data = 0;
+		decodedTextures[name] = decoded;
+		threadPool->enqueue([decoded]() {
+			// The GL thread may have taken it while it was queued
+			if(SDL_AtomicCAS(&decoded->state, TEXTURE_QUEUED, TEXTURE_DECODING)) decodeTexture(decoded);
+		});
+	}
+}
+
+// Size of a file in bytes, 0 if it can't be opened
+static size_t getFileSize(const char* fileName)
+{
+	std::ifstream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+	if(!file.is_open()) return 0;
+	return (size_t) file.tellg();
+}
+
+// Peak resident set size of the process in bytes, 0 if unavailable
+static size_t getPeakMemoryUsage()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return (size_t) counters.PeakWorkingSetSize;
+	return 0;
+#else
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while(std::getline(status, line)) {
+		if(line.compare(0, 6, "VmHWM:") == 0)
+			return (size_t) strtoull(line.c_str() + 6, NULL, 10) * 1024; // reported in kB
+	}
+	return 0;
+#endif
+}
+
+// Recursively split triangles order[begin, end) at the median centroid along the longest axis until each
+// part has at most maxTriangles, appending the parts to clusters in order
+static void splitTriangles(const std::vector<glm::vec3>& centroids, std::vector<unsigned int>& order,
+		size_t begin, size_t end, size_t maxTriangles, std::vector<std::pair<size_t, size_t> >& clusters)
+{
+	if(end - begin <= maxTriangles)
+	{
+		clusters.push_back(std::make_pair(begin, end - begin));
+		return;
+	}
+
+	glm::vec3 lo = centroids[order[begin]], hi = lo;
+	for(size_t t = begin + 1; t < end; t++)
+	{
+		lo = glm::min(lo, centroids[order[t]]);
+		hi = glm::max(hi, centroids[order[t]]);
 	}
+	glm::vec3 extent = hi - lo;
+	int axis = 0;
+	if(extent[1] > extent[axis]) axis = 1;
+	if(extent[2] > extent[axis]) axis = 2;
+
+	size_t mid = begin + (end - begin) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[&](unsigned int a, unsigned int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+	splitTriangles(centroids, order, begin, mid, maxTriangles, clusters);
+	splitTriangles(centroids, order, mid, end, maxTriangles, clusters);
+}
+
+// Reorder the triangles in triangleIndices so spatially close triangles are contiguous and return
+// the (first triangle, triangle count) range of each cluster
+static std::vector<std::pair<size_t, size_t> > clusterTriangles(const Vertex* vertices, GLuint* triangleIndices,
+		size_t numTriangles, size_t maxTriangles)
+{
+	std::vector<glm::vec3> centroids(numTriangles);
+	std::vector<unsigned int> order(numTriangles);
+	for(size_t t = 0; t < numTriangles; t++)
+	{
+		glm::vec3 c(0.f);
+		for(int k = 0; k < 3; k++) c += glm::make_vec3(vertices[triangleIndices[t * 3 + k]].vertex);
+		centroids[t] = c / 3.f;
+		order[t] = (unsigned int) t;
+	}
+
+	std::vector<std::pair<size_t, size_t> > clusters;
+	splitTriangles(centroids, order, 0, numTriangles, maxTriangles, clusters);
+
+	std::vector<GLuint> original(triangleIndices, triangleIndices + numTriangles * 3);
+	for(size_t t = 0; t < numTriangles; t++)
+	{
+		memcpy(&triangleIndices[t * 3], &original[order[t] * 3], sizeof(GLuint) * 3);
+	}
+	return clusters;
 }
 
 // Used for debugging, TODO: replace with << operator
@@ -443,6 +840,227 @@ void printVertex(Vertex& v)
 			<< '\t' << " t " << v.textureCoordinate[0] << ", " << v.textureCoordinate[1] << std::endl;
 }
 
+// Build the vertex at tinyobj index of a mesh
+static Vertex wavefrontVertex(tinyobj::mesh_t* m, unsigned int index, const char* fileName)
+{
+	Vertex v;
+	memcpy((void*)& v.vertex, (void*)& m->positions[index * 3], sizeof(float) * 3);
+
+	if((index * 3) >= m->normals.size())
+	{
+		// TODO: generate normals
+		std::cerr << "Unable to put normal in " << fileName << std::endl;
+		v.normal[0] = v.normal[1] = v.normal[2] = 0.f;
+	} else {
+		memcpy((void*)& v.normal, (void*)& m->normals[index * 3], sizeof(float) * 3);
+	}
+
+	if((index * 2) >= m->texcoords.size())
+	{
+		v.textureCoordinate[0] = 0.f;
+		v.textureCoordinate[1] = 0.f;
+	} else {
+		v.textureCoordinate[0] = m->texcoords[index * 2];
+		v.textureCoordinate[1] = 1 - m->texcoords[index * 2 + 1]; // Account for wavefront to opengl coordinate system conversion
+	}
+	return v;
+}
+
+// Reads .mtl files like tinyobj::MaterialFileReader and remembers their paths so the cache can track them
+class SourceTrackingMaterialReader : public tinyobj::MaterialFileReader
+{
+public:
+	SourceTrackingMaterialReader(const std::string& basePath, std::vector<std::string>& sourceFiles)
+		: tinyobj::MaterialFileReader(basePath), basePath(basePath), sourceFiles(sourceFiles) {}
+
+	virtual bool operator()(const std::string& matId, std::vector<tinyobj::material_t>& materials,
+			std::map<std::string, int>& matMap, std::string& err)
+	{
+		sourceFiles.push_back(basePath + matId);
+		return tinyobj::MaterialFileReader::operator()(matId, materials, matMap, err);
+	}
+private:
+	std::string basePath;
+	std::vector<std::string>& sourceFiles;
+};
+
+// Split an .obj file into its groups and hash each one together with the material it starts with
+static void hashObjGroups(const char* data, size_t size, std::vector<tinyobj::group_t>& groups,
+		std::vector<uint64_t>& hashes, ThreadPool* threadPool)
+{
+	tinyobj::ScanObjGroups(groups, data, size);
+	hashes.resize(groups.size());
+	threadPool->parallelFor(groups.size(), [&](size_t i) {
+		uint64_t seed = xxHash64(groups[i].material.data(), groups[i].material.size(), 0);
+		hashes[i] = xxHash64(data + groups[i].offset, groups[i].size, seed);
+	});
+}
+
+static void setObjGroup(SceneCacheGroup& group, const tinyobj::group_t& objGroup, uint64_t hash)
+{
+	group.offset = objGroup.offset;
+	group.size = objGroup.size;
+	group.hash = hash;
+	group.vBase = objGroup.v_base;
+	group.vnBase = objGroup.vn_base;
+	group.vtBase = objGroup.vt_base;
+}
+
+// Whether the faces of a shape only reference v, vt and vn records of the group it came from
+static bool isShapeLocal(const tinyobj::shape_t& shape, const std::vector<tinyobj::group_t>& groups)
+{
+	const tinyobj::group_t& group = groups[shape.group];
+	size_t begin[3] = { group.v_base, group.vt_base, group.vn_base };
+	size_t end[3] = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+	if(shape.group + 1 < groups.size()) {
+		const tinyobj::group_t& next = groups[shape.group + 1];
+		end[0] = next.v_base;
+		end[1] = next.vt_base;
+		end[2] = next.vn_base;
+	}
+	for(int c = 0; c < 3; c++) {
+		if(shape.min_index[c] < 0) continue;
+		if((size_t) shape.min_index[c] < begin[c] || (size_t) shape.max_index[c] >= end[c]) return false;
+	}
+	return true;
+}
+
+// Append the geometry of parsed shapes to the scene, material ids index materialNames. If groups is set
+// the scene nodes of each shape are added to the group the shape came from.
+void Renderer::addShapes(std::vector<tinyobj::shape_t>& shapes, const std::vector<std::string>& materialNames,
+		const char* fileName, glm::mat4 matrix, SceneCacheGroup* groups)
+{
+	bool indexed = configLoader->getBool("renderer.indexedGeometry");
+
+	// Reserve the final vertex and index stores up front so growing them doesn't double peak memory
+	size_t numVertices = 0, numIndices = 0;
+	for(size_t i = 0; i < shapes.size(); i++)
+	{
+		numIndices += shapes[i].mesh.indices.size();
+		numVertices += indexed ? std::min(shapes[i].mesh.positions.size() / 3, shapes[i].mesh.indices.size())
+				: shapes[i].mesh.indices.size();
+	}
+	vertexData.reserve(vertexData.size() + numVertices);
+	indices.reserve(indices.size() + numIndices);
+
+	bool mergeRuns = configLoader->getBool("renderer.mergeMaterialRuns");
+	int clusterSize = configLoader->getInt("renderer.clusterTriangles");
+
+	// Maps tinyobj vertex indices to vertices of the current node, -1 if not yet added
+	std::vector<int> vertexRemap;
+	// Order in which a shape's triangles are emitted, grouped by material when merging runs
+	std::vector<unsigned int> triangleOrder;
+	std::vector<size_t> materialOffsets;
+
+	for (size_t i = 0; i < shapes.size(); i++)
+	{
+		size_t firstNode = sceneNodes.size();
+		tinyobj::mesh_t* m = &shapes[i].mesh;
+		size_t numTriangles = m->indices.size() / 3;
+		if(indexed) vertexRemap.assign(m->positions.size() / 3, -1);
+
+		for(size_t t = 0; t < numTriangles; t++) {
+			if(t == 0 || m->material_ids[t] != m->material_ids[t - 1]) numMaterialRuns++;
+		}
+
+		triangleOrder.resize(numTriangles);
+		if(mergeRuns) {
+			// Stable counting sort by material, bucket 0 holds -1 and out of range ids
+			materialOffsets.assign(materialNames.size() + 2, 0);
+			for(size_t t = 0; t < numTriangles; t++) {
+				int id = m->material_ids[t];
+				materialOffsets[(id >= 0 && (size_t) id < materialNames.size() ? id + 1 : 0) + 1]++;
+			}
+			for(size_t b = 1; b < materialOffsets.size(); b++) materialOffsets[b] += materialOffsets[b - 1];
+			for(size_t t = 0; t < numTriangles; t++) {
+				int id = m->material_ids[t];
+				triangleOrder[materialOffsets[id >= 0 && (size_t) id < materialNames.size() ? id + 1 : 0]++] = (unsigned int) t;
+			}
+		} else {
+			for(size_t t = 0; t < numTriangles; t++) triangleOrder[t] = (unsigned int) t;
+		}
+
+		// Start a new scene node whenever the material changes
+		size_t runStart = 0;
+		while(runStart < numTriangles)
+		{
+			int materialId = m->material_ids[triangleOrder[runStart]];
+			size_t runEnd = runStart + 1;
+			while(runEnd < numTriangles && m->material_ids[triangleOrder[runEnd]] == materialId) runEnd++;
+
+			SceneNode sceneNode;
+			sceneNode.startPosition = (GLuint) vertexData.size();
+			sceneNode.indexStart = (GLuint) indices.size();
+
+			// Emit straight into the renderer's vertex and index stores, indices are relative to startPosition
+			for(size_t r = runStart; r < runEnd; r++)
+			{
+				for(size_t c = 0; c < 3; c++)
+				{
+					unsigned int index = m->indices[triangleOrder[r] * 3 + c];
+					if(indexed) {
+						// Weld corners sharing a position/normal/texcoord triple
+						if(vertexRemap[index] < 0) {
+							vertexRemap[index] = (int) (vertexData.size() - sceneNode.startPosition);
+							vertexData.push_back(wavefrontVertex(m, index, fileName));
+						}
+						indices.push_back((GLuint) vertexRemap[index]);
+					} else {
+						indices.push_back((GLuint) (vertexData.size() - sceneNode.startPosition));
+						vertexData.push_back(wavefrontVertex(m, index, fileName));
+					}
+				}
+			}
+
+			if(indexed) {
+				// Vertices are not shared between nodes
+				for(size_t r = runStart; r < runEnd; r++) {
+					for(size_t c = 0; c < 3; c++) vertexRemap[m->indices[triangleOrder[r] * 3 + c]] = -1;
+				}
+			}
+
+			strncpy(&sceneNode.name[0], shapes[i].name.c_str(), MAX_NODE_NAME_STRING_LENGTH);
+			const char* materialName = "";
+			if(materialId >= 0 && (size_t) materialId < materialNames.size()) materialName = materialNames[materialId].c_str();
+			strncpy(&sceneNode.material[0], materialName, MAX_MATERIAL_NAME_STRING_LENGTH);
+
+			sceneNode.endPosition = (GLuint) vertexData.size();
+			sceneNode.indexCount = (GLuint) indices.size() - sceneNode.indexStart;
+			sceneNode.primativeMode = GL_TRIANGLES;
+			sceneNode.diffuseTextureId = 0;
+			sceneNode.diffuseLayer = 0;
+			sceneNode.modelViewMatrix = matrix;
+
+			if(clusterSize > 0 && sceneNode.indexCount / 3 > (GLuint) clusterSize) {
+				// Split large nodes into clusters that can be culled on their own, they share the node's vertices
+				std::vector<std::pair<size_t, size_t> > clusters = clusterTriangles(&vertexData[sceneNode.startPosition],
+						&indices[sceneNode.indexStart], sceneNode.indexCount / 3, (size_t) clusterSize);
+				GLuint indexStart = sceneNode.indexStart;
+				for(size_t c = 0; c < clusters.size(); c++) {
+					sceneNode.indexStart = indexStart + (GLuint) clusters[c].first * 3;
+					sceneNode.indexCount = (GLuint) clusters[c].second * 3;
+					addSceneNode(&sceneNode);
+				}
+				numClusteredNodes += clusters.size() - 1;
+			} else {
+				addSceneNode(&sceneNode);
+			}
+
+			runStart = runEnd;
+		}
+
+		if(groups) {
+			SceneCacheGroup* group = &groups[shapes[i].group];
+			if(group->numNodes == 0) group->firstNode = (uint32_t) firstNode;
+			group->numNodes += (uint32_t) (sceneNodes.size() - firstNode);
+		}
+
+		// Release the tinyobj copy of this shape as soon as it has been emitted
+		shapes[i].mesh = tinyobj::mesh_t();
+	}
+
+}
+
 void Renderer::addWavefront(const char* fileName, glm::mat4 matrix)
 {
 	std::vector<tinyobj::shape_t> shapes;
@@ -452,13 +1070,55 @@ void Renderer::addWavefront(const char* fileName, glm::mat4 matrix)
 	std::string fileNameStr(modelDirectory);
 	fileNameStr += fileName;
 	std::string err;
-	bool noError = (tinyobj::LoadObj(shapes, materials, err, fileNameStr.c_str(), modelDirectory.c_str()), true, true);
+	bool verbose = configLoader->getBool("renderer.verbose");
+	bool useMmap = configLoader->getBool("renderer.mmapObj");
+	int loaderThreads = configLoader->getInt("renderer.objLoaderThreads");
+	const char* loaderName = useMmap ? "mmap" : "stream";
+
+	size_t sourceIndex = sourceFiles.size();
+	sourceFiles.push_back(fileNameStr);
+	SourceTrackingMaterialReader materialReader(modelDirectory, sourceFiles);
+
+	Uint64 loadStart = SDL_GetPerformanceCounter();
+	bool noError = false;
+	// Mapped pages can be read as a whole, so the loaders are told the file data is padded
+	tinyobj::MappedFile objFile;
+	if(loaderThreads != 1 || useMmap) {
+		if(!objFile.open(fileNameStr.c_str())) {
+			err = "Cannot open file [" + fileNameStr + "]";
+		} else if(loaderThreads != 1) {
+			// 0 uses one thread per core
+			loaderName = "parallel";
+			noError = tinyobj::LoadObjFromMemoryParallel(shapes, materials, err, objFile.data, objFile.size, materialReader,
+					(unsigned) std::max(loaderThreads, 0), true, true, true);
+		} else {
+			noError = tinyobj::LoadObjFromMemory(shapes, materials, err, objFile.data, objFile.size, materialReader, true, true,
+					true);
+		}
+	} else {
+		std::ifstream objStream(fileNameStr.c_str());
+		if(!objStream) {
+			err = "Cannot open file [" + fileNameStr + "]";
+		} else {
+			noError = tinyobj::LoadObj(shapes, materials, err, objStream, materialReader, true, true);
+		}
+	}
+	double loadSeconds = (double)(SDL_GetPerformanceCounter() - loadStart) / (double)SDL_GetPerformanceFrequency();
+
 	if(!noError)
 	{
 		std::cerr << err << std::endl;
 		return;
 	}
 
+	if(verbose) {
+		if(!err.empty()) std::cerr << err << std::endl;
+		double megabytes = (double)getFileSize(fileNameStr.c_str()) / (1024.0 * 1024.0);
+		std::cout << "parsed " << fileName << " (" << megabytes << " MB) with the "
+				<< loaderName << " loader in " << loadSeconds << " s, "
+				<< (loadSeconds > 0.0 ? megabytes / loadSeconds : 0.0) << " MB/s" << std::endl;
+	}
+
 	for(size_t i=0; i<materials.size(); i++)
 	{
 		Material m;
@@ -480,167 +1140,244 @@ void Renderer::addWavefront(const char* fileName, glm::mat4 matrix)
 
 		addMaterial(&m);
 	}
+	decodeTextures();
 
-	for (size_t i = 0; i < shapes.size(); i++)
-	{
-		std::vector<Vertex> mVertexData;
+	// Hash every g and o group so a later change to some of them can be imported on its own
+	std::vector<tinyobj::group_t> groups;
+	std::vector<uint64_t> groupHashes;
+	if(objFile.data || objFile.open(fileNameStr.c_str())) {
+		hashObjGroups(objFile.data, objFile.size, groups, groupHashes, threadPool);
+	}
+	objFile.close();
+	for(size_t i=0; i<shapes.size(); i++) {
+		// The stream loader splits lines longer than its buffer, so its groups may not match the scan
+		if(shapes[i].group >= groups.size()) groups.clear();
+	}
 
-		unsigned int materialId, lastMaterialId = 0;
-		if(shapes[i].mesh.material_ids.size() > 0)
-		{
-			materialId = lastMaterialId = shapes[i].mesh.material_ids[0];
-		}
+	size_t firstGroup = sourceGroups.size();
+	for(size_t i=0; i<groups.size(); i++) {
+		SceneCacheGroup group;
+		memset(&group, 0, sizeof(SceneCacheGroup));
+		group.source = (uint32_t) sourceIndex;
+		group.flags = SCENE_CACHE_GROUP_LOCAL;
+		setObjGroup(group, groups[i], groupHashes[i]);
+		memcpy(group.modelViewMatrix, glm::value_ptr(matrix), sizeof(float) * 16);
+		sourceGroups.push_back(group);
+	}
+	for(size_t i=0; i<shapes.size() && !groups.empty(); i++) {
+		if(!isShapeLocal(shapes[i], groups)) sourceGroups[firstGroup + shapes[i].group].flags &= ~SCENE_CACHE_GROUP_LOCAL;
+	}
 
-		for(int j=0; j <shapes[i].mesh.indices.size(); j++)
-		{
-			if((j%3) == 0)
-			{
-				lastMaterialId = materialId;
-				materialId = shapes[i].mesh.material_ids[j/3];
+	std::vector<std::string> materialNames;
+	for(size_t i=0; i<materials.size(); i++) materialNames.push_back(materials[i].name);
+	size_t firstNode = sceneNodes.size();
+	addShapes(shapes, materialNames, fileName, matrix, groups.empty() ? 0 : &sourceGroups[firstGroup]);
 
-				if(materialId != lastMaterialId)
-				{
-					//new node
-					SceneNode sceneNode;
-					strncpy(&sceneNode.name[0], shapes[i].name.c_str(), MAX_NODE_NAME_STRING_LENGTH);
-					strncpy(&sceneNode.material[0], materials[lastMaterialId].name.c_str(), MAX_NODE_NAME_STRING_LENGTH);
-
-					sceneNode.vertexDataSize = mVertexData.size();
-					sceneNode.vertexData = new Vertex[sceneNode.vertexDataSize];
-					memcpy((void*) sceneNode.vertexData, (void*) mVertexData.data(), sizeof(Vertex) * sceneNode.vertexDataSize);
-					sceneNode.startPosition = startPosition;
-					startPosition += (GLuint) sceneNode.vertexDataSize;
-					sceneNode.endPosition = sceneNode.startPosition + (GLuint) sceneNode.vertexDataSize;
-					sceneNode.primativeMode = GL_TRIANGLES;
-					sceneNode.diffuseTextureId = 0;
-					sceneNode.modelViewMatrix = matrix;
-					addSceneNode(&sceneNode);
-					mVertexData.clear();
-				}
-			}
-
-			Vertex v;
-			memcpy((void*)& v.vertex, (void*)& shapes[i].mesh.positions[ shapes[i].mesh.indices[j] * 3 ], sizeof(float) * 3);
+	// Groups without faces sit between the nodes of their neighbours
+	for(size_t i=firstGroup; i<sourceGroups.size(); i++) {
+		if(sourceGroups[i].numNodes == 0) sourceGroups[i].firstNode = (uint32_t) firstNode;
+		else firstNode = sourceGroups[i].firstNode + sourceGroups[i].numNodes;
+	}
+	if(!groups.empty()) stampModel(sourceIndex);
 
-			if((shapes[i].mesh.indices[j] * 3) >= shapes[i].mesh.normals.size())
-			{
-				// TODO: generate normals
-				std::cerr << "Unable to put normal in " << fileName << std::endl;
-				//return;
-			} else {
-				memcpy((void*)& v.normal, (void*)& shapes[i].mesh.normals[ (shapes[i].mesh.indices[j] * 3) ], sizeof(float) * 3);
-			}
+	if(verbose) {
+		std::cout << "imported " << fileName << ", peak memory " << (double)getPeakMemoryUsage() / (1024.0 * 1024.0)
+				<< " MB" << std::endl;
+	}
+}
 
-			tinyobj::mesh_t* m = &shapes[i].mesh;
+// Pages are cut once they hold this much geometry
+#define SCENE_PAGE_BYTES (4 * 1024 * 1024)
 
-			if((shapes[i].mesh.indices[j] * 2) >= shapes[i].mesh.texcoords.size())
-			{
-				//std::cerr << "Unable to put texcoord in " << shapes[i].name << std::endl;
-				v.textureCoordinate[0] = 0.f;
-				v.textureCoordinate[1] = 0.f;
-			} else {
-				v.textureCoordinate[0] = m->texcoords[(int)m->indices[j]*2];
-				v.textureCoordinate[1] = 1 - m->texcoords[(int)m->indices[j]*2+1]; // Account for wavefront to opengl coordinate system conversion
-			}
+// Group consecutive scene nodes whose vertices and indices are contiguous into pages of roughly SCENE_PAGE_BYTES
+static void buildScenePages(std::vector<SceneNode>& sceneNodes, std::vector<SceneCachePage>& pages)
+{
+	size_t first = 0;
+	while(first < sceneNodes.size()) {
+		SceneCachePage page;
+		memset(&page, 0, sizeof(SceneCachePage));
+		page.firstNode = (uint32_t) first;
+		page.vertexStart = sceneNodes[first].startPosition;
+		page.indexStart = sceneNodes[first].indexStart;
+		GLuint vertexEnd = sceneNodes[first].endPosition;
+		GLuint indexEnd = sceneNodes[first].indexStart + sceneNodes[first].indexCount;
+
+		size_t last = first + 1;
+		for(; last < sceneNodes.size(); last++) {
+			SceneNode& sn = sceneNodes[last];
+			size_t bytes = sizeof(Vertex) * (vertexEnd - page.vertexStart) + sizeof(GLuint) * (indexEnd - page.indexStart);
+			bool contiguous = sn.indexStart == indexEnd && sn.startPosition >= page.vertexStart && sn.startPosition <= vertexEnd;
+			if(!contiguous || bytes >= SCENE_PAGE_BYTES) break;
+			indexEnd += sn.indexCount;
+			vertexEnd = std::max(vertexEnd, sn.endPosition);
+		}
+		page.numNodes = (uint32_t) (last - first);
+		page.vertexCount = vertexEnd - page.vertexStart;
+		page.indexCount = indexEnd - page.indexStart;
 
-			mVertexData.push_back(v);
-			if(j == shapes[i].mesh.indices.size() - 1)
-			{
-				SceneNode sceneNode;
-				strncpy(&sceneNode.name[0], shapes[i].name.c_str(), MAX_NODE_NAME_STRING_LENGTH);
-				strncpy(&sceneNode.material[0], materials[lastMaterialId].name.c_str(), MAX_MATERIAL_NAME_STRING_LENGTH);
-
-				sceneNode.vertexDataSize = mVertexData.size();
-				sceneNode.vertexData = new Vertex[sceneNode.vertexDataSize];
-				memcpy((void*) sceneNode.vertexData, (void*) mVertexData.data(), sizeof(Vertex) * sceneNode.vertexDataSize);
-				sceneNode.startPosition = startPosition;
-				sceneNode.endPosition = sceneNode.startPosition + (GLuint) sceneNode.vertexDataSize;
-				startPosition += (GLuint) sceneNode.vertexDataSize;
-				sceneNode.primativeMode = GL_TRIANGLES;
-				sceneNode.diffuseTextureId = 0;
-				sceneNode.modelViewMatrix = matrix;
-				addSceneNode(&sceneNode);
-			}
+		glm::vec3 center(0.f);
+		for(size_t i = first; i < last; i++) {
+			center += glm::vec3(sceneNodes[i].lx, sceneNodes[i].ly, sceneNodes[i].lz);
+		}
+		center /= (float) page.numNodes;
+		for(size_t i = first; i < last; i++) {
+			glm::vec3 nodeCenter(sceneNodes[i].lx, sceneNodes[i].ly, sceneNodes[i].lz);
+			page.radius = std::max(page.radius, glm::length(nodeCenter - center) + sceneNodes[i].boundingSphere);
 		}
+		memcpy(page.center, glm::value_ptr(center), sizeof(page.center));
+
+		pages.push_back(page);
+		first = last;
 	}
 }
 
-/*	Binary cache file format:
- * 	[------numMaterials------]
- * 	[------numSceneNodes-----]
- * 	[------numTextures-------]
- * 	[------------------------]
- * 	[------material array----]
- * 	[----scene node array----]
- * 	[----vertex data array---]
- * 	[---texture data array---]
- */
-typedef struct BinCacheFileHeader {
-	size_t numMaterials;
-	size_t numSceneNodes;
-	size_t numVertices;
-	size_t numTextures;
-} BinCacheFileHeader;
-
-
-// Thread callback to store geometry in a binary file
+// Thread callback to store the scene in a binary cache file
 static int CreateBinCache(void *rendererPtr)
 {
 	Renderer* renderer = (Renderer*)rendererPtr;
-	const char* filename = renderer->cacheFileName.c_str();
-	std::ofstream binFile (filename, std::ios::binary | std::ios::trunc);
-	if(!binFile.is_open()) {
-		std::cerr << "Unable to open " << filename << " for writing" << std::endl;
-		return -1;
-	}
+	std::string pendingFileName = pendingCacheFileName(renderer->cacheFileName);
+	const char* filename = renderer->sceneCache ? pendingFileName.c_str() : renderer->cacheFileName.c_str();
+	SceneCacheWriter writer;
 
-	BinCacheFileHeader header;
-	header.numMaterials = renderer->materials.size();
-	header.numSceneNodes = renderer->sceneNodes.size();
-	header.numVertices = renderer->vertexData.size();
-	header.numTextures = renderer->textures.size();
-	binFile.write((char*)&header, sizeof(BinCacheFileHeader));
-
-	// Write material array
+	std::vector<Material> materials;
 	std::map<std::string, Material>::iterator it;
 	for(it=renderer->materials.begin(); it!=renderer->materials.end(); ++it) {
-		Material* m = &it->second;
-		binFile.write((char*)m, sizeof(Material));
+		materials.push_back(it->second);
 	}
-
-	// Write scene node array
-	std::vector<SceneNode>::iterator it2;
-	for(it2=renderer->sceneNodes.begin(); it2!=renderer->sceneNodes.end(); ++it2) {
-		SceneNode* sn = &*it2;
-		binFile.write((char*)sn, sizeof(SceneNode));
+	writer.addSection(SCENE_CACHE_MATERIALS, sizeof(Material), materials.size());
+	writer.addSectionData(materials.empty() ? 0 : &materials[0], sizeof(Material) * materials.size());
+
+	std::vector<SceneCacheNode> nodes(renderer->sceneNodes.size());
+	for(size_t i=0; i<renderer->sceneNodes.size(); i++) {
+		SceneNode* sn = &renderer->sceneNodes[i];
+		SceneCacheNode* cn = &nodes[i];
+		memset(cn, 0, sizeof(SceneCacheNode));
+		memcpy(cn->name, sn->name, MAX_NODE_NAME_STRING_LENGTH);
+		memcpy(cn->material, sn->material, MAX_MATERIAL_NAME_STRING_LENGTH);
+		memcpy(cn->modelViewMatrix, glm::value_ptr(sn->modelViewMatrix), sizeof(float) * 16);
+		cn->startPosition = sn->startPosition;
+		cn->endPosition = sn->endPosition;
+		cn->indexStart = sn->indexStart;
+		cn->indexCount = sn->indexCount;
+		cn->primativeMode = sn->primativeMode;
+		cn->boundingSphere = sn->boundingSphere;
+		cn->lx = sn->lx;
+		cn->ly = sn->ly;
+		cn->lz = sn->lz;
 	}
-
-	// Write vertex array
-	Vertex* v = 0;
-	for(size_t i=0; i<renderer->vertexData.size(); i++) {
-		v = &renderer->vertexData[i];
-		binFile.write((char*)v, sizeof(Vertex));
+	writer.addSection(SCENE_CACHE_NODES, sizeof(SceneCacheNode), nodes.size());
+	writer.addSectionData(nodes.empty() ? 0 : &nodes[0], sizeof(SceneCacheNode) * nodes.size());
+
+	writer.addSection(SCENE_CACHE_VERTICES, sizeof(Vertex), renderer->vertexData.size());
+	writer.addSectionData(renderer->vertexData.empty() ? 0 : &renderer->vertexData[0], sizeof(Vertex) * renderer->vertexData.size());
+
+	writer.addSection(SCENE_CACHE_INDICES, sizeof(GLuint), renderer->indices.size());
+	writer.addSectionData(renderer->indices.empty() ? 0 : &renderer->indices[0], sizeof(GLuint) * renderer->indices.size());
+
+	std::vector<SceneCachePage> pages;
+	buildScenePages(renderer->sceneNodes, pages);
+	writer.addSection(SCENE_CACHE_PAGES, sizeof(SceneCachePage), pages.size());
+	writer.addSectionData(pages.empty() ? 0 : &pages[0], sizeof(SceneCachePage) * pages.size());
+
+	const std::vector<SceneCacheBvhNode>& bvhNodes = renderer->nodeHierarchy.getNodes();
+	const std::vector<uint32_t>& bvhSpheres = renderer->nodeHierarchy.getSpheres();
+	writer.addSection(SCENE_CACHE_BVH_NODES, sizeof(SceneCacheBvhNode), bvhNodes.size());
+	writer.addSectionData(bvhNodes.empty() ? 0 : &bvhNodes[0], sizeof(SceneCacheBvhNode) * bvhNodes.size());
+	writer.addSection(SCENE_CACHE_BVH_SPHERES, sizeof(uint32_t), bvhSpheres.size());
+	writer.addSectionData(bvhSpheres.empty() ? 0 : &bvhSpheres[0], sizeof(uint32_t) * bvhSpheres.size());
+
+	// Texture pixels go in one data section, referenced by offset from the texture table.
+	// Raw textures are block compressed on the worker threads, the buffers are kept until the cache is written.
+	bool verbose = renderer->configLoader->getBool("renderer.verbose");
+	std::vector<SceneCacheTexture> textures;
+	std::vector<std::vector<unsigned char> > compressedData(renderer->textures.size());
+	size_t compressedPixels = 0, rawBytes = 0, compressedBytes = 0;
+	double compressSeconds = 0.0;
+	writer.addSection(SCENE_CACHE_TEXTURE_DATA, 1, 0);
+	std::map<std::string, Texture>::iterator it2;
+	for(it2=renderer->textures.begin(); it2!=renderer->textures.end(); ++it2) {
+		Texture texture = it2->second;
+		unsigned compression = TEXTURE_COMPRESSION_NONE;
+		if(texture.compression == TEXTURE_COMPRESSION_NONE && (texture.bpp == 3 || texture.bpp == 4)) {
+			if(renderer->textureCompression == "bc7") compression = TEXTURE_COMPRESSION_BC7;
+			else if(renderer->textureCompression == "bc1") compression = texture.bpp == 4 ? TEXTURE_COMPRESSION_BC3 : TEXTURE_COMPRESSION_BC1;
+		}
+		if(compression != TEXTURE_COMPRESSION_NONE) {
+			std::vector<unsigned char>& data = compressedData[textures.size()];
+			Uint64 compressStart = SDL_GetPerformanceCounter();
+			compressTexture(it2->second, compression, renderer->threadPool, texture, data);
+			double seconds = (double)(SDL_GetPerformanceCounter() - compressStart) / (double)SDL_GetPerformanceFrequency();
+			size_t pixels = textureDataSize(it2->second) / it2->second.bpp;
+			compressSeconds += seconds;
+			compressedPixels += pixels;
+			rawBytes += textureDataSize(it2->second);
+			compressedBytes += data.size();
+			if(verbose) {
+				// Quality of the base level, the smaller levels are filtered from it
+				std::vector<unsigned char> decoded(textureLevelSize(it2->second, 0));
+				decompressLevel(texture, 0, &decoded[0]);
+				std::cout << "Compressed " << it2->first << " to " << data.size() / 1024 << " KB in " << 1000.0 * seconds
+						<< " ms, " << pixels / seconds / 1000000.0 << " MP/s, PSNR "
+						<< computePsnr(it2->second.data, &decoded[0], decoded.size()) << " dB" << std::endl;
+			}
+		}
+		SceneCacheTexture ct;
+		memset(&ct, 0, sizeof(SceneCacheTexture));
+		strncpy(ct.name, it2->first.c_str(), MAX_MATERIAL_NAME_STRING_LENGTH - 1);
+		ct.width = texture.width;
+		ct.height = texture.height;
+		ct.bpp = texture.bpp;
+		ct.mode = texture.mode;
+		ct.levels = texture.levels;
+		ct.compression = texture.compression;
+		ct.dataSize = (uint64_t) textureDataSize(texture);
+		ct.dataOffset = writer.addSectionData(texture.data, (size_t) ct.dataSize);
+		textures.push_back(ct);
 	}
-
-	// Write textures to array at end of file
-	std::map<std::string, Texture>::iterator it3;
-	char name[MAX_MATERIAL_NAME_STRING_LENGTH];
-	for(it3=renderer->textures.begin(); it3!=renderer->textures.end(); ++it3) {
-		Texture* texture = &it3->second;
-		strncpy(&name[0], it3->first.c_str(), MAX_MATERIAL_NAME_STRING_LENGTH);
-		binFile.write(&name[0], sizeof(char) * MAX_MATERIAL_NAME_STRING_LENGTH);
-		binFile.write((char*) &texture->bpp, sizeof(unsigned));
-		binFile.write((char*) &texture->mode, sizeof(int));
-		binFile.write((char*) &texture->width, sizeof(unsigned));
-		binFile.write((char*) &texture->height, sizeof(unsigned));
-		size_t dataSize = (size_t) texture->width * texture->height * texture->bpp;
-		binFile.write((char*) &texture->data, dataSize);
+	if(verbose && compressedPixels > 0) {
+		std::cout << "Compressed textures from " << rawBytes / 1024 << " KB to " << compressedBytes / 1024 << " KB in "
+				<< 1000.0 * compressSeconds << " ms, " << compressedPixels / compressSeconds / 1000000.0 << " MP/s" << std::endl;
+	}
+	writer.addSection(SCENE_CACHE_TEXTURES, sizeof(SceneCacheTexture), textures.size());
+	writer.addSectionData(textures.empty() ? 0 : &textures[0], sizeof(SceneCacheTexture) * textures.size());
+
+	// Record every file the scene was built from so stale caches can be detected
+	Uint64 hashStart = SDL_GetPerformanceCounter();
+	std::vector<SceneCacheSource> sources;
+	uint64_t sourceBytes = 0;
+	for(size_t i=0; i<renderer->sourceFiles.size(); i++) {
+		SceneCacheSource source;
+		if(!describeSourceFile(renderer->sourceFiles[i].c_str(), source, renderer->threadPool)) {
+			std::cerr << "Unable to hash " << renderer->sourceFiles[i] << ", not saving cache" << std::endl;
+			return -1;
+		}
+		sourceBytes += source.size;
+		sources.push_back(source);
 	}
+	writer.addSection(SCENE_CACHE_SOURCES, sizeof(SceneCacheSource), sources.size());
+	writer.addSectionData(sources.empty() ? 0 : &sources[0], sizeof(SceneCacheSource) * sources.size());
 
-	binFile.close();
+	writer.addSection(SCENE_CACHE_GROUPS, sizeof(SceneCacheGroup), renderer->sourceGroups.size());
+	writer.addSectionData(renderer->sourceGroups.empty() ? 0 : &renderer->sourceGroups[0],
+			sizeof(SceneCacheGroup) * renderer->sourceGroups.size());
+	double hashSeconds = (double)(SDL_GetPerformanceCounter() - hashStart) / (double)SDL_GetPerformanceFrequency();
 
-	if(renderer->configLoader->getBool("renderer.verbose"))
-		std::cout << "saved cache to " << filename << std::endl;
+	Uint64 writeStart = SDL_GetPerformanceCounter();
+	if(!writer.write(filename, renderer->threadPool, renderer->configLoader->getBool("renderer.compressCache"))) {
+		std::cerr << "Unable to write cache " << filename << std::endl;
+		return -1;
+	}
+	// An older cache waiting to be switched to would replace this one
+	if(!renderer->sceneCache) remove(pendingFileName.c_str());
+	double writeSeconds = (double)(SDL_GetPerformanceCounter() - writeStart) / (double)SDL_GetPerformanceFrequency();
+
+	if(renderer->configLoader->getBool("renderer.verbose")) {
+		std::cout << "hashed " << sources.size() << " source files (" << sourceBytes / (1024.0 * 1024.0) << " MB) in "
+				<< hashSeconds << " s" << std::endl;
+		std::cout << "saved cache to " << filename << " in " << writeSeconds << " s, "
+				<< writer.getRawSize() / (1024.0 * 1024.0) << " MB stored as " << writer.getFileSize() / (1024.0 * 1024.0)
+				<< " MB" << std::endl;
+	}
 
 	return 0;
 }
@@ -655,53 +1392,55 @@ bool Renderer::checkScene() {
 
 	if(configLoader->getBool("renderer.verbose")) {
 		std::cout << "num scene nodes: " << sceneNodes.size() << std::endl;
-		std::cout << "num vertices: " << vertexData.size() << std::endl;
-		std::cout << "num indices: " << indices.size() << std::endl;
+		if(numClusteredNodes > 0) {
+			std::cout << "split large scene nodes into " << numClusteredNodes << " additional clusters" << std::endl;
+		}
+		if(numMaterialRuns > sceneNodes.size() - numClusteredNodes) {
+			// Every scene node is one draw call per pass
+			size_t mergedNodes = sceneNodes.size() - numClusteredNodes;
+			std::cout << "merged " << numMaterialRuns << " material runs into " << mergedNodes << " scene nodes, "
+					<< 100.0 * (1.0 - (double)mergedNodes / (double)numMaterialRuns) << "% fewer draw calls" << std::endl;
+		}
+		std::cout << "num vertices: " << gpuVertexCount << std::endl;
+		std::cout << "num indices: " << gpuIndexCount << std::endl;
+		std::cout << "vertex buffer: " << (sizeof(Vertex) * gpuVertexCount) / (1024.0 * 1024.0) << " MB, index buffer: "
+				<< (sizeof(GLuint) * gpuIndexCount) / (1024.0 * 1024.0) << " MB" << std::endl;
 	}
 	return true;
 }
 
-bool Renderer::buildScene(Camera& camera)
+// Fit bounding spheres to scene nodes [first, last) from vertexData and indices
+void Renderer::computeBoundingSpheres(size_t first, size_t last)
 {
-	// populate vertexData and indices from sceneNodes
-	for(int i=0; i<sceneNodes.size(); i++)
-	{
-		for(int j=0; j<sceneNodes[i].vertexDataSize; j++)
-		{
-			Vertex v;
-			memcpy((void*) &v, (void*) &sceneNodes[i].vertexData[j], sizeof(Vertex));
-			vertexData.push_back(v);
-			indices.push_back((unsigned int) indices.size());
-		}
-	}
-
-	//Calculate Bounding Sphere radius
-	for(int i=0; i<sceneNodes.size(); i++)
+	for(size_t i=first; i<last; i++)
 	{
 		// local origin/center of object (center of bounding sphere)
 		float lx = 0.f, ly = 0.f, lz = 0.f;
 		float r = 0.f;
 
-		int vertexDataSize = (int) sceneNodes[i].vertexDataSize;
+		// Clusters share their vertex range, so only visit the vertices the node's indices reference
+		Vertex* nodeVertexData = &vertexData[sceneNodes[i].startPosition];
+		GLuint* nodeIndices = &indices[sceneNodes[i].indexStart];
+		int indexCount = (int) sceneNodes[i].indexCount;
 		//Calculate local origin
-		for(int j=0; j<vertexDataSize; j++)
+		for(int j=0; j<indexCount; j++)
 		{
-			lx += sceneNodes[i].vertexData[j].vertex[0];
-			ly += sceneNodes[i].vertexData[j].vertex[1];
-			lz += sceneNodes[i].vertexData[j].vertex[2];
+			lx += nodeVertexData[nodeIndices[j]].vertex[0];
+			ly += nodeVertexData[nodeIndices[j]].vertex[1];
+			lz += nodeVertexData[nodeIndices[j]].vertex[2];
 		}
-		lx /= (double)vertexDataSize;
-		ly /= (double)vertexDataSize;
-		lz /= (double)vertexDataSize;
+		lx /= (double)indexCount;
+		ly /= (double)indexCount;
+		lz /= (double)indexCount;
 		sceneNodes[i].lx = lx;
 		sceneNodes[i].ly = ly;
 		sceneNodes[i].lz = lz;
 
-		for(int j=0; j<sceneNodes[i].vertexDataSize; j++)
+		for(int j=0; j<indexCount; j++)
 		{
-			float x = sceneNodes[i].vertexData[j].vertex[0];
-			float y = sceneNodes[i].vertexData[j].vertex[1];
-			float z = sceneNodes[i].vertexData[j].vertex[2];
+			float x = nodeVertexData[nodeIndices[j]].vertex[0];
+			float y = nodeVertexData[nodeIndices[j]].vertex[1];
+			float z = nodeVertexData[nodeIndices[j]].vertex[2];
 
 			double nx = x - lx;
 			double ny = y - ly;
@@ -723,104 +1462,489 @@ bool Renderer::buildScene(Camera& camera)
 		}
 		sceneNodes[i].boundingSphere = r;
 	}
+}
 
-	// Free vertex data in sceneNodes
-	for(size_t i = 0; i<sceneNodes.size(); i++) {
-		delete[] sceneNodes[i].vertexData;
-	}
+bool Renderer::buildScene(Camera& camera)
+{
+	//Calculate Bounding Sphere radius
+	computeBoundingSpheres(0, sceneNodes.size());
+	updateNodeBounds();
+	buildNodeHierarchy();
+
+	gpuVertices = vertexData.empty() ? 0 : &vertexData[0];
+	gpuVertexCount = vertexData.size();
+	gpuIndices = indices.empty() ? 0 : &indices[0];
+	gpuIndexCount = indices.size();
 
 	return checkScene();
 }
 
-// Load a scene from a binary file cache
+// Load a scene from a binary file cache, geometry and textures stay in the file mapping until the renderer is destroyed
 bool Renderer::buildScene(Camera& camera, const char* filename)
 {
-
-	if(configLoader->getBool("renderer.verbose"))
+	bool verbose = configLoader->getBool("renderer.verbose");
+	if(verbose)
 		std::cout << "loading cached geometry" << std::endl;
 
-	std::ifstream binFile(filename, std::ios::in | std::ios::binary);
-	if(!binFile.is_open()) {
-		if(configLoader->getBool("renderer.verbose"))
-			std::cout << "Unable to open " << filename << " for reading" << std::endl;
+	Uint64 loadStart = SDL_GetPerformanceCounter();
+	// A cache written by a run that didn't get to switch to it
+	switchToPendingCache(filename);
+	sceneCache = new SceneCache();
+	if(!sceneCache->open(filename, threadPool)) {
+		if(verbose)
+			std::cout << "Unable to open " << filename << " as a version " << SCENE_CACHE_VERSION << " cache" << std::endl;
 
+		delete sceneCache;
+		sceneCache = 0;
 		return false;
 	}
 
-	Material m;
-	SceneNode sn;
-	Vertex v;
-	BinCacheFileHeader header;
-	// Load header
-	binFile.read((char*)&header, sizeof(BinCacheFileHeader));
+	size_t numSources, numGroups, numMaterials, numNodes, numTextures, textureDataSize;
+	const SceneCacheSource* sources = (const SceneCacheSource*) sceneCache->getSectionData(SCENE_CACHE_SOURCES, sizeof(SceneCacheSource), numSources);
+	const SceneCacheGroup* cachedGroups = (const SceneCacheGroup*) sceneCache->getSectionData(SCENE_CACHE_GROUPS, sizeof(SceneCacheGroup), numGroups);
+	const Material* cachedMaterials = (const Material*) sceneCache->getSectionData(SCENE_CACHE_MATERIALS, sizeof(Material), numMaterials);
+	const SceneCacheNode* cachedNodes = (const SceneCacheNode*) sceneCache->getSectionData(SCENE_CACHE_NODES, sizeof(SceneCacheNode), numNodes);
+	const SceneCacheTexture* cachedTextures = (const SceneCacheTexture*) sceneCache->getSectionData(SCENE_CACHE_TEXTURES, sizeof(SceneCacheTexture), numTextures);
+	const unsigned char* textureData = (const unsigned char*) sceneCache->getSectionData(SCENE_CACHE_TEXTURE_DATA, 1, textureDataSize);
+	gpuVertices = (const Vertex*) sceneCache->getSectionData(SCENE_CACHE_VERTICES, sizeof(Vertex), gpuVertexCount);
+	gpuIndices = (const GLuint*) sceneCache->getSectionData(SCENE_CACHE_INDICES, sizeof(GLuint), gpuIndexCount);
+	const SceneCacheSection* textureDataSection = sceneCache->getSection(SCENE_CACHE_TEXTURE_DATA);
+	if(!sources || !cachedGroups || !cachedMaterials || !cachedNodes || !cachedTextures || !textureData || !gpuVertices || !gpuIndices) {
+		std::cerr << "Cache " << filename << " is missing sections or was written by an incompatible build" << std::endl;
+		delete sceneCache;
+		sceneCache = 0;
+		return false;
+	}
+
+	// Find the files the cache was built from that changed since
+	std::vector<size_t> staleSources;
+	for(size_t i=0; i<numSources; i++) {
+		if(!isSourceFileCurrent(sources[i], threadPool)) {
+			if(verbose) std::cout << "cache " << filename << " is stale, " << sources[i].path << " changed" << std::endl;
+			staleSources.push_back(i);
+		}
+		char path[MAX_SOURCE_PATH_LENGTH];
+		memcpy(path, sources[i].path, MAX_SOURCE_PATH_LENGTH);
+		path[MAX_SOURCE_PATH_LENGTH - 1] = '\0';
+		sourceFiles.push_back(path);
+	}
+	sourceGroups.assign(cachedGroups, cachedGroups + numGroups);
+	for(size_t i=0; i<numGroups; i++) {
+		if(cachedGroups[i].source >= numSources || (size_t) cachedGroups[i].firstNode + cachedGroups[i].numNodes > numNodes) {
+			std::cerr << "Cache " << filename << " has a corrupt group table, ignoring it" << std::endl;
+			sourceGroups.clear();
+			break;
+		}
+	}
 
 	// Load materials
-	for(size_t i=0; i<header.numMaterials; i++) {
-		binFile.read((char*)&m, sizeof(Material));
-		materials[m.name] = m;
+	for(size_t i=0; i<numMaterials; i++) {
+		materials[cachedMaterials[i].name] = cachedMaterials[i];
 	}
 
-	// Load scene nodes
-	for(size_t i=0; i<header.numSceneNodes; i++) {
-		binFile.read((char*)&sn, sizeof(SceneNode));
-		sn.diffuseTextureId = 0;
-		addSceneNode(&sn);
+	// A stale cache can still be used if only groups of .obj files changed, those are imported again
+	std::vector<ChangedObjGroup> changedGroups;
+	if(!staleSources.empty() && (!configLoader->getBool("renderer.incrementalImport")
+			|| !importChangedGroups(staleSources, changedGroups))) {
+		materials.clear();
+		sourceFiles.clear();
+		sourceGroups.clear();
+		delete sceneCache;
+		sceneCache = 0;
+		return false;
 	}
 
-	// Load vertex data
-	for(size_t i=0; i<header.numVertices; i++) {
-		binFile.read((char*)&v, sizeof(Vertex));
-		vertexData.push_back(v);
-		indices.push_back((unsigned int) indices.size());
+	// Load scene nodes
+	for(size_t i=0; i<numNodes; i++) {
+		const SceneCacheNode* cn = &cachedNodes[i];
+		SceneNode sn = SceneNode();
+		memcpy(sn.name, cn->name, MAX_NODE_NAME_STRING_LENGTH);
+		memcpy(sn.material, cn->material, MAX_MATERIAL_NAME_STRING_LENGTH);
+		sn.modelViewMatrix = glm::make_mat4(cn->modelViewMatrix);
+		sn.startPosition = cn->startPosition;
+		sn.endPosition = cn->endPosition;
+		sn.indexStart = cn->indexStart;
+		sn.indexCount = cn->indexCount;
+		sn.primativeMode = cn->primativeMode;
+		sn.boundingSphere = cn->boundingSphere;
+		sn.lx = cn->lx;
+		sn.ly = cn->ly;
+		sn.lz = cn->lz;
+		addSceneNode(&sn);
 	}
 
-	size_t numTexturesLoaded = 0;
-	// Load textures from the end of the file
-	char textureFileName[MAX_MATERIAL_NAME_STRING_LENGTH];
-	while(numTexturesLoaded < header.numTextures) {
-		textureFileName[0] = '\0';
+	// Textures point straight at their pixels and mip levels in the mapping
+	for(size_t i=0; i<numTextures; i++) {
+		const SceneCacheTexture* ct = &cachedTextures[i];
+		if(ct->dataSize == 0 || ct->dataOffset + ct->dataSize > textureDataSection->size || ct->levels == 0
+				|| ct->levels > mipLevelCount(ct->width, ct->height) || ct->compression > TEXTURE_COMPRESSION_BC7) {
+			std::cerr << "Unable to load image size of " << ct->dataSize << ": " << ct->name << std::endl;
+			exit(9);
+		}
 		Texture texture;
-		binFile.read((char*) &textureFileName[0], MAX_MATERIAL_NAME_STRING_LENGTH);
-		binFile.read((char*) &texture.bpp, sizeof(unsigned));
-		binFile.read((char*) &texture.mode, sizeof(int));
-		binFile.read((char*) &texture.width, sizeof(unsigned));
-		binFile.read((char*) &texture.height, sizeof(unsigned));
-		size_t imageSize = texture.width * texture.height * texture.bpp;
-		if(imageSize == 0) {
-			std::cerr << "Unable to load image size of 0: " << textureFileName << std::endl;
+		texture.width = ct->width;
+		texture.height = ct->height;
+		texture.bpp = ct->bpp;
+		texture.mode = ct->mode;
+		texture.levels = ct->levels;
+		texture.compression = ct->compression;
+		if(ct->dataSize != ::textureDataSize(texture)) {
+			std::cerr << "Unable to load image size of " << ct->dataSize << ": " << ct->name << std::endl;
 			exit(9);
 		}
-		texture.data = new unsigned char[imageSize];
-		binFile.read((char*)texture.data, imageSize);
-		textures[std::string(&textureFileName[0])] = texture;
-		numTexturesLoaded++;
+		texture.data = (unsigned char*) textureData + ct->dataOffset;
+		textures[std::string(ct->name)] = texture;
+	}
+	// Textures missing from the cache are loaded from their files
+	decodeTextures();
+
+	// Patch the changed groups into the cached geometry, the cache is rewritten once the scene is on the GPU
+	if(!staleSources.empty()) {
+		spliceChangedGroups(changedGroups);
+		rewriteCache = true;
+	}
+	for(size_t i=0; i<sourceGroups.size(); i++) {
+		size_t source = sourceGroups[i].source;
+		if(source < numSources && modelStamps.find(source) == modelStamps.end()) {
+			modelStamps[source] = std::make_pair(sources[source].size, sources[source].mtime);
+		}
+	}
+	for(size_t i=0; i<staleSources.size(); i++) stampModel(staleSources[i]);
+
+	// The cached hierarchy is only valid for the nodes it was built over
+	updateNodeBounds();
+	size_t numBvhNodes, numBvhSpheres;
+	const SceneCacheBvhNode* bvhNodes = (const SceneCacheBvhNode*) sceneCache->getSectionData(SCENE_CACHE_BVH_NODES, sizeof(SceneCacheBvhNode), numBvhNodes);
+	const uint32_t* bvhSpheres = (const uint32_t*) sceneCache->getSectionData(SCENE_CACHE_BVH_SPHERES, sizeof(uint32_t), numBvhSpheres);
+	if(rewriteCache || !bvhNodes || !bvhSpheres || !nodeHierarchy.load(bvhNodes, numBvhNodes, bvhSpheres, numBvhSpheres, sceneNodes.size())) {
+		buildNodeHierarchy();
 	}
 
-	binFile.close();
-	if(configLoader->getBool("renderer.verbose")) std::cout << "loaded cached scene" << std::endl;
+	if(verbose) {
+		double loadSeconds = (double)(SDL_GetPerformanceCounter() - loadStart) / (double)SDL_GetPerformanceFrequency();
+		double megabytes = (double)sceneCache->getFileSize() / (1024.0 * 1024.0);
+		std::cout << "loaded cached scene (" << megabytes << " MB) in " << loadSeconds << " s" << std::endl;
+	}
 
 	return checkScene();
 }
 
+// Remember the size and mtime of an .obj source so reloadChangedModels can tell when it changes
+void Renderer::stampModel(size_t source)
+{
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	statSourceFile(sourceFiles[source].c_str(), size, mtime);
+	modelStamps[source] = std::make_pair(size, mtime);
+}
+
+// Import the groups of changed .obj sources whose bytes changed on their own. Returns false if a source has
+// no group table or the change can't be imported group by group, then the whole scene has to be imported.
+bool Renderer::importChangedGroups(const std::vector<size_t>& changedSources, std::vector<ChangedObjGroup>& changed)
+{
+	bool verbose = configLoader->getBool("renderer.verbose");
+	Uint64 importStart = SDL_GetPerformanceCounter();
+
+	// Material ids as addShapes will resolve them
+	std::map<std::string, int> materialIds;
+	for(std::map<std::string, Material>::iterator it=materials.begin(); it!=materials.end(); ++it) {
+		int id = (int) materialIds.size();
+		materialIds[it->first] = id;
+	}
+
+	size_t numGroups = 0;
+	for(size_t s=0; s<changedSources.size(); s++) {
+		const char* path = sourceFiles[changedSources[s]].c_str();
+		std::vector<size_t> oldGroups;
+		for(size_t i=0; i<sourceGroups.size(); i++) {
+			if(sourceGroups[i].source == changedSources[s]) oldGroups.push_back(i);
+		}
+		tinyobj::MappedFile objFile;
+		if(oldGroups.empty() || !objFile.open(path)) {
+			if(verbose) std::cout << path << " can't be imported group by group" << std::endl;
+			return false;
+		}
+
+		std::vector<tinyobj::group_t> groups;
+		std::vector<uint64_t> hashes;
+		hashObjGroups(objFile.data, objFile.size, groups, hashes, threadPool);
+		if(groups.size() != oldGroups.size()) {
+			if(verbose) std::cout << "groups were added to or removed from " << path << std::endl;
+			return false;
+		}
+		numGroups += groups.size();
+
+		// A group is unchanged if its bytes and the vertex records before it are
+		size_t firstChanged = changed.size();
+		bool keepsSharedGroups = false;
+		for(size_t j=0; j<groups.size(); j++) {
+			const SceneCacheGroup& old = sourceGroups[oldGroups[j]];
+			if(hashes[j] == old.hash && groups[j].v_base == old.vBase && groups[j].vn_base == old.vnBase
+					&& groups[j].vt_base == old.vtBase) {
+				if(!(old.flags & SCENE_CACHE_GROUP_LOCAL)) keepsSharedGroups = true;
+				continue;
+			}
+			changed.push_back(ChangedObjGroup());
+			ChangedObjGroup& group = changed.back();
+			group.group = oldGroups[j];
+			group.objGroup = j;
+			group.updated = old;
+			group.updated.flags = SCENE_CACHE_GROUP_LOCAL;
+			setObjGroup(group.updated, groups[j], hashes[j]);
+		}
+		size_t numChanged = changed.size() - firstChanged;
+		if(numChanged > 0 && keepsSharedGroups) {
+			// Kept groups might reference vertices of the changed ones
+			if(verbose) std::cout << path << " has groups sharing vertices" << std::endl;
+			return false;
+		}
+
+		// Parse the changed groups in parallel, a group that now references other groups needs a full import
+		std::vector<std::string> errors(numChanged);
+		std::vector<char> loaded(numChanged);
+		threadPool->parallelFor(numChanged, [&](size_t k) {
+			ChangedObjGroup& group = changed[firstChanged + k];
+			loaded[k] = tinyobj::LoadObjGroupFromMemory(group.shapes, errors[k], objFile.data, groups[group.objGroup],
+					(unsigned) group.objGroup, materialIds, true, true, true);
+		});
+		for(size_t k=0; k<numChanged; k++) {
+			if(!loaded[k]) {
+				if(verbose) std::cout << "group " << changed[firstChanged + k].objGroup << " of " << path << ": " << errors[k];
+				return false;
+			}
+		}
+	}
+
+	if(verbose) {
+		double importSeconds = (double)(SDL_GetPerformanceCounter() - importStart) / (double)SDL_GetPerformanceFrequency();
+		std::cout << "imported " << changed.size() << " changed of " << numGroups << " groups in " << importSeconds << " s" << std::endl;
+	}
+	return true;
+}
+
+// Append scene nodes [first, last) of nodes and the geometry they use to the scene
+void Renderer::appendNodes(const std::vector<SceneNode>& nodes, size_t first, size_t last, const Vertex* fromVertices,
+		const GLuint* fromIndices)
+{
+	if(first >= last) return;
+
+	// Nodes are stored in the order of their vertex and index ranges
+	GLuint vertexStart = nodes[first].startPosition, vertexEnd = nodes[first].endPosition;
+	for(size_t i=first; i<last; i++) vertexEnd = std::max(vertexEnd, nodes[i].endPosition);
+	GLuint indexStart = nodes[first].indexStart;
+	GLuint indexEnd = nodes[last - 1].indexStart + nodes[last - 1].indexCount;
+
+	GLuint vertexOffset = (GLuint) vertexData.size() - vertexStart;
+	GLuint indexOffset = (GLuint) indices.size() - indexStart;
+	vertexData.insert(vertexData.end(), fromVertices + vertexStart, fromVertices + vertexEnd);
+	indices.insert(indices.end(), fromIndices + indexStart, fromIndices + indexEnd);
+	for(size_t i=first; i<last; i++) {
+		SceneNode sn = nodes[i];
+		sn.startPosition += vertexOffset;
+		sn.endPosition += vertexOffset;
+		sn.indexStart += indexOffset;
+		addSceneNode(&sn);
+	}
+}
+
+// Rebuild the scene with the changed groups' new shapes in place of their old nodes
+void Renderer::spliceChangedGroups(std::vector<ChangedObjGroup>& changed)
+{
+	std::sort(changed.begin(), changed.end(), [](const ChangedObjGroup& a, const ChangedObjGroup& b) {
+		return a.group < b.group;
+	});
+
+	std::vector<std::string> materialNames;
+	for(std::map<std::string, Material>::iterator it=materials.begin(); it!=materials.end(); ++it) {
+		materialNames.push_back(it->first);
+	}
+
+	// The old geometry is either in these or in the cache mapping, gpuVertices and gpuIndices point at it
+	std::vector<SceneNode> oldNodes;
+	std::vector<Vertex> oldVertexData;
+	std::vector<GLuint> oldIndices;
+	oldNodes.swap(sceneNodes);
+	oldVertexData.swap(vertexData);
+	oldIndices.swap(indices);
+	sceneNodes.reserve(oldNodes.size());
+	vertexData.reserve(gpuVertexCount);
+	indices.reserve(gpuIndexCount);
+
+	// Groups are stored in the order of their nodes, copy the nodes between changed groups as they are
+	size_t nextNode = 0, c = 0;
+	for(size_t i=0; i<sourceGroups.size(); i++) {
+		SceneCacheGroup& group = sourceGroups[i];
+		if(c == changed.size() || changed[c].group != i) {
+			group.firstNode = (uint32_t) (sceneNodes.size() + group.firstNode - nextNode);
+			continue;
+		}
+		ChangedObjGroup& update = changed[c++];
+		appendNodes(oldNodes, nextNode, group.firstNode, gpuVertices, gpuIndices);
+
+		size_t oldVertexCount = 0, oldIndexCount = 0;
+		if(group.numNodes > 0) {
+			const SceneNode& firstNode = oldNodes[group.firstNode];
+			const SceneNode& lastNode = oldNodes[group.firstNode + group.numNodes - 1];
+			GLuint vertexEnd = firstNode.endPosition;
+			for(size_t n=group.firstNode; n<group.firstNode + group.numNodes; n++) vertexEnd = std::max(vertexEnd, oldNodes[n].endPosition);
+			oldVertexCount = vertexEnd - firstNode.startPosition;
+			oldIndexCount = lastNode.indexStart + lastNode.indexCount - firstNode.indexStart;
+		}
+
+		size_t firstNode = sceneNodes.size();
+		update.vertexStart = vertexData.size();
+		update.indexStart = indices.size();
+		addShapes(update.shapes, materialNames, sourceFiles[group.source].c_str(), glm::make_mat4(group.modelViewMatrix), 0);
+		computeBoundingSpheres(firstNode, sceneNodes.size());
+		update.vertexEnd = vertexData.size();
+		update.indexEnd = indices.size();
+		update.resized = update.vertexEnd - update.vertexStart != oldVertexCount || update.indexEnd - update.indexStart != oldIndexCount;
+
+		nextNode = group.firstNode + group.numNodes;
+		group = update.updated;
+		group.firstNode = (uint32_t) firstNode;
+		group.numNodes = (uint32_t) (sceneNodes.size() - firstNode);
+	}
+	appendNodes(oldNodes, nextNode, oldNodes.size(), gpuVertices, gpuIndices);
+
+	gpuVertices = vertexData.empty() ? 0 : &vertexData[0];
+	gpuVertexCount = vertexData.size();
+	gpuIndices = indices.empty() ? 0 : &indices[0];
+	gpuIndexCount = indices.size();
+}
+
+// Upload the geometry spliceChangedGroups changed. If no group changed size only their ranges are uploaded,
+// otherwise everything from the first changed group on moved.
+void Renderer::uploadChangedGroups(const std::vector<ChangedObjGroup>& changed)
+{
+	bool resized = false;
+	for(size_t i=0; i<changed.size(); i++) resized |= changed[i].resized;
+
+	// Upload through the copy target so the vertex array object's index buffer binding is left alone
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+	if(gpuVertexCount > vboCapacity) {
+		// Leave room to grow so the next edits can be uploaded in place
+		vboCapacity = gpuVertexCount + gpuVertexCount / 8;
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(Vertex) * vboCapacity, 0, GL_STATIC_DRAW);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(Vertex) * gpuVertexCount, gpuVertices);
+	} else if(resized) {
+		size_t first = changed[0].vertexStart;
+		glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(Vertex) * first, sizeof(Vertex) * (gpuVertexCount - first), gpuVertices + first);
+	} else {
+		for(size_t i=0; i<changed.size(); i++) {
+			glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(Vertex) * changed[i].vertexStart,
+					sizeof(Vertex) * (changed[i].vertexEnd - changed[i].vertexStart), gpuVertices + changed[i].vertexStart);
+		}
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ibo);
+	if(gpuIndexCount > iboCapacity) {
+		iboCapacity = gpuIndexCount + gpuIndexCount / 8;
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * iboCapacity, 0, GL_STATIC_DRAW);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint) * gpuIndexCount, gpuIndices);
+	} else if(resized) {
+		size_t first = changed[0].indexStart;
+		glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * first, sizeof(GLuint) * (gpuIndexCount - first), gpuIndices + first);
+	} else {
+		for(size_t i=0; i<changed.size(); i++) {
+			glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * changed[i].indexStart,
+					sizeof(GLuint) * (changed[i].indexEnd - changed[i].indexStart), gpuIndices + changed[i].indexStart);
+		}
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Check the .obj sources for changes and bring the scene up to date by importing only the changed groups
+void Renderer::reloadChangedModels()
+{
+	std::vector<size_t> changedSources;
+	std::map<size_t, std::pair<uint64_t, int64_t> >::iterator it;
+	for(it=modelStamps.begin(); it!=modelStamps.end(); ++it) {
+		uint64_t size;
+		int64_t mtime;
+		if(statSourceFile(sourceFiles[it->first].c_str(), size, mtime) && (size != it->second.first || mtime != it->second.second)) {
+			changedSources.push_back(it->first);
+		}
+	}
+	if(changedSources.empty()) return;
+	for(size_t i=0; i<changedSources.size(); i++) stampModel(changedSources[i]);
+
+	if(scenePager) {
+		std::cerr << "Reloading models is not supported for paged scenes" << std::endl;
+		return;
+	}
+
+	// The cache writer reads the scene
+	int cacheWriterThreadStatus = 0;
+	SDL_WaitThread(binCacheWriterThread, &cacheWriterThreadStatus);
+	binCacheWriterThread = 0;
+
+	Uint64 reloadStart = SDL_GetPerformanceCounter();
+	std::vector<ChangedObjGroup> changed;
+	if(!importChangedGroups(changedSources, changed)) {
+		std::cerr << sourceFiles[changedSources[0]] << " changed in a way that needs a full import, restart to see the change" << std::endl;
+		return;
+	}
+	if(changed.empty()) return;
+
+	// Texture objects still used by other nodes are kept
+	for(size_t i=0; i<changed.size(); i++) {
+		const SceneCacheGroup& group = sourceGroups[changed[i].group];
+		for(size_t n=group.firstNode; n<group.firstNode + group.numNodes; n++) {
+			GLuint textureId = sceneNodes[n].diffuseTextureId;
+			if(textureRegistry.release(textureId) && textureStreamer) {
+				textureStreamer->cancel(textureId);
+				textureResidency->removeTexture(textureId);
+			}
+		}
+	}
+
+	// Textures that aren't in an array yet get new arrays
+	spliceChangedGroups(changed);
+	std::vector<size_t> changedNodes;
+	for(size_t i=0; i<changed.size(); i++) {
+		const SceneCacheGroup& group = sourceGroups[changed[i].group];
+		for(size_t n=group.firstNode; n<group.firstNode + group.numNodes; n++) changedNodes.push_back(n);
+	}
+	packTextureArrays(changedNodes);
+	uploadChangedGroups(changed);
+	updateNodeBounds();
+	buildNodeHierarchy();
+
+	if(configLoader->getBool("renderer.verbose")) {
+		double reloadSeconds = (double)(SDL_GetPerformanceCounter() - reloadStart) / (double)SDL_GetPerformanceFrequency();
+		std::cout << "reloaded " << changed.size() << " changed groups in " << reloadSeconds << " s" << std::endl;
+	}
+
+	if(configLoader->getBool("renderer.createBinObj")) {
+		binCacheWriterThread = SDL_CreateThread(CreateBinCache, "BinCacheWriterThread", (void *)this);
+	}
+}
+
 void Renderer::bufferToGpu(Camera& camera, bool loadCachedScene)
 {
 	if(configLoader->getBool("renderer.verbose")) std::cout << "Buffering to GPU" << std::endl;
-	// Load textures
+	// Upload textures, decoding started on the worker threads when the materials were loaded
 	checkForGLError();
-	for(int i=0; i <sceneNodes.size(); i++)
-	{
-		if(materials.find(sceneNodes[i].material) == materials.end()  )
-		{
-			std::cerr << "Material " << sceneNodes[i].material << " was not loaded" << std::endl;
-		}
-		else
-		{
-			if(strlen(materials[sceneNodes[i].material].diffuseTexName) > 0)
-				addTexture(materials[sceneNodes[i].material].diffuseTexName, &sceneNodes[i].diffuseTextureId);
-		}
+	Uint64 texturesStart = SDL_GetPerformanceCounter();
+	textureDecodeSeconds = textureWaitSeconds = textureUploadSeconds = 0.0;
+	if(configLoader->getBool("renderer.streamTextures") && !textureStreamer) {
+		textureStreamer = new TextureStreamer(1024 * std::max(configLoader->getInt("renderer.textureUploadKBPerFrame"), 1),
+				configLoader->getFloat("renderer.textureUploadMsPerFrame") / 1000.0);
+		textureResidency = new TextureResidency(textureStreamer,
+				1024 * 1024 * (size_t) std::max(configLoader->getInt("renderer.textureVramBudgetMB"), 0));
 	}
+	std::vector<size_t> allNodes(sceneNodes.size());
+	for(size_t i=0; i<sceneNodes.size(); i++) allNodes[i] = i;
+	packTextureArrays(allNodes);
 
-	if(configLoader->getBool("renderer.verbose")) std::cout << "buffered textures" << std::endl;
+	if(configLoader->getBool("renderer.verbose")) {
+		double texturesSeconds = (double)(SDL_GetPerformanceCounter() - texturesStart) / (double)SDL_GetPerformanceFrequency();
+		std::cout << "buffered textures in " << texturesSeconds << " s: " << textureUploadSeconds << " s uploading, "
+				<< textureWaitSeconds << " s waiting for workers, " << textureDecodeSeconds << " s decoding on the GL thread" << std::endl;
+		std::cout << textureRegistry.getNumTextures() << " texture arrays shared by " << textureRegistry.getNumReferences()
+				<< " scene nodes" << std::endl;
+	}
 
 	checkForGLError();
 
@@ -831,10 +1955,33 @@ void Renderer::bufferToGpu(Camera& camera, bool loadCachedScene)
 	glBindVertexArray(vao);
 	checkForGLError();
 
+	// A paged scene keeps its geometry in the cache mapping and uploads it as the camera moves
+	if(loadCachedScene && !rewriteCache && configLoader->getBool("renderer.pagedScene")) {
+		size_t numPages;
+		const SceneCachePage* pages = (const SceneCachePage*) sceneCache->getSectionData(SCENE_CACHE_PAGES, sizeof(SceneCachePage), numPages);
+		for(size_t i=0; pages && i<numPages; i++) {
+			if((size_t) pages[i].firstNode + pages[i].numNodes > sceneNodes.size()
+					|| (size_t) pages[i].vertexStart + pages[i].vertexCount > gpuVertexCount
+					|| (size_t) pages[i].indexStart + pages[i].indexCount > gpuIndexCount) {
+				std::cerr << "Cache page " << i << " is out of range, uploading the whole scene" << std::endl;
+				pages = 0;
+			}
+		}
+		if(pages && numPages > 0) {
+			size_t megabyte = 1024 * 1024;
+			scenePager = new ScenePager(pages, numPages, gpuVertices, gpuIndices, sceneNodes.size(), threadPool,
+					megabyte * std::max(configLoader->getInt("renderer.pageRamBudgetMB"), 0),
+					megabyte * std::max(configLoader->getInt("renderer.pageVramBudgetMB"), 0),
+					megabyte * std::max(configLoader->getInt("renderer.pageUploadMBPerFrame"), 1));
+			if(configLoader->getBool("renderer.verbose")) std::cout << "paging scene geometry in " << numPages << " pages" << std::endl;
+		}
+	}
+
 	//Triangle Vertices
 	glGenBuffers(1, &vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertexData.size(), &vertexData[0], GL_STATIC_DRAW);
+	if(!scenePager) glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * gpuVertexCount, gpuVertices, GL_STATIC_DRAW);
+	vboCapacity = gpuVertexCount;
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(Vertex),(void*)0);                       //send positions on pipe 0
 	glEnableVertexAttribArray(1);
@@ -842,8 +1989,8 @@ void Renderer::bufferToGpu(Camera& camera, bool loadCachedScene)
 	glEnableVertexAttribArray(2);
 	glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,sizeof(Vertex),(void*)(sizeof(float)*6));     //send texcoords on pipe 2
 
-	// Spawn thread to save scene to binary cache
-	if(!loadCachedScene && configLoader->getBool("renderer.createBinObj")) {
+	// Spawn thread to save scene to binary cache, or to replace a cache that was patched while loading
+	if((!loadCachedScene || rewriteCache) && configLoader->getBool("renderer.createBinObj")) {
 		binCacheWriterThread = SDL_CreateThread(CreateBinCache, "BinCacheWriterThread", (void *)this);
 	}
 
@@ -851,7 +1998,8 @@ void Renderer::bufferToGpu(Camera& camera, bool loadCachedScene)
 
 	glGenBuffers(1, &ibo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+	if(!scenePager) glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * gpuIndexCount, gpuIndices, GL_STATIC_DRAW);
+	iboCapacity = gpuIndexCount;
 	checkForGLError();
 
 	if(configLoader->getBool("renderer.verbose")) std::cout << "buffered geometry" << std::endl;
@@ -924,49 +2072,53 @@ void Renderer::bufferToGpu(Camera& camera, bool loadCachedScene)
 			glm::vec3(0.0, 1.0, 0.0));
 	lightSpaceMatrix = lightProjection * lightView;
 
-	// Set shadow program uniforms: uniform mat4 lightSpaceMatrix; uniform mat4 model;
-	shadowProgram->uniformLoader->addUniform("lightSpaceMatrix",
-			new UniformMat4(lightSpaceMatrix));
-
-	shadowProgram->uniformLoader->addUniform("model", new UniformMat4(model));
-
-	// Set rendering shader uniforms: uniform mat4 projection; uniform mat4 view; uniform mat4 model; uniform mat4 lightSpaceMatrix;
-
-	gpuProgram->uniformLoader->addUniform("projection",	new UniformMat4(camera.projectionMatrix));
-	gpuProgram->uniformLoader->addUniform("view", new UniformMat4(camera.modelViewMatrix));
-	gpuProgram->uniformLoader->addUniform("model", new UniformMat4(model));
-
-	gpuProgram->uniformLoader->addUniform("lightSpaceMatrix",
-			new UniformMat4(lightSpaceMatrix));
-
-	gpuProgram->uniformLoader->addUniform("lightPos",
-			new UniformVec3(lightPos));
-
-	gpuProgram->uniformLoader->addUniform("viewPos",
-			new UniformVec3(camera.position));
-
-	//uniform sampler2D diffuseTexture; 	uniform sampler2D shadowMap;
-
-	gpuProgram->uniformLoader->addUniform("diffuseTexture", new UniformInt(0));
+	// Both programs read the matrices, light and shadow switch from uniform blocks
+	frameUniforms.projection = camera.projectionMatrix;
+	frameUniforms.view = camera.modelViewMatrix;
+	frameUniforms.lightSpaceMatrix = lightSpaceMatrix;
+	frameUniforms.lightPos = glm::vec4(lightPos, 1.f);
+	frameUniforms.viewPos = glm::vec4(camera.position, 1.f);
+	programUniforms.model = model;
+	programUniforms.shadows = shadowsEnabled ? 1 : 0;
+	programUniforms.padding[0] = programUniforms.padding[1] = programUniforms.padding[2] = 0;
+	frameUniformBuffer = new UniformBuffer(FRAME_UNIFORM_BINDING, sizeof(FrameUniforms));
+	programUniformBuffer = new UniformBuffer(PROGRAM_UNIFORM_BINDING, sizeof(ProgramUniforms));
+	frameUniformBuffer->set(&frameUniforms);
+	programUniformBuffer->set(&programUniforms);
+	shadowProgram->bindUniformBlock("FrameData", FRAME_UNIFORM_BINDING);
+	shadowProgram->bindUniformBlock("ProgramData", PROGRAM_UNIFORM_BINDING);
+	gpuProgram->bindUniformBlock("FrameData", FRAME_UNIFORM_BINDING);
+	gpuProgram->bindUniformBlock("ProgramData", PROGRAM_UNIFORM_BINDING);
+
+	//uniform sampler2DArray diffuseTextures; uniform int diffuseLayer; 	uniform sampler2D shadowMap;
+
+	gpuProgram->uniformLoader->addUniform("diffuseTextures", new UniformInt(0));
+	diffuseLayerUniform = gpuProgram->uniformLoader->addUniform("diffuseLayer", new UniformInt(0));
 	gpuProgram->uniformLoader->addUniform("shadowMap", new UniformInt(1));
-	gpuProgram->uniformLoader->addUniform("shadows", new UniformInt(shadowsEnabled ? 1 : 0));
+
+	// Draws submitted one by one don't enable the per draw layers of indirect draws, they read 0 and use the uniform
+	glVertexAttribI4ui(3, 0, 0, 0, 0);
+	if(multiDrawIndirect && !GLAD_GL_VERSION_4_3) {
+		std::cerr << "Multi draw indirect needs OpenGL 4.3, drawing nodes one by one" << std::endl;
+	}
 }
 
 void Renderer::enableShadows()
 {
-	UniformInt* u = (UniformInt*) gpuProgram->uniformLoader->get("shadows");
-	u->set(1);
+	programUniforms.shadows = 1;
+	if(programUniformBuffer) programUniformBuffer->set(&programUniforms);
 	shadowsEnabled = 1;
 }
 
 void Renderer::disableShadows()
 {
-	UniformInt* u = (UniformInt*) gpuProgram->uniformLoader->get("shadows");
-	u->set(0);
+	programUniforms.shadows = 0;
+	if(programUniformBuffer) programUniformBuffer->set(&programUniforms);
 	shadowsEnabled = 0;
 }
 
-GLuint Renderer::createShadowMap(Camera& camera)
+// Render to a new depth texture from the light, the shadow pass packets are drawn next
+GLuint Renderer::beginShadowPass()
 {
 	// See https://github.com/JoeyDeVries/LearnOpenGL/blob/master/src/5.advanced_lighting/3.1.shadow_mapping/shadow_mapping.cpp:120
 	// - Create depth texture
@@ -981,68 +2133,78 @@ GLuint Renderer::createShadowMap(Camera& camera)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	GLfloat borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
 	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	// Backup the viewport
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
 	glViewport(0, 0, shadowWidth, shadowHeight);
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
 	glClear(GL_DEPTH_BUFFER_BIT);
 
-	if(sceneNodes.size() == 0)
-	{
-		std::cout << "empty scene" << std::endl;
-		exit(-1);
-	}
-
 #if _DEBUG
 	checkForGLError();
 #endif
 
-	glBindVertexArray(vao);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-
-	shadowProgram->use();
-	shadowProgram->uniformLoader->load();
-
-
-	for(int i=0; i<sceneNodes.size(); i++)
-	{
-		glDrawRangeElementsBaseVertex(sceneNodes[i].primativeMode, sceneNodes[i].startPosition, sceneNodes[i].endPosition,
-				(sceneNodes[i].endPosition - sceneNodes[i].startPosition), GL_UNSIGNED_INT, (void*)(0), sceneNodes[i].startPosition);
-
-	}
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(2);
-	glBindVertexArray(0);
+	return depthMap;
+}
 
+// Go back to the window's framebuffer and viewport after the shadow pass
+void Renderer::endShadowPass(const GLint* viewport)
+{
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Restore viewport
 	glViewport(0, 0, viewport[2], viewport[3]);
-	glBindTexture(GL_TEXTURE_2D, depthMap);
 
 #if _DEBUG
 	checkForGLError();
 #endif
+}
 
-	return depthMap;
+// Copy the bounding spheres of the nodes into the arrays batch culling reads, after the nodes changed
+void Renderer::updateNodeBounds()
+{
+	size_t count = sceneNodes.size();
+	nodeBounds.x.resize(count);
+	nodeBounds.y.resize(count);
+	nodeBounds.z.resize(count);
+	nodeBounds.radius.resize(count);
+	visibleNodes.resize(count);
+	sceneTriangles = 0;
+	for(size_t i = 0; i < count; i++) {
+		nodeBounds.x[i] = sceneNodes[i].lx;
+		nodeBounds.y[i] = sceneNodes[i].ly;
+		nodeBounds.z[i] = sceneNodes[i].lz;
+		nodeBounds.radius[i] = sceneNodes[i].boundingSphere;
+		sceneTriangles += sceneNodes[i].indexCount / 3;
+	}
+}
+
+// Build the bounding volume hierarchy over nodeBounds
+void Renderer::buildNodeHierarchy()
+{
+	Uint64 buildStart = SDL_GetPerformanceCounter();
+	nodeHierarchy.build(nodeBounds);
+	if(configLoader->getBool("renderer.verbose")) {
+		double buildSeconds = (double)(SDL_GetPerformanceCounter() - buildStart) / (double)SDL_GetPerformanceFrequency();
+		std::cout << "built bounding volume hierarchy of " << nodeHierarchy.getNodes().size() << " boxes over "
+				<< sceneNodes.size() << " scene nodes in " << buildSeconds << " s" << std::endl;
+	}
+}
+
+// Draw a scene node from the scene buffers or its page, returns false if its page is not resident yet
+bool Renderer::drawNode(size_t i)
+{
+	SceneNode& node = sceneNodes[i];
+	if(!scenePager) {
+		glDrawRangeElementsBaseVertex(node.primativeMode, 0, node.endPosition - node.startPosition - 1,
+				node.indexCount, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * node.indexStart), node.startPosition);
+		return true;
+	}
+	if(!scenePager->bindNode(i)) return false;
+	glDrawRangeElementsBaseVertex(node.primativeMode, 0, node.endPosition - node.startPosition - 1,
+			node.indexCount, GL_UNSIGNED_INT, (void*)(size_t)scenePager->getIndexOffset(node, i), scenePager->getBaseVertex(node, i));
+	return true;
 }
 
 void Renderer::render(Camera* camera)
@@ -1054,6 +2216,10 @@ void Renderer::render(Camera* camera)
 		return;
 	}
 
+	frustum.extractFrustum(camera->modelViewMatrix, camera->projectionMatrix);
+	if(scenePager) scenePager->update(frustum, camera->position);
+	if(textureStreamer) textureStreamer->update();
+
 	glm::vec3 lightPos = camera->position + glm::vec3(10.0, 50.0, 0.0);
 
 	GLuint depthProgramId = shadowProgram->getId();
@@ -1067,23 +2233,15 @@ void Renderer::render(Camera* camera)
 	lightSpaceMatrix = lightProjection * lightView;
 
 
-	// Set shadow program uniforms: uniform mat4 lightSpaceMatrix; uniform mat4 model;
-	shadowProgram->uniformLoader->addUniform(
-			"lightSpaceMatrix",
-			new UniformMat4(lightSpaceMatrix)
-	);
-
-	gpuProgram->uniformLoader->addUniform(
-			"lightSpaceMatrix",
-			new UniformMat4(lightSpaceMatrix)
-	);
-
-	UniformVec3* lightPosUniform = (UniformVec3*) gpuProgram->uniformLoader->get("lightPos");
-	lightPosUniform->set(lightPos);
-
-	if(shadowsEnabled) shadowMap = createShadowMap(*camera);
-	glUseProgram(0);
-
+	// Uniform blocks are only sent when their values changed since the last frame
+	frameUniforms.projection = camera->projectionMatrix;
+	frameUniforms.view = camera->modelViewMatrix;
+	frameUniforms.lightSpaceMatrix = lightSpaceMatrix;
+	frameUniforms.lightPos = glm::vec4(lightPos, 1.f);
+	frameUniforms.viewPos = glm::vec4(camera->position, 1.f);
+	frameUniformBuffer->set(&frameUniforms);
+	frameUniformBuffer->load();
+	programUniformBuffer->load();
 
 	glBindVertexArray(vao);
 	glEnableVertexAttribArray(0);
@@ -1097,56 +2255,57 @@ void Renderer::render(Camera* camera)
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 
-	frustum.extractFrustum(camera->modelViewMatrix, camera->projectionMatrix);
-	for(int i=0; i<sceneNodes.size(); i++)
+	// Screen pixels covered by a unit of length at unit distance, for the footprints of the nodes' textures
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	float pixelsPerUnit = camera->projectionMatrix[1][1] * 0.5f * (float) viewport[3];
+	// Far plane of the perspective projection, the depth buckets of the sort keys span up to it
+	float farPlane = camera->projectionMatrix[3][2] / (camera->projectionMatrix[2][2] + 1.f);
+
+	// Culling emits the draws of the frame, every node casts a shadow
+	renderQueue.clear();
+	if(shadowsEnabled) {
+		uint64_t key = RenderQueue::makeKey(RENDER_PASS_SHADOW, RENDER_PROGRAM_DEPTH, 0, 0.f, 0);
+		for(size_t i = 0; i < sceneNodes.size(); i++) renderQueue.push(key, (GLuint) i);
+	}
+	// Frustum culling lists the visible nodes, either walking the hierarchy or testing every bounding sphere in batches
+	size_t visibleCount;
+	if(bvhCulling) {
+		visibleCount = nodeHierarchy.cull(frustum, nodeBounds, &visibleNodes[0]);
+		bvhNodesVisited = nodeHierarchy.getNodesVisited();
+	} else {
+		visibleCount = frustum.spheresPartiallyInFrustum(nodeBounds, &visibleNodes[0]);
+		bvhNodesVisited = 0;
+	}
+	trianglesDrawn = 0;
+	trianglesCulled = sceneTriangles;
+	for(size_t v = 0; v < visibleCount; v++)
 	{
+		size_t i = visibleNodes[v];
 		glm::vec4 position(sceneNodes[i].lx, sceneNodes[i].ly, sceneNodes[i].lz, 1.f);
-
-		// Frustum culling test
-		if( frustum.spherePartiallyInFrustum(position.x, position.y, position.z, sceneNodes[i].boundingSphere) > 0)
-		{
-
-			gpuProgram->use();
-#if _DEBUG
-			checkForGLError();
-#endif
-
-
-			UniformMat4* viewUniform = (UniformMat4*) gpuProgram->uniformLoader->get("view");
-			viewUniform->set(camera->modelViewMatrix);
-
-			glActiveTexture(GL_TEXTURE0);
-#if _DEBUG
-			checkForGLError();
-#endif
-
-
-			glBindTexture(GL_TEXTURE_2D,  sceneNodes[i].diffuseTextureId );
-
-
-#if _DEBUG
-			checkForGLError();
-#endif
-			if(shadowsEnabled) {
-				glActiveTexture(GL_TEXTURE1);
-				glBindTexture(GL_TEXTURE_2D,  shadowMap );
+		trianglesCulled -= sceneNodes[i].indexCount / 3;
+
+		// Textures without a level in VRAM yet are drawn with the placeholder
+		GLuint textureArray = sceneNodes[i].diffuseTextureId;
+		GLuint layer = sceneNodes[i].diffuseLayer;
+		float radius = sceneNodes[i].boundingSphere;
+		float distance = glm::length(glm::vec3(position) - camera->position);
+		if(textureResidency) {
+			float footprint = distance > radius ? 2.f * radius * pixelsPerUnit / distance : (float) std::max(viewport[2], viewport[3]);
+			textureResidency->markVisible(textureArray, footprint);
+			if(!textureResidency->isDrawable(textureArray)) {
+				textureArray = textureStreamer->getPlaceholder();
+				layer = 0;
 			}
-			gpuProgram->uniformLoader->load();
-
-#if _DEBUG
-			checkForGLError();
-#endif
-
-			glDrawRangeElementsBaseVertex(sceneNodes[i].primativeMode, sceneNodes[i].startPosition, sceneNodes[i].endPosition,
-					(sceneNodes[i].endPosition - sceneNodes[i].startPosition), GL_UNSIGNED_INT, (void*)(0), sceneNodes[i].startPosition);
-
-#if _DEBUG
-			checkForGLError();
-#endif
 		}
+		renderQueue.push(RenderQueue::makeKey(RENDER_PASS_SCENE, RENDER_PROGRAM_SHADED, textureArray,
+				std::max(distance - radius, 0.f) / farPlane, layer), (GLuint) i);
 	}
+	renderQueue.sort();
+	submitRenderQueue(viewport);
 
 	if(shadowsEnabled == 1) glDeleteTextures(1, &shadowMap);
+	if(textureResidency) textureResidency->update();
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -1160,3 +2319,145 @@ void Renderer::render(Camera* camera)
 	checkForGLError();
 #endif
 }
+
+// Bring the GL state in line with a packet's key, only the parts that differ from the last packet are set
+void Renderer::setDrawState(uint64_t key, const GLint* viewport, bool perDrawLayers)
+{
+	GpuProgram* programs[] = {shadowProgram, gpuProgram};
+	if(RenderQueue::getPass(key) != submitState.pass) {
+		if(submitState.pass == RENDER_PASS_SHADOW) endShadowPass(viewport);
+		submitState.pass = RenderQueue::getPass(key);
+		if(submitState.pass == RENDER_PASS_SHADOW) shadowMap = beginShadowPass();
+		// The shadow map stays on unit 1, the scene pass only rebinds unit 0
+		if(submitState.pass == RENDER_PASS_SCENE && shadowsEnabled) {
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, shadowMap);
+			glActiveTexture(GL_TEXTURE0);
+		}
+		if(scenePager) scenePager->beginPass();
+		renderStats.passes++;
+	}
+	bool uniformsChanged = false;
+	if(RenderQueue::getProgram(key) != submitState.program) {
+		submitState.program = RenderQueue::getProgram(key);
+		programs[submitState.program]->use();
+		uniformsChanged = true;
+		renderStats.programs++;
+	}
+	if(submitState.pass == RENDER_PASS_SCENE) {
+		if(RenderQueue::getTexture(key) != submitState.texture) {
+			submitState.texture = RenderQueue::getTexture(key);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, submitState.texture);
+			renderStats.textures++;
+		}
+		// Indirect draws add the layer of each draw to the uniform
+		GLuint layer = perDrawLayers ? 0 : RenderQueue::getLayer(key);
+		if(layer != submitState.layer) {
+			submitState.layer = layer;
+			((UniformInt*) gpuProgram->uniformLoader->get(diffuseLayerUniform))->set(layer);
+			uniformsChanged = true;
+			renderStats.layers++;
+		}
+	}
+	if(uniformsChanged) programs[submitState.program]->uniformLoader->load();
+
+#if _DEBUG
+	checkForGLError();
+#endif
+}
+
+// Draw the sorted packets one by one, or in indirect batches if multi draw indirect is on and supported
+void Renderer::submitRenderQueue(const GLint* viewport)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	memset(&renderStats, 0, sizeof(renderStats));
+	submitState.pass = submitState.program = (unsigned) -1;
+	submitState.texture = submitState.layer = (GLuint) -1;
+	if(multiDrawIndirect && GLAD_GL_VERSION_4_3) {
+		submitIndirect(viewport);
+	} else {
+		std::vector<DrawPacket>& packets = renderQueue.getPackets();
+		for(size_t p = 0; p < packets.size(); p++)
+		{
+			setDrawState(packets[p].key, viewport, false);
+
+			// Nodes of a page that isn't resident yet are skipped until it is uploaded
+			size_t i = packets[p].node;
+			if(!drawNode(i)) continue;
+			renderStats.draws++;
+			renderStats.drawCalls++;
+			if(submitState.pass == RENDER_PASS_SCENE) trianglesDrawn += sceneNodes[i].indexCount / 3;
+		}
+	}
+	if(submitState.pass == RENDER_PASS_SHADOW) endShadowPass(viewport);
+	glUseProgram(0);
+	renderStats.submitSeconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+// Write the draws into an indirect command buffer and issue one glMultiDrawElementsIndirect per batch of packets
+// sharing their state, page and primitive mode. Each draw reads its layer from an instanced attribute at its base instance.
+void Renderer::submitIndirect(const GLint* viewport)
+{
+	if(!indirectBuffer) {
+		glGenBuffers(1, &indirectBuffer);
+		glGenBuffers(1, &drawLayerBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, drawLayerBuffer);
+		glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, 0, (void*)0);
+		glVertexAttribDivisor(3, 1);
+	}
+
+	std::vector<DrawPacket>& packets = renderQueue.getPackets();
+	indirectCommands.clear();
+	drawLayers.clear();
+	indirectBatches.clear();
+	for(size_t p = 0; p < packets.size(); p++)
+	{
+		size_t i = packets[p].node;
+		SceneNode& node = sceneNodes[i];
+		// Nodes of a page that isn't resident yet are skipped until it is uploaded
+		if(scenePager && !scenePager->isNodeResident(i)) continue;
+		uint64_t key = packets[p].key;
+		size_t page = scenePager ? scenePager->getNodePage(i) : 0;
+		if(indirectBatches.empty() || RenderQueue::getState(key) != RenderQueue::getState(indirectBatches.back().key)
+				|| page != indirectBatches.back().page || node.primativeMode != sceneNodes[indirectBatches.back().node].primativeMode) {
+			IndirectBatch batch;
+			batch.key = key;
+			batch.node = (GLuint) i;
+			batch.page = page;
+			batch.firstCommand = indirectCommands.size();
+			batch.commands = 0;
+			indirectBatches.push_back(batch);
+		}
+		DrawElementsIndirectCommand command;
+		command.count = node.indexCount;
+		command.instanceCount = 1;
+		command.firstIndex = scenePager ? scenePager->getIndexOffset(node, i) / sizeof(GLuint) : node.indexStart;
+		command.baseVertex = scenePager ? scenePager->getBaseVertex(node, i) : (GLint) node.startPosition;
+		command.baseInstance = (GLuint) indirectCommands.size();
+		indirectCommands.push_back(command);
+		drawLayers.push_back(RenderQueue::getLayer(key));
+		indirectBatches.back().commands++;
+		if(RenderQueue::getPass(key) == RENDER_PASS_SCENE) trianglesDrawn += node.indexCount / 3;
+	}
+	if(indirectCommands.empty()) return;
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * indirectCommands.size(), &indirectCommands[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, drawLayerBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * drawLayers.size(), &drawLayers[0], GL_STREAM_DRAW);
+	glEnableVertexAttribArray(3);
+	for(size_t b = 0; b < indirectBatches.size(); b++)
+	{
+		IndirectBatch& batch = indirectBatches[b];
+		setDrawState(batch.key, viewport, true);
+		if(scenePager) scenePager->bindNode(batch.node);
+		glMultiDrawElementsIndirect(sceneNodes[batch.node].primativeMode, GL_UNSIGNED_INT,
+				(void*)(sizeof(DrawElementsIndirectCommand) * batch.firstCommand), (GLsizei) batch.commands, 0);
+		renderStats.draws += batch.commands;
+		renderStats.drawCalls++;
+	}
+	// Drawing from the array leaves the attribute's current value undefined, per node draws need layer 0 again
+	glDisableVertexAttribArray(3);
+	glVertexAttribI4ui(3, 0, 0, 0, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
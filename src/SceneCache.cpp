@@ -0,0 +1,518 @@
+#include "Common.h"
+#include "Lz4.h"
+#include "SceneCache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Files are hashed in chunks of this size, one chunk per task
+#define SOURCE_HASH_CHUNK_SIZE (4 * 1024 * 1024)
+
+static const uint64_t PRIME64_1 = 11400714785074694791ULL;
+static const uint64_t PRIME64_2 = 14029467366897019727ULL;
+static const uint64_t PRIME64_3 = 1609587929392839161ULL;
+static const uint64_t PRIME64_4 = 9650029242287828579ULL;
+static const uint64_t PRIME64_5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t xxRound(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t xxMergeRound(uint64_t acc, uint64_t val)
+{
+	acc ^= xxRound(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t xxHash64(const void* data, size_t length, uint64_t seed)
+{
+	const unsigned char* p = (const unsigned char*) data;
+	const unsigned char* end = p + length;
+	uint64_t h;
+
+	if(length >= 32) {
+		const unsigned char* limit = end - 32;
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+		do {
+			v1 = xxRound(v1, read64(p));
+			v2 = xxRound(v2, read64(p + 8));
+			v3 = xxRound(v3, read64(p + 16));
+			v4 = xxRound(v4, read64(p + 24));
+			p += 32;
+		} while(p <= limit);
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxMergeRound(h, v1);
+		h = xxMergeRound(h, v2);
+		h = xxMergeRound(h, v3);
+		h = xxMergeRound(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+
+	h += (uint64_t) length;
+	for(; p + 8 <= end; p += 8) {
+		h ^= xxRound(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if(p + 4 <= end) {
+		h ^= (uint64_t) read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for(; p < end; p++) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+bool statSourceFile(const char* filename, uint64_t& size, int64_t& mtime)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if(!GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes)) return false;
+	size = ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	mtime = (int64_t) (((uint64_t) attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime);
+#else
+	struct stat st;
+	if(stat(filename, &st) != 0) return false;
+	size = (uint64_t) st.st_size;
+#if defined(__APPLE__)
+	mtime = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+	mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+	mtime = (int64_t) st.st_mtime;
+#endif
+#endif
+	return true;
+}
+
+// Hash a file as the xxHash of its per chunk hashes so the chunks can be hashed in parallel
+static bool hashSourceFile(const char* filename, uint64_t& hash, ThreadPool* threadPool)
+{
+	tinyobj::MappedFile file;
+	if(!file.open(filename)) {
+		// mapping an empty file fails on some platforms
+		uint64_t size;
+		int64_t mtime;
+		if(!statSourceFile(filename, size, mtime) || size != 0) return false;
+		hash = xxHash64(0, 0, 0);
+		return true;
+	}
+
+	size_t numChunks = (file.size + SOURCE_HASH_CHUNK_SIZE - 1) / SOURCE_HASH_CHUNK_SIZE;
+	std::vector<uint64_t> chunkHashes(numChunks);
+	std::function<void(size_t)> hashChunk = [&](size_t i) {
+		size_t begin = i * SOURCE_HASH_CHUNK_SIZE;
+		chunkHashes[i] = xxHash64(file.data + begin, std::min((size_t) SOURCE_HASH_CHUNK_SIZE, file.size - begin), 0);
+	};
+	if(threadPool) {
+		threadPool->parallelFor(numChunks, hashChunk);
+	} else {
+		for(size_t i = 0; i < numChunks; i++) hashChunk(i);
+	}
+
+	hash = xxHash64(chunkHashes.empty() ? 0 : &chunkHashes[0], sizeof(uint64_t) * numChunks, (uint64_t) file.size);
+	return true;
+}
+
+bool describeSourceFile(const char* filename, SceneCacheSource& source, ThreadPool* threadPool)
+{
+	memset(&source, 0, sizeof(SceneCacheSource));
+	if(strlen(filename) >= MAX_SOURCE_PATH_LENGTH) return false;
+	strncpy(source.path, filename, MAX_SOURCE_PATH_LENGTH - 1);
+	return statSourceFile(filename, source.size, source.mtime) && hashSourceFile(filename, source.hash, threadPool);
+}
+
+bool isSourceFileCurrent(const SceneCacheSource& source, ThreadPool* threadPool)
+{
+	char path[MAX_SOURCE_PATH_LENGTH];
+	memcpy(path, source.path, MAX_SOURCE_PATH_LENGTH);
+	path[MAX_SOURCE_PATH_LENGTH - 1] = '\0';
+
+	uint64_t size;
+	int64_t mtime;
+	if(!statSourceFile(path, size, mtime) || size != source.size) return false;
+	if(mtime == source.mtime) return true;
+
+	// Touched or copied, compare the content
+	uint64_t hash;
+	return hashSourceFile(path, hash, threadPool) && hash == source.hash;
+}
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + SCENE_CACHE_ALIGNMENT - 1) & ~(uint64_t)(SCENE_CACHE_ALIGNMENT - 1);
+}
+
+SceneCache::SceneCache()
+{
+	header = 0;
+	sections = 0;
+	threadPool = 0;
+}
+
+SceneCache::~SceneCache()
+{
+	close();
+}
+
+bool SceneCache::open(const char* filename, ThreadPool* pool)
+{
+	close();
+	if(!file.open(filename)) return false;
+
+	// Validate the header and section table before handing out any pointers into the mapping
+	const SceneCacheHeader* h = (const SceneCacheHeader*) file.data;
+	if(file.size < sizeof(SceneCacheHeader) || h->magic != SCENE_CACHE_MAGIC || h->version != SCENE_CACHE_VERSION
+			|| h->fileSize != file.size
+			|| h->numSections > (file.size - sizeof(SceneCacheHeader)) / sizeof(SceneCacheSection)) {
+		file.close();
+		return false;
+	}
+
+	const SceneCacheSection* s = (const SceneCacheSection*) (file.data + sizeof(SceneCacheHeader));
+	for(uint32_t i = 0; i < h->numSections; i++) {
+		bool compressed = (s[i].flags & SCENE_CACHE_LZ4) != 0;
+		if(s[i].offset % SCENE_CACHE_ALIGNMENT != 0 || s[i].offset > file.size || s[i].storedSize > file.size - s[i].offset
+				|| (!compressed && s[i].storedSize != s[i].size) || (compressed && s[i].blockSize == 0)
+				|| (s[i].elementSize > 0 && s[i].count > s[i].size / s[i].elementSize)) {
+			file.close();
+			return false;
+		}
+	}
+
+	header = h;
+	sections = s;
+	threadPool = pool;
+	return true;
+}
+
+void SceneCache::close()
+{
+	header = 0;
+	sections = 0;
+	decompressed.clear();
+	file.close();
+}
+
+const SceneCacheSection* SceneCache::getSection(uint32_t type)
+{
+	if(!header) return 0;
+	for(uint32_t i = 0; i < header->numSections; i++) {
+		if(sections[i].type == type) return &sections[i];
+	}
+	return 0;
+}
+
+bool SceneCache::decompressSection(const SceneCacheSection* section, std::vector<unsigned char>& out)
+{
+	// Block sizes are stored after the blocks, work out where each block starts
+	uint64_t numBlocks = (section->size + section->blockSize - 1) / section->blockSize;
+	if(numBlocks > section->storedSize / sizeof(uint64_t)) return false;
+	const unsigned char* data = (const unsigned char*) file.data + section->offset;
+	uint64_t blocksSize = section->storedSize - numBlocks * sizeof(uint64_t);
+	std::vector<uint64_t> blockOffsets((size_t) numBlocks + 1, 0);
+	for(uint64_t i = 0; i < numBlocks; i++) {
+		uint64_t storedBlockSize;
+		memcpy(&storedBlockSize, data + blocksSize + i * sizeof(uint64_t), sizeof(uint64_t));
+		if(storedBlockSize > blocksSize - blockOffsets[i]) return false;
+		blockOffsets[i + 1] = blockOffsets[i] + storedBlockSize;
+	}
+
+	out.resize((size_t) section->size);
+	SDL_atomic_t failed;
+	SDL_AtomicSet(&failed, 0);
+	std::function<void(size_t)> decompressBlock = [&](size_t i) {
+		uint64_t rawOffset = i * (uint64_t) section->blockSize;
+		size_t rawBlockSize = (size_t) std::min((uint64_t) section->blockSize, section->size - rawOffset);
+		size_t storedBlockSize = (size_t) (blockOffsets[i + 1] - blockOffsets[i]);
+		const unsigned char* src = data + blockOffsets[i];
+		if(storedBlockSize == rawBlockSize) {
+			memcpy(&out[(size_t) rawOffset], src, rawBlockSize);
+		} else if(!lz4Decompress(src, storedBlockSize, &out[(size_t) rawOffset], rawBlockSize)) {
+			SDL_AtomicSet(&failed, 1);
+		}
+	};
+	if(threadPool) {
+		threadPool->parallelFor((size_t) numBlocks, decompressBlock);
+	} else {
+		for(size_t i = 0; i < numBlocks; i++) decompressBlock(i);
+	}
+	return SDL_AtomicGet(&failed) == 0;
+}
+
+const void* SceneCache::getSectionData(uint32_t type, size_t elementSize, size_t& count)
+{
+	count = 0;
+	const SceneCacheSection* section = getSection(type);
+	if(!section || section->elementSize != elementSize) return 0;
+
+	const void* data = file.data + section->offset;
+	if(section->flags & SCENE_CACHE_LZ4) {
+		std::map<uint32_t, std::vector<unsigned char> >::iterator it = decompressed.find(type);
+		if(it == decompressed.end()) {
+			it = decompressed.insert(std::make_pair(type, std::vector<unsigned char>())).first;
+			if(!decompressSection(section, it->second)) {
+				std::cerr << "Cache section " << type << " is corrupt" << std::endl;
+				decompressed.erase(it);
+				return 0;
+			}
+		}
+		data = it->second.empty() ? 0 : &it->second[0];
+	}
+	count = (size_t) section->count;
+	return data;
+}
+
+size_t SceneCache::getFileSize()
+{
+	return header ? file.size : 0;
+}
+
+SceneCacheWriter::SceneCacheWriter()
+{
+	rawSize = fileSize = 0;
+}
+
+void SceneCacheWriter::addSection(uint32_t type, size_t elementSize, size_t count)
+{
+	PendingSection p;
+	memset(&p.section, 0, sizeof(SceneCacheSection));
+	p.section.type = type;
+	p.section.elementSize = (uint32_t) elementSize;
+	p.section.count = count;
+	sections.push_back(p);
+}
+
+uint64_t SceneCacheWriter::addSectionData(const void* data, size_t size)
+{
+	PendingSection& p = sections.back();
+	uint64_t offset = p.section.size;
+	p.parts.push_back(std::make_pair(data, size));
+	p.section.size = alignOffset(offset + size);
+	return offset;
+}
+
+// Gather size bytes starting at offset of the section as it will be laid out, including the padding between parts
+void SceneCacheWriter::copySectionRange(const PendingSection& p, uint64_t offset, size_t size, unsigned char* dst)
+{
+	memset(dst, 0, size);
+	uint64_t partOffset = 0;
+	for(size_t i = 0; i < p.parts.size() && partOffset < offset + size; i++) {
+		uint64_t partSize = p.parts[i].second;
+		uint64_t begin = std::max(offset, partOffset);
+		uint64_t end = std::min(offset + size, partOffset + partSize);
+		if(begin < end) {
+			memcpy(dst + (begin - offset), (const unsigned char*) p.parts[i].first + (begin - partOffset), (size_t) (end - begin));
+		}
+		partOffset = alignOffset(partOffset + partSize);
+	}
+}
+
+bool SceneCacheWriter::writeCompressedSection(std::ofstream& binFile, PendingSection& p, ThreadPool* threadPool)
+{
+	p.section.flags = SCENE_CACHE_LZ4;
+	p.section.blockSize = SCENE_CACHE_BLOCK_SIZE;
+	size_t numBlocks = (size_t) ((p.section.size + SCENE_CACHE_BLOCK_SIZE - 1) / SCENE_CACHE_BLOCK_SIZE);
+	std::vector<uint64_t> storedBlockSizes(numBlocks);
+	uint64_t storedSize = 0;
+
+	// Compress a batch of blocks per worker at a time so memory use stays bounded for large sections
+	size_t batchSize = std::max((size_t) 1, (size_t) (threadPool ? threadPool->getNumThreads() + 1 : 1)) * 4;
+	std::vector<std::vector<unsigned char> > raw(batchSize), compressed(batchSize);
+	for(size_t batch = 0; batch < numBlocks; batch += batchSize) {
+		size_t count = std::min(batchSize, numBlocks - batch);
+		std::function<void(size_t)> compressBlock = [&](size_t i) {
+			uint64_t rawOffset = (uint64_t) (batch + i) * SCENE_CACHE_BLOCK_SIZE;
+			size_t rawBlockSize = (size_t) std::min((uint64_t) SCENE_CACHE_BLOCK_SIZE, p.section.size - rawOffset);
+			raw[i].resize(rawBlockSize);
+			copySectionRange(p, rawOffset, rawBlockSize, &raw[i][0]);
+			compressed[i].resize(lz4CompressBound(rawBlockSize));
+			size_t compressedSize = lz4Compress(&raw[i][0], rawBlockSize, &compressed[i][0]);
+			if(compressedSize >= rawBlockSize) {
+				// Doesn't shrink, store it as is
+				compressed[i].swap(raw[i]);
+			} else {
+				compressed[i].resize(compressedSize);
+			}
+		};
+		if(threadPool) {
+			threadPool->parallelFor(count, compressBlock);
+		} else {
+			for(size_t i = 0; i < count; i++) compressBlock(i);
+		}
+
+		for(size_t i = 0; i < count; i++) {
+			binFile.write((const char*) &compressed[i][0], (std::streamsize) compressed[i].size());
+			storedBlockSizes[batch + i] = compressed[i].size();
+			storedSize += compressed[i].size();
+		}
+	}
+
+	binFile.write((const char*) &storedBlockSizes[0], (std::streamsize) (sizeof(uint64_t) * numBlocks));
+	p.section.storedSize = storedSize + sizeof(uint64_t) * numBlocks;
+	return !binFile.fail();
+}
+
+// Flush a written file to the disk. Renaming it over the old cache before could leave an empty or torn file under
+// the final name after a power loss.
+static bool syncFile(const char* path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) return false;
+	bool synced = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return synced;
+#else
+	int fd = open(path, O_WRONLY);
+	if(fd < 0) return false;
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+#endif
+}
+
+// Flush the directory holding a renamed file so the rename itself survives a crash. MoveFileExA does this with
+// MOVEFILE_WRITE_THROUGH on Windows.
+static void syncParentDirectory(const char* path)
+{
+#ifndef _WIN32
+	std::string directory(path);
+	size_t separator = directory.find_last_of('/');
+	directory = separator == std::string::npos ? "." : directory.substr(0, std::max(separator, (size_t) 1));
+	int fd = open(directory.c_str(), O_RDONLY);
+	if(fd < 0) return;
+	fsync(fd);
+	close(fd);
+#endif
+}
+
+bool replaceSceneCacheFile(const char* from, const char* to)
+{
+#ifdef _WIN32
+	bool renamed = MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool renamed = rename(from, to) == 0;
+#endif
+	if(!renamed) {
+		std::cerr << "Unable to rename " << from << " to " << to << std::endl;
+		return false;
+	}
+	syncParentDirectory(to);
+	return true;
+}
+
+bool SceneCacheWriter::write(const char* filename, ThreadPool* threadPool, bool compress)
+{
+	std::string tempFileName = std::string(filename) + ".tmp";
+	std::ofstream binFile(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+	if(!binFile.is_open()) {
+		std::cerr << "Unable to open " << tempFileName << " for writing" << std::endl;
+		return false;
+	}
+
+	// The header and section table are written last, once the section offsets and sizes are known
+	static const char padding[SCENE_CACHE_ALIGNMENT] = { 0 };
+	uint64_t offset = alignOffset(sizeof(SceneCacheHeader) + sizeof(SceneCacheSection) * sections.size());
+	for(uint64_t i = 0; i < offset; i += SCENE_CACHE_ALIGNMENT) {
+		binFile.write(padding, (std::streamsize) std::min((uint64_t) SCENE_CACHE_ALIGNMENT, offset - i));
+	}
+
+	rawSize = offset;
+	std::vector<SceneCacheSection> table;
+	for(size_t i = 0; i < sections.size(); i++) {
+		PendingSection& p = sections[i];
+		p.section.offset = offset;
+		rawSize += p.section.size;
+
+		if(compress && p.section.size >= SCENE_CACHE_MIN_COMPRESSED_SIZE && p.section.type != SCENE_CACHE_SOURCES) {
+			if(!writeCompressedSection(binFile, p, threadPool)) break;
+			binFile.write(padding, (std::streamsize) (alignOffset(p.section.storedSize) - p.section.storedSize));
+		} else {
+			for(size_t j = 0; j < p.parts.size(); j++) {
+				size_t size = p.parts[j].second;
+				if(size > 0) binFile.write((const char*) p.parts[j].first, (std::streamsize) size);
+				binFile.write(padding, (std::streamsize) (alignOffset(size) - size));
+			}
+			p.section.storedSize = p.section.size;
+		}
+		offset += alignOffset(p.section.storedSize);
+		table.push_back(p.section);
+	}
+
+	SceneCacheHeader header;
+	header.magic = SCENE_CACHE_MAGIC;
+	header.version = SCENE_CACHE_VERSION;
+	header.numSections = (uint32_t) sections.size();
+	header.reserved = 0;
+	header.fileSize = offset;
+	fileSize = offset;
+
+	binFile.seekp(0);
+	binFile.write((const char*) &header, sizeof(SceneCacheHeader));
+	if(!table.empty()) binFile.write((const char*) &table[0], sizeof(SceneCacheSection) * table.size());
+	binFile.close();
+	if(binFile.fail() || table.size() != sections.size() || !syncFile(tempFileName.c_str())) {
+		std::cerr << "Unable to write " << tempFileName << std::endl;
+		remove(tempFileName.c_str());
+		return false;
+	}
+
+	// Only replace the old cache once the new one is complete
+	if(!replaceSceneCacheFile(tempFileName.c_str(), filename)) {
+		remove(tempFileName.c_str());
+		return false;
+	}
+	return true;
+}
+
+uint64_t SceneCacheWriter::getRawSize()
+{
+	return rawSize;
+}
+
+uint64_t SceneCacheWriter::getFileSize()
+{
+	return fileSize;
+}
@@ -0,0 +1,225 @@
+#include "Common.h"
+#include "ScenePager.h"
+
+// Pages being read by worker threads at once
+#define MAX_PAGE_LOADS_IN_FLIGHT 16
+
+ScenePager::ScenePager(const SceneCachePage* cachePages, size_t numPages, const Vertex* _vertices, const GLuint* _indices,
+		size_t numNodes, ThreadPool* _threadPool, size_t _ramBudget, size_t _vramBudget, size_t _uploadBudget)
+{
+	vertices = _vertices;
+	indices = _indices;
+	threadPool = _threadPool;
+	ramBudget = _ramBudget;
+	vramBudget = _vramBudget;
+	uploadBudget = _uploadBudget;
+	ramBytes = vramBytes = 0;
+	SDL_AtomicSet(&loadsInFlight, 0);
+	boundPage = 0;
+	latencySum = latencyMax = 0.0;
+	latencyCount = 0;
+
+	pages.resize(numPages);
+	sorted.resize(numPages);
+	nodePages.resize(numNodes, 0);
+	for(size_t i = 0; i < numPages; i++) {
+		ScenePage& page = pages[i];
+		page.info = cachePages[i];
+		SDL_AtomicSet(&page.state, PAGE_ON_DISK);
+		page.vbo = page.ibo = 0;
+		page.distance = 0.f;
+		page.visible = page.wantRam = page.wantVram = false;
+		page.requestTime = 0;
+		for(size_t n = page.info.firstNode; n < page.info.firstNode + page.info.numNodes && n < numNodes; n++) {
+			nodePages[n] = i;
+		}
+	}
+}
+
+ScenePager::~ScenePager()
+{
+	// Workers write into the pages, wait for them before freeing anything
+	while(SDL_AtomicGet(&loadsInFlight) > 0) SDL_Delay(1);
+	for(size_t i = 0; i < pages.size(); i++) {
+		evictFromVram(pages[i]);
+	}
+}
+
+size_t ScenePager::pageBytes(ScenePage& page)
+{
+	return sizeof(Vertex) * page.info.vertexCount + sizeof(GLuint) * page.info.indexCount;
+}
+
+// Worker thread callback, copies a page out of the mapped cache which faults it in from disk
+void ScenePager::loadPage(ScenePage* page, const Vertex* vertices, const GLuint* indices)
+{
+	size_t vertexBytes = sizeof(Vertex) * page->info.vertexCount;
+	size_t indexBytes = sizeof(GLuint) * page->info.indexCount;
+	page->ram.resize(vertexBytes + indexBytes);
+	memcpy(&page->ram[0], vertices + page->info.vertexStart, vertexBytes);
+	memcpy(&page->ram[vertexBytes], indices + page->info.indexStart, indexBytes);
+	SDL_AtomicSet(&page->state, PAGE_IN_RAM);
+}
+
+void ScenePager::evictFromVram(ScenePage& page)
+{
+	if(!page.vbo) return;
+	glDeleteBuffers(1, &page.vbo);
+	glDeleteBuffers(1, &page.ibo);
+	page.vbo = page.ibo = 0;
+	vramBytes -= pageBytes(page);
+	if(boundPage == &page) boundPage = 0;
+}
+
+static bool comparePagePriority(ScenePage* a, ScenePage* b)
+{
+	if(a->visible != b->visible) return a->visible;
+	return a->distance < b->distance;
+}
+
+void ScenePager::update(Frustum& frustum, glm::vec3& cameraPosition)
+{
+	boundPage = 0;
+
+	// Visible pages come first, then the rest so pages just outside the view are prefetched, closest first
+	for(size_t i = 0; i < pages.size(); i++) {
+		ScenePage& page = pages[i];
+		glm::vec3 center = glm::make_vec3(page.info.center);
+		page.distance = std::max(glm::length(center - cameraPosition) - page.info.radius, 0.f);
+		page.visible = frustum.spherePartiallyInFrustum(center.x, center.y, center.z, page.info.radius) > 0;
+	}
+	for(size_t i = 0; i < pages.size(); i++) sorted[i] = &pages[i];
+	std::sort(sorted.begin(), sorted.end(), comparePagePriority);
+
+	size_t ramWanted = 0, vramWanted = 0;
+	for(size_t i = 0; i < sorted.size(); i++) {
+		ScenePage& page = *sorted[i];
+		size_t bytes = pageBytes(page);
+		page.wantVram = vramWanted + bytes <= vramBudget;
+		if(page.wantVram) vramWanted += bytes;
+		page.wantRam = ramWanted + bytes <= ramBudget;
+		if(page.wantRam) ramWanted += bytes;
+	}
+
+	// Evict pages that fell out of the budgets, a page waiting for upload keeps its RAM copy until then
+	Uint64 now = SDL_GetPerformanceCounter();
+	for(size_t i = 0; i < pages.size(); i++) {
+		ScenePage& page = pages[i];
+		if(!page.wantVram) {
+			evictFromVram(page);
+			page.requestTime = 0;
+		} else if(!page.vbo && page.requestTime == 0) {
+			page.requestTime = now;
+		}
+		bool needsRam = page.wantRam || (page.wantVram && !page.vbo);
+		if(!needsRam && SDL_AtomicGet(&page.state) == PAGE_IN_RAM) {
+			std::vector<unsigned char>().swap(page.ram);
+			SDL_AtomicSet(&page.state, PAGE_ON_DISK);
+			ramBytes -= pageBytes(page);
+		}
+	}
+
+	// Start loads and upload pages that finished loading, highest priority first
+	size_t uploaded = 0;
+	for(size_t i = 0; i < sorted.size(); i++) {
+		ScenePage& page = *sorted[i];
+		bool needsRam = page.wantRam || (page.wantVram && !page.vbo);
+		int state = SDL_AtomicGet(&page.state);
+
+		if(needsRam && state == PAGE_ON_DISK && SDL_AtomicGet(&loadsInFlight) < MAX_PAGE_LOADS_IN_FLIGHT) {
+			SDL_AtomicSet(&page.state, PAGE_LOADING);
+			SDL_AtomicAdd(&loadsInFlight, 1);
+			ramBytes += pageBytes(page);
+			ScenePage* p = &page;
+			const Vertex* v = vertices;
+			const GLuint* idx = indices;
+			SDL_atomic_t* inFlight = &loadsInFlight;
+			threadPool->enqueue([p, v, idx, inFlight]() {
+				loadPage(p, v, idx);
+				SDL_AtomicAdd(inFlight, -1);
+			});
+		} else if(page.wantVram && !page.vbo && state == PAGE_IN_RAM && uploaded < uploadBudget) {
+			size_t vertexBytes = sizeof(Vertex) * page.info.vertexCount;
+			size_t indexBytes = sizeof(GLuint) * page.info.indexCount;
+			// Upload through the copy target so the bound vertex array object is left alone
+			glGenBuffers(1, &page.vbo);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, page.vbo);
+			glBufferData(GL_COPY_WRITE_BUFFER, vertexBytes, &page.ram[0], GL_STATIC_DRAW);
+			glGenBuffers(1, &page.ibo);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, page.ibo);
+			glBufferData(GL_COPY_WRITE_BUFFER, indexBytes, &page.ram[vertexBytes], GL_STATIC_DRAW);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			vramBytes += vertexBytes + indexBytes;
+			uploaded += vertexBytes + indexBytes;
+
+			double latency = (double)(SDL_GetPerformanceCounter() - page.requestTime) / (double)SDL_GetPerformanceFrequency();
+			latencySum += latency;
+			latencyMax = std::max(latencyMax, latency);
+			latencyCount++;
+			page.requestTime = 0;
+
+			if(!page.wantRam) {
+				std::vector<unsigned char>().swap(page.ram);
+				SDL_AtomicSet(&page.state, PAGE_ON_DISK);
+				ramBytes -= vertexBytes + indexBytes;
+			}
+		}
+	}
+}
+
+bool ScenePager::bindNode(size_t node)
+{
+	ScenePage& page = pages[nodePages[node]];
+	if(!page.vbo) return false;
+	if(boundPage != &page) {
+		glBindBuffer(GL_ARRAY_BUFFER, page.vbo);
+		glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(Vertex),(void*)0);
+		glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(Vertex),(void*)(sizeof(float)*3));
+		glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,sizeof(Vertex),(void*)(sizeof(float)*6));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.ibo);
+		boundPage = &page;
+	}
+	return true;
+}
+
+bool ScenePager::isNodeResident(size_t node)
+{
+	return pages[nodePages[node]].vbo != 0;
+}
+
+size_t ScenePager::getNodePage(size_t node)
+{
+	return nodePages[node];
+}
+
+void ScenePager::beginPass()
+{
+	boundPage = 0;
+}
+
+GLuint ScenePager::getIndexOffset(SceneNode& sceneNode, size_t node)
+{
+	return (GLuint) sizeof(GLuint) * (sceneNode.indexStart - pages[nodePages[node]].info.indexStart);
+}
+
+GLint ScenePager::getBaseVertex(SceneNode& sceneNode, size_t node)
+{
+	return (GLint) (sceneNode.startPosition - pages[nodePages[node]].info.vertexStart);
+}
+
+void ScenePager::printStats(std::ostream& os)
+{
+	size_t resident = 0;
+	for(size_t i = 0; i < pages.size(); i++) {
+		if(pages[i].vbo) resident++;
+	}
+	os << "pages in VRAM: " << resident << "/" << pages.size() << " (" << vramBytes / (1024.0 * 1024.0) << " MB), RAM: "
+			<< ramBytes / (1024.0 * 1024.0) << " MB";
+	if(latencyCount > 0) {
+		os << ", page-in latency avg " << 1000.0 * latencySum / (double)latencyCount << " ms, max "
+				<< 1000.0 * latencyMax << " ms over " << latencyCount << " pages";
+	}
+	os << std::endl;
+	latencySum = latencyMax = 0.0;
+	latencyCount = 0;
+}
@@ -0,0 +1,540 @@
+#include "TextureCompression.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+// BC7 mode 6 interpolation weights out of 64 for its 4 bit indices
+static const int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+static const int bc7Order[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+GLenum compressionInternalFormat(unsigned compression)
+{
+	switch(compression) {
+	case TEXTURE_COMPRESSION_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case TEXTURE_COMPRESSION_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case TEXTURE_COMPRESSION_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return 0;
+	}
+}
+
+static size_t blockBytes(unsigned compression)
+{
+	return compression == TEXTURE_COMPRESSION_BC1 ? 8 : 16;
+}
+
+size_t textureLevelSize(const Texture& texture, unsigned level)
+{
+	size_t width = std::max(texture.width >> level, 1u);
+	size_t height = std::max(texture.height >> level, 1u);
+	if(texture.compression == TEXTURE_COMPRESSION_NONE) return width * height * texture.bpp;
+	return ((width + 3) / 4) * ((height + 3) / 4) * blockBytes(texture.compression);
+}
+
+size_t textureDataSize(const Texture& texture)
+{
+	size_t size = 0;
+	for(unsigned i = 0; i < texture.levels; i++) size += textureLevelSize(texture, i);
+	return size;
+}
+
+// Read a 4x4 block as RGBA, pixels past the edge of the image repeat the last row or column
+static void loadBlock(const unsigned char* pixels, unsigned width, unsigned height, unsigned bpp, unsigned bx, unsigned by,
+		float block[16][4])
+{
+	for(unsigned y = 0; y < 4; y++) {
+		unsigned py = std::min(by * 4 + y, height - 1);
+		for(unsigned x = 0; x < 4; x++) {
+			unsigned px = std::min(bx * 4 + x, width - 1);
+			const unsigned char* p = pixels + ((size_t) py * width + px) * bpp;
+			float* out = block[y * 4 + x];
+			out[0] = p[0];
+			out[1] = p[1];
+			out[2] = p[2];
+			out[3] = bpp == 4 ? p[3] : 255.f;
+		}
+	}
+}
+
+// Endpoints at the extremes of the block along its principal axis
+static void principalEndpoints(const float block[16][4], int channels, float a[4], float b[4])
+{
+	float mean[4] = {0.f, 0.f, 0.f, 0.f};
+	for(int i = 0; i < 16; i++) {
+		for(int c = 0; c < channels; c++) mean[c] += block[i][c] / 16.f;
+	}
+	float cov[4][4];
+	memset(cov, 0, sizeof(cov));
+	for(int i = 0; i < 16; i++) {
+		for(int r = 0; r < channels; r++) {
+			for(int c = 0; c < channels; c++) cov[r][c] += (block[i][r] - mean[r]) * (block[i][c] - mean[c]);
+		}
+	}
+
+	// Power iteration, starting from the diagonal of the bounding box converges quickly on most blocks
+	float axis[4] = {1.f, 1.f, 1.f, 1.f};
+	for(int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {0.f, 0.f, 0.f, 0.f};
+		float length = 0.f;
+		for(int r = 0; r < channels; r++) {
+			for(int c = 0; c < channels; c++) next[r] += cov[r][c] * axis[c];
+			length = std::max(length, fabsf(next[r]));
+		}
+		if(length < 1e-6f) break;
+		for(int c = 0; c < channels; c++) axis[c] = next[c] / length;
+	}
+
+	float lo = 0.f, hi = 0.f;
+	for(int i = 0; i < 16; i++) {
+		float t = 0.f;
+		for(int c = 0; c < channels; c++) t += (block[i][c] - mean[c]) * axis[c];
+		lo = std::min(lo, t);
+		hi = std::max(hi, t);
+	}
+	float norm = 0.f;
+	for(int c = 0; c < channels; c++) norm += axis[c] * axis[c];
+	if(norm > 0.f) {
+		lo /= norm;
+		hi /= norm;
+	}
+	for(int c = 0; c < channels; c++) {
+		a[c] = std::min(std::max(mean[c] + axis[c] * lo, 0.f), 255.f);
+		b[c] = std::min(std::max(mean[c] + axis[c] * hi, 0.f), 255.f);
+	}
+}
+
+// Least squares endpoints for the given interpolation weights of every pixel, returns false if degenerate
+static bool fitEndpoints(const float block[16][4], const float weights[16], int channels, float a[4], float b[4])
+{
+	float aa = 0.f, ab = 0.f, bb = 0.f;
+	float ax[4] = {0.f, 0.f, 0.f, 0.f}, bx[4] = {0.f, 0.f, 0.f, 0.f};
+	for(int i = 0; i < 16; i++) {
+		float w = weights[i];
+		aa += (1.f - w) * (1.f - w);
+		ab += (1.f - w) * w;
+		bb += w * w;
+		for(int c = 0; c < channels; c++) {
+			ax[c] += (1.f - w) * block[i][c];
+			bx[c] += w * block[i][c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if(fabsf(det) < 1e-6f) return false;
+	for(int c = 0; c < channels; c++) {
+		a[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / det, 0.f), 255.f);
+		b[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / det, 0.f), 255.f);
+	}
+	return true;
+}
+
+static inline float pixelError(const float* pixel, const int* color, int channels)
+{
+	float error = 0.f;
+	for(int c = 0; c < channels; c++) error += (pixel[c] - color[c]) * (pixel[c] - color[c]);
+	return error;
+}
+
+// Pick the closest palette entry for every pixel, returns the total squared error. The palette is interpolated
+// between two endpoints, order lists its entries from the first endpoint to the second, so only the entries
+// around a pixel's projection onto the line between them have to be compared.
+static float assignIndices(const float block[16][4], const int palette[][4], const int* order, int paletteSize,
+		int channels, int indices[16])
+{
+	const int* first = palette[order[0]];
+	const int* last = palette[order[paletteSize - 1]];
+	float axis[4] = {0.f, 0.f, 0.f, 0.f};
+	float length = 0.f;
+	for(int c = 0; c < channels; c++) {
+		axis[c] = (float) (last[c] - first[c]);
+		length += axis[c] * axis[c];
+	}
+
+	float total = 0.f;
+	for(int i = 0; i < 16; i++) {
+		int k = 0;
+		if(length > 0.f) {
+			float t = 0.f;
+			for(int c = 0; c < channels; c++) t += (block[i][c] - first[c]) * axis[c];
+			k = (int) floorf(t / length * (paletteSize - 1) + 0.5f);
+			k = std::min(std::max(k, 0), paletteSize - 1);
+		}
+		int lo = std::max(k - 1, 0), hi = std::min(k + 1, paletteSize - 1);
+		float best = pixelError(block[i], palette[order[lo]], channels);
+		indices[i] = order[lo];
+		for(int p = lo + 1; p <= hi; p++) {
+			float error = pixelError(block[i], palette[order[p]], channels);
+			if(error < best) {
+				best = error;
+				indices[i] = order[p];
+			}
+		}
+		total += best;
+	}
+	return total;
+}
+
+static inline unsigned short packRgb565(const float* c)
+{
+	unsigned r = (unsigned) (c[0] * 31.f / 255.f + 0.5f);
+	unsigned g = (unsigned) (c[1] * 63.f / 255.f + 0.5f);
+	unsigned b = (unsigned) (c[2] * 31.f / 255.f + 0.5f);
+	return (unsigned short) ((r << 11) | (g << 5) | b);
+}
+
+static inline void unpackRgb565(unsigned short v, int* c)
+{
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+	c[3] = 255;
+}
+
+// Four color palette of a BC1 block in index order
+static void bc1Palette(unsigned short c0, unsigned short c1, int palette[4][4])
+{
+	unpackRgb565(c0, palette[0]);
+	unpackRgb565(c1, palette[1]);
+	for(int c = 0; c < 4; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+}
+
+static void writeLe16(unsigned char* out, unsigned v)
+{
+	out[0] = (unsigned char) (v & 0xff);
+	out[1] = (unsigned char) (v >> 8);
+}
+
+// Color block of BC1 and BC3, always in four color mode
+static void encodeBc1Block(const float block[16][4], unsigned char* out)
+{
+	// Weight of the second endpoint for each index, and the indices from the first endpoint to the second
+	static const float indexWeights[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+	static const int indexOrder[4] = {0, 2, 3, 1};
+	float a[4], b[4];
+	principalEndpoints(block, 3, a, b);
+
+	unsigned short bestC0 = 0, bestC1 = 0;
+	int bestIndices[16];
+	float bestError = -1.f;
+	for(int iteration = 0; iteration < 2; iteration++) {
+		unsigned short c0 = packRgb565(b), c1 = packRgb565(a);
+		if(c0 < c1) std::swap(c0, c1);
+		int palette[4][4];
+		int indices[16];
+		bc1Palette(c0, c1, palette);
+		// Equal endpoints would switch the block to three color mode, index 0 is the only color then
+		float error = assignIndices(block, palette, indexOrder, c0 == c1 ? 1 : 4, 3, indices);
+		if(bestError < 0.f || error < bestError) {
+			bestError = error;
+			bestC0 = c0;
+			bestC1 = c1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+		if(c0 == c1) break;
+
+		// Refit the endpoints to the chosen indices, the unquantized fit starts from the first endpoint
+		float weights[16];
+		for(int i = 0; i < 16; i++) weights[i] = indexWeights[indices[i]];
+		if(!fitEndpoints(block, weights, 3, b, a)) break;
+	}
+
+	writeLe16(out, bestC0);
+	writeLe16(out + 2, bestC1);
+	uint32_t bits = 0;
+	for(int i = 0; i < 16; i++) bits |= (uint32_t) bestIndices[i] << (2 * i);
+	for(int i = 0; i < 4; i++) out[4 + i] = (unsigned char) (bits >> (8 * i));
+}
+
+// Alpha block of BC3 in eight value mode
+static void encodeAlphaBlock(const float block[16][4], unsigned char* out)
+{
+	float lo = 255.f, hi = 0.f;
+	for(int i = 0; i < 16; i++) {
+		lo = std::min(lo, block[i][3]);
+		hi = std::max(hi, block[i][3]);
+	}
+	int a0 = (int) (hi + 0.5f), a1 = (int) (lo + 0.5f);
+	uint64_t bits = 0;
+	if(a0 > a1) {
+		int values[8];
+		values[0] = a0;
+		values[1] = a1;
+		for(int i = 2; i < 8; i++) values[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+		for(int i = 0; i < 16; i++) {
+			int best = 0;
+			float bestError = fabsf(block[i][3] - values[0]);
+			for(int v = 1; v < 8; v++) {
+				float error = fabsf(block[i][3] - values[v]);
+				if(error < bestError) {
+					bestError = error;
+					best = v;
+				}
+			}
+			bits |= (uint64_t) best << (3 * i);
+		}
+	}
+	out[0] = (unsigned char) a0;
+	out[1] = (unsigned char) a1;
+	for(int i = 0; i < 6; i++) out[2 + i] = (unsigned char) (bits >> (8 * i));
+}
+
+// Quantize a BC7 mode 6 endpoint to 7 bits per channel and a shared p-bit, picking the p-bit that fits best
+static void quantizeBc7Endpoint(const float* v, int* q, int& p)
+{
+	float bestError = -1.f;
+	for(int pBit = 0; pBit < 2; pBit++) {
+		int candidate[4];
+		float error = 0.f;
+		for(int c = 0; c < 4; c++) {
+			candidate[c] = std::min(std::max((int) floorf((v[c] - pBit) / 2.f + 0.5f), 0), 127);
+			float recon = (float) ((candidate[c] << 1) | pBit);
+			error += (recon - v[c]) * (recon - v[c]);
+		}
+		if(bestError < 0.f || error < bestError) {
+			bestError = error;
+			p = pBit;
+			memcpy(q, candidate, sizeof(candidate));
+		}
+	}
+}
+
+static void bc7Palette(const int* q0, int p0, const int* q1, int p1, int palette[16][4])
+{
+	for(int c = 0; c < 4; c++) {
+		int e0 = (q0[c] << 1) | p0, e1 = (q1[c] << 1) | p1;
+		for(int i = 0; i < 16; i++) palette[i][c] = ((64 - bc7Weights[i]) * e0 + bc7Weights[i] * e1 + 32) >> 6;
+	}
+}
+
+// Little endian bit writer for 128 bit blocks
+typedef struct {
+	uint64_t lo, hi;
+	unsigned position;
+} BlockBits;
+
+static void putBits(BlockBits& bits, uint64_t value, unsigned count)
+{
+	for(unsigned i = 0; i < count; i++, bits.position++) {
+		uint64_t bit = (value >> i) & 1;
+		if(bits.position < 64) bits.lo |= bit << bits.position;
+		else bits.hi |= bit << (bits.position - 64);
+	}
+}
+
+static unsigned getBits(BlockBits& bits, unsigned count)
+{
+	unsigned value = 0;
+	for(unsigned i = 0; i < count; i++, bits.position++) {
+		uint64_t word = bits.position < 64 ? bits.lo >> bits.position : bits.hi >> (bits.position - 64);
+		value |= (unsigned) (word & 1) << i;
+	}
+	return value;
+}
+
+// BC7 mode 6, one subset of RGBA endpoints with p-bits and 4 bit indices
+static void encodeBc7Block(const float block[16][4], unsigned char* out)
+{
+	float a[4], b[4];
+	principalEndpoints(block, 4, a, b);
+
+	int best0[4], best1[4], bestP0 = 0, bestP1 = 0;
+	int bestIndices[16];
+	float bestError = -1.f;
+	for(int iteration = 0; iteration < 2; iteration++) {
+		int q0[4], q1[4], p0, p1;
+		quantizeBc7Endpoint(a, q0, p0);
+		quantizeBc7Endpoint(b, q1, p1);
+		int palette[16][4];
+		int indices[16];
+		bc7Palette(q0, p0, q1, p1, palette);
+		float error = assignIndices(block, palette, bc7Order, 16, 4, indices);
+		if(bestError < 0.f || error < bestError) {
+			bestError = error;
+			memcpy(best0, q0, sizeof(q0));
+			memcpy(best1, q1, sizeof(q1));
+			bestP0 = p0;
+			bestP1 = p1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+
+		float weights[16];
+		for(int i = 0; i < 16; i++) weights[i] = bc7Weights[indices[i]] / 64.f;
+		if(!fitEndpoints(block, weights, 4, a, b)) break;
+	}
+
+	// The first index is stored without its top bit, so it has to be below 8
+	if(bestIndices[0] >= 8) {
+		for(int c = 0; c < 4; c++) std::swap(best0[c], best1[c]);
+		std::swap(bestP0, bestP1);
+		for(int i = 0; i < 16; i++) bestIndices[i] = 15 - bestIndices[i];
+	}
+
+	BlockBits bits = {0, 0, 0};
+	putBits(bits, 1 << 6, 7);
+	for(int c = 0; c < 4; c++) {
+		putBits(bits, best0[c], 7);
+		putBits(bits, best1[c], 7);
+	}
+	putBits(bits, bestP0, 1);
+	putBits(bits, bestP1, 1);
+	putBits(bits, bestIndices[0], 3);
+	for(int i = 1; i < 16; i++) putBits(bits, bestIndices[i], 4);
+	for(int i = 0; i < 8; i++) {
+		out[i] = (unsigned char) (bits.lo >> (8 * i));
+		out[8 + i] = (unsigned char) (bits.hi >> (8 * i));
+	}
+}
+
+static void decodeBc1Block(const unsigned char* in, int pixels[16][4])
+{
+	int palette[4][4];
+	unsigned short c0 = (unsigned short) (in[0] | (in[1] << 8));
+	unsigned short c1 = (unsigned short) (in[2] | (in[3] << 8));
+	bc1Palette(c0, c1, palette);
+	uint32_t bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t) in[7] << 24);
+	for(int i = 0; i < 16; i++) memcpy(pixels[i], palette[(bits >> (2 * i)) & 3], sizeof(pixels[i]));
+}
+
+static void decodeAlphaBlock(const unsigned char* in, int pixels[16][4])
+{
+	int values[8];
+	int a0 = in[0], a1 = in[1];
+	values[0] = a0;
+	values[1] = a1;
+	if(a0 > a1) {
+		for(int i = 2; i < 8; i++) values[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	} else {
+		for(int i = 2; i < 6; i++) values[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		values[6] = 0;
+		values[7] = 255;
+	}
+	uint64_t bits = 0;
+	for(int i = 0; i < 6; i++) bits |= (uint64_t) in[2 + i] << (8 * i);
+	for(int i = 0; i < 16; i++) pixels[i][3] = values[(bits >> (3 * i)) & 7];
+}
+
+static void decodeBc7Block(const unsigned char* in, int pixels[16][4])
+{
+	BlockBits bits = {0, 0, 0};
+	for(int i = 0; i < 8; i++) {
+		bits.lo |= (uint64_t) in[i] << (8 * i);
+		bits.hi |= (uint64_t) in[8 + i] << (8 * i);
+	}
+	if(getBits(bits, 7) != (1 << 6)) {
+		// Only mode 6 is ever written, anything else decodes to transparent black like a reserved mode
+		memset(pixels, 0, sizeof(int) * 16 * 4);
+		return;
+	}
+	int q0[4], q1[4];
+	for(int c = 0; c < 4; c++) {
+		q0[c] = getBits(bits, 7);
+		q1[c] = getBits(bits, 7);
+	}
+	int p0 = getBits(bits, 1), p1 = getBits(bits, 1);
+	int palette[16][4];
+	bc7Palette(q0, p0, q1, p1, palette);
+	for(int i = 0; i < 16; i++) memcpy(pixels[i], palette[getBits(bits, i == 0 ? 3 : 4)], sizeof(pixels[i]));
+}
+
+static void compressLevel(const unsigned char* pixels, unsigned width, unsigned height, unsigned bpp, unsigned compression,
+		unsigned char* out, ThreadPool* threadPool)
+{
+	unsigned blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	size_t bytes = blockBytes(compression);
+	std::function<void(size_t)> compressRow = [&](size_t by) {
+		for(unsigned bx = 0; bx < blocksX; bx++) {
+			float block[16][4];
+			loadBlock(pixels, width, height, bpp, bx, (unsigned) by, block);
+			unsigned char* blockOut = out + (by * blocksX + bx) * bytes;
+			if(compression == TEXTURE_COMPRESSION_BC1) {
+				encodeBc1Block(block, blockOut);
+			} else if(compression == TEXTURE_COMPRESSION_BC3) {
+				encodeAlphaBlock(block, blockOut);
+				encodeBc1Block(block, blockOut + 8);
+			} else {
+				encodeBc7Block(block, blockOut);
+			}
+		}
+	};
+	if(threadPool) {
+		threadPool->parallelFor(blocksY, compressRow);
+	} else {
+		for(unsigned by = 0; by < blocksY; by++) compressRow(by);
+	}
+}
+
+void compressTexture(const Texture& texture, unsigned compression, ThreadPool* threadPool, Texture& compressed,
+		std::vector<unsigned char>& data)
+{
+	compressed = texture;
+	compressed.compression = compression;
+	data.resize(textureDataSize(compressed));
+	compressed.data = &data[0];
+	const unsigned char* in = texture.data;
+	unsigned char* out = compressed.data;
+	for(unsigned i = 0; i < texture.levels; i++) {
+		compressLevel(in, std::max(texture.width >> i, 1u), std::max(texture.height >> i, 1u), texture.bpp, compression, out,
+				threadPool);
+		in += textureLevelSize(texture, i);
+		out += textureLevelSize(compressed, i);
+	}
+}
+
+void decompressLevel(const Texture& texture, unsigned level, unsigned char* pixels)
+{
+	const unsigned char* in = texture.data;
+	for(unsigned i = 0; i < level; i++) in += textureLevelSize(texture, i);
+	unsigned width = std::max(texture.width >> level, 1u), height = std::max(texture.height >> level, 1u);
+	if(texture.compression == TEXTURE_COMPRESSION_NONE) {
+		memcpy(pixels, in, textureLevelSize(texture, level));
+		return;
+	}
+
+	unsigned blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	size_t bytes = blockBytes(texture.compression);
+	for(unsigned by = 0; by < blocksY; by++) {
+		for(unsigned bx = 0; bx < blocksX; bx++) {
+			const unsigned char* block = in + ((size_t) by * blocksX + bx) * bytes;
+			int decoded[16][4];
+			if(texture.compression == TEXTURE_COMPRESSION_BC1) {
+				decodeBc1Block(block, decoded);
+			} else if(texture.compression == TEXTURE_COMPRESSION_BC3) {
+				decodeBc1Block(block + 8, decoded);
+				decodeAlphaBlock(block, decoded);
+			} else {
+				decodeBc7Block(block, decoded);
+			}
+			// Pixels of edge blocks outside the image are dropped
+			for(unsigned y = 0; y < 4 && by * 4 + y < height; y++) {
+				for(unsigned x = 0; x < 4 && bx * 4 + x < width; x++) {
+					unsigned char* p = pixels + ((size_t) (by * 4 + y) * width + bx * 4 + x) * texture.bpp;
+					for(unsigned c = 0; c < texture.bpp; c++) p[c] = (unsigned char) decoded[y * 4 + x][c];
+				}
+			}
+		}
+	}
+}
+
+void decompressTexture(const Texture& texture, std::vector<unsigned char>& pixels)
+{
+	Texture raw = texture;
+	raw.compression = TEXTURE_COMPRESSION_NONE;
+	pixels.resize(textureDataSize(raw));
+	size_t offset = 0;
+	for(unsigned i = 0; i < texture.levels; i++) {
+		decompressLevel(texture, i, &pixels[offset]);
+		offset += textureLevelSize(raw, i);
+	}
+}
+
+double computePsnr(const unsigned char* a, const unsigned char* b, size_t size)
+{
+	double squaredError = 0.0;
+	for(size_t i = 0; i < size; i++) squaredError += (double) (a[i] - b[i]) * (a[i] - b[i]);
+	if(squaredError == 0.0 || size == 0) return 99.0;
+	double mse = squaredError / (double) size;
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,61 @@
+#include "Common.h"
+#include "TextureRegistry.h"
+
+TextureRegistry::~TextureRegistry()
+{
+	for(std::map<GLuint, unsigned>::iterator it = references.begin(); it != references.end(); ++it) {
+		glDeleteTextures(1, &it->first);
+	}
+}
+
+bool TextureRegistry::acquire(const std::string& fileName, GLuint* textureId)
+{
+	std::map<std::string, GLuint>::iterator it = ids.find(fileName);
+	if(it == ids.end()) return false;
+	references[it->second]++;
+	*textureId = it->second;
+	return true;
+}
+
+void TextureRegistry::add(const std::string& fileName, GLuint textureId)
+{
+	if(textureId == 0) return;
+	ids[fileName] = textureId;
+	if(references.find(textureId) == references.end()) references[textureId] = 1;
+}
+
+bool TextureRegistry::contains(const std::string& fileName)
+{
+	return ids.find(fileName) != ids.end();
+}
+
+bool TextureRegistry::release(GLuint textureId)
+{
+	if(textureId == 0) return false;
+	std::map<GLuint, unsigned>::iterator it = references.find(textureId);
+	if(it == references.end()) {
+		glDeleteTextures(1, &textureId);
+		return true;
+	}
+	if(--it->second > 0) return false;
+
+	references.erase(it);
+	glDeleteTextures(1, &textureId);
+	for(std::map<std::string, GLuint>::iterator id = ids.begin(); id != ids.end();) {
+		if(id->second == textureId) ids.erase(id++);
+		else ++id;
+	}
+	return true;
+}
+
+size_t TextureRegistry::getNumTextures()
+{
+	return references.size();
+}
+
+size_t TextureRegistry::getNumReferences()
+{
+	size_t count = 0;
+	for(std::map<GLuint, unsigned>::iterator it = references.begin(); it != references.end(); ++it) count += it->second;
+	return count;
+}
@@ -0,0 +1,197 @@
+#include "Common.h"
+#include "TextureCompression.h"
+#include "TextureResidency.h"
+
+#include <cmath>
+
+TextureResidency::TextureResidency(TextureStreamer* _streamer, size_t _budget)
+{
+	streamer = _streamer;
+	budget = _budget;
+	residentBytes = 0;
+	frame = 1;
+	evictions = loads = 0;
+}
+
+size_t TextureResidency::levelBytes(ResidentTexture& texture, unsigned level)
+{
+	return textureLevelSize(texture.layers[0], level) * texture.layers.size();
+}
+
+// Allocate a level's storage, or free it with an empty image
+static void specifyLevel(GLuint textureId, const Texture& format, unsigned level, GLsizei layers, bool allocate)
+{
+	GLsizei width = allocate ? std::max(format.width >> level, 1u) : 0;
+	GLsizei height = allocate ? std::max(format.height >> level, 1u) : 0;
+	GLsizei depth = allocate ? layers : 0;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+	if(format.compression != TEXTURE_COMPRESSION_NONE) {
+		GLsizei size = allocate ? (GLsizei) (textureLevelSize(format, level) * layers) : 0;
+		glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, compressionInternalFormat(format.compression), width, height,
+				depth, 0, size, NULL);
+	} else {
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format.mode, width, height, depth, 0, format.mode, GL_UNSIGNED_BYTE, NULL);
+	}
+}
+
+void TextureResidency::addTexture(GLuint textureId, const std::vector<Texture>& layers,
+		std::vector<std::vector<unsigned char> >& pixels)
+{
+	ResidentTexture& texture = textures[textureId];
+	texture.layers = layers;
+	texture.pixels.swap(pixels);
+	texture.baseLevel = texture.layers[0].levels;
+	texture.wantedLevel = texture.layers[0].levels - 1;
+	texture.footprint = 0.f;
+	texture.lastVisibleFrame = 0;
+
+	// The smallest level is loaded right away so the texture can be drawn
+	unsigned level = texture.layers[0].levels - 1;
+	specifyLevel(textureId, texture.layers[0], level, (GLsizei) texture.layers.size(), true);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	for(size_t i = 0; i < texture.layers.size(); i++) streamer->queueLevel(textureId, (GLuint) i, level, texture.layers[i]);
+	texture.loadingLevel = level;
+	residentBytes += levelBytes(texture, level);
+	loads++;
+}
+
+void TextureResidency::removeTexture(GLuint textureId)
+{
+	std::map<GLuint, ResidentTexture>::iterator it = textures.find(textureId);
+	if(it == textures.end()) return;
+	ResidentTexture& texture = it->second;
+	for(unsigned i = std::min(texture.baseLevel, texture.loadingLevel); i < texture.layers[0].levels; i++) {
+		residentBytes -= levelBytes(texture, i);
+	}
+	textures.erase(it);
+}
+
+bool TextureResidency::isDrawable(GLuint textureId)
+{
+	std::map<GLuint, ResidentTexture>::iterator it = textures.find(textureId);
+	return it == textures.end() || it->second.baseLevel < it->second.layers[0].levels;
+}
+
+void TextureResidency::markVisible(GLuint textureId, float footprint)
+{
+	std::map<GLuint, ResidentTexture>::iterator it = textures.find(textureId);
+	if(it == textures.end()) return;
+	ResidentTexture& texture = it->second;
+	if(texture.lastVisibleFrame != frame) {
+		texture.lastVisibleFrame = frame;
+		texture.footprint = 0.f;
+	}
+	if(footprint <= texture.footprint) return;
+	texture.footprint = footprint;
+
+	// Level whose size is closest to the footprint without being smaller
+	const Texture& format = texture.layers[0];
+	float ratio = (float) std::max(format.width, format.height) / std::max(footprint, 1.f);
+	int level = ratio > 1.f ? (int) floorf(log2f(ratio)) : 0;
+	texture.wantedLevel = (unsigned) std::min(level, (int) format.levels - 1);
+}
+
+// Bytes evictLevel can free from a texture, visible textures keep the levels they need
+size_t TextureResidency::evictableBytes(ResidentTexture& texture)
+{
+	size_t bytes = 0;
+	if(texture.loadingLevel != texture.baseLevel) return 0;
+	unsigned keep = texture.layers[0].levels - 1;
+	if(texture.lastVisibleFrame == frame) keep = std::min(keep, texture.wantedLevel);
+	for(unsigned i = texture.baseLevel; i < keep; i++) bytes += levelBytes(texture, i);
+	return bytes;
+}
+
+// Drop the finest level of a texture, the smallest level and textures with a level loading are kept
+bool TextureResidency::evictLevel(GLuint textureId)
+{
+	ResidentTexture& texture = textures[textureId];
+	if(evictableBytes(texture) == 0) return false;
+	unsigned level = texture.baseLevel++;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, texture.baseLevel);
+	specifyLevel(textureId, texture.layers[0], level, (GLsizei) texture.layers.size(), false);
+	texture.loadingLevel = texture.baseLevel;
+	residentBytes -= levelBytes(texture, level);
+	evictions++;
+	return true;
+}
+
+void TextureResidency::update()
+{
+	// Levels the streamer finished are sampled from now on
+	wanted.clear(); // missing levels and texture of visible textures needing more detail
+	for(std::map<GLuint, ResidentTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+		ResidentTexture& texture = it->second;
+		if(texture.loadingLevel < texture.baseLevel && !streamer->isUploading(it->first)) {
+			texture.baseLevel = texture.loadingLevel;
+			glBindTexture(GL_TEXTURE_2D_ARRAY, it->first);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, texture.baseLevel);
+		}
+		if(texture.lastVisibleFrame == frame && texture.loadingLevel == texture.baseLevel
+				&& texture.wantedLevel < texture.baseLevel) {
+			wanted.push_back(std::make_pair((int) texture.baseLevel - (int) texture.wantedLevel, it->first));
+		}
+	}
+
+	// Least recently visible textures lose levels first, then visible ones with more detail than they need
+	victims.clear();
+	for(std::map<GLuint, ResidentTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+		victims.push_back(std::make_pair(it->second.lastVisibleFrame, it->first));
+	}
+	std::sort(victims.begin(), victims.end());
+	size_t victim = 0;
+	while(budget > 0 && residentBytes > budget && victim < victims.size()) {
+		if(!evictLevel(victims[victim].second)) victim++;
+	}
+
+	// Load one more level of the textures furthest from their wanted detail, making room if there is a budget
+	std::sort(wanted.rbegin(), wanted.rend());
+	for(size_t i = 0; i < wanted.size(); i++) {
+		GLuint textureId = wanted[i].second;
+		ResidentTexture& texture = textures[textureId];
+		unsigned level = texture.baseLevel - 1;
+		size_t bytes = levelBytes(texture, level);
+		// Only evict if that makes enough room
+		if(budget > 0 && residentBytes + bytes > budget) {
+			size_t evictable = 0;
+			for(size_t v = victim; v < victims.size(); v++) {
+				if(victims[v].second != textureId) evictable += evictableBytes(textures[victims[v].second]);
+			}
+			if(residentBytes + bytes > budget + evictable) continue;
+		}
+		while(budget > 0 && residentBytes + bytes > budget && victim < victims.size()) {
+			if(victims[victim].second == textureId || !evictLevel(victims[victim].second)) victim++;
+		}
+
+		specifyLevel(textureId, texture.layers[0], level, (GLsizei) texture.layers.size(), true);
+		for(size_t l = 0; l < texture.layers.size(); l++) streamer->queueLevel(textureId, (GLuint) l, level, texture.layers[l]);
+		texture.loadingLevel = level;
+		residentBytes += bytes;
+		loads++;
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	frame++;
+}
+
+size_t TextureResidency::getResidentBytes()
+{
+	return residentBytes;
+}
+
+size_t TextureResidency::getEvictions()
+{
+	return evictions;
+}
+
+void TextureResidency::printStats(std::ostream& os)
+{
+	size_t full = 0;
+	for(std::map<GLuint, ResidentTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+		if(it->second.baseLevel == 0) full++;
+	}
+	os << "textures at full resolution: " << full << "/" << textures.size() << ", VRAM: "
+			<< residentBytes / (1024.0 * 1024.0) << " MB";
+	if(budget > 0) os << " of " << budget / (1024.0 * 1024.0) << " MB";
+	os << ", " << loads << " levels loaded and " << evictions << " evicted so far" << std::endl;
+}
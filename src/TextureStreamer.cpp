@@ -0,0 +1,178 @@
+#include "Common.h"
+#include "TextureCompression.h"
+#include "TextureStreamer.h"
+
+// Frames of uploads the GPU may still be reading when a new one starts
+#define TEXTURE_UPLOAD_BUFFERS 3
+
+TextureStreamer::TextureStreamer(size_t _byteBudget, double _timeBudget)
+{
+	byteBudget = std::max(_byteBudget, (size_t) 1);
+	timeBudget = _timeBudget;
+	bytesUploaded = levelsUploaded = framesUploading = 0;
+	maxFrameSeconds = 0.0;
+
+	buffers.resize(TEXTURE_UPLOAD_BUFFERS);
+	for(size_t i = 0; i < buffers.size(); i++) {
+		glGenBuffers(1, &buffers[i].pbo);
+		buffers[i].fence = 0;
+	}
+
+	unsigned char grey[4] = {128, 128, 128, 255};
+	glGenTextures(1, &placeholder);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, placeholder);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	for(size_t i = 0; i < buffers.size(); i++) {
+		if(buffers[i].fence) glDeleteSync(buffers[i].fence);
+		glDeleteBuffers(1, &buffers[i].pbo);
+	}
+	glDeleteTextures(1, &placeholder);
+}
+
+void TextureStreamer::queueLevel(GLuint texture, GLuint layer, unsigned level, const Texture& source)
+{
+	const unsigned char* data = source.data;
+	for(unsigned i = 0; i < level; i++) data += textureLevelSize(source, i);
+	TextureUpload upload;
+	upload.texture = texture;
+	upload.layer = layer;
+	upload.level = level;
+	upload.width = std::max(source.width >> level, 1u);
+	upload.height = std::max(source.height >> level, 1u);
+	upload.compressed = source.compression != TEXTURE_COMPRESSION_NONE;
+	upload.format = upload.compressed ? compressionInternalFormat(source.compression) : (GLenum) source.mode;
+	upload.rowHeight = upload.compressed ? 4 : 1;
+	upload.rows = (upload.height + upload.rowHeight - 1) / upload.rowHeight;
+	upload.rowBytes = textureLevelSize(source, level) / upload.rows;
+	upload.nextRow = 0;
+	upload.data = data;
+	queue.push_back(upload);
+	pendingLevels[texture]++;
+}
+
+void TextureStreamer::cancel(GLuint texture)
+{
+	for(std::deque<TextureUpload>::iterator it = queue.begin(); it != queue.end();) {
+		if(it->texture == texture) it = queue.erase(it);
+		else ++it;
+	}
+	pendingLevels.erase(texture);
+	// The name can be reused by a new texture before the buffers holding its last uploads are retired
+	for(size_t i = 0; i < buffers.size(); i++) {
+		std::vector<GLuint>& done = buffers[i].levelsDone;
+		done.erase(std::remove(done.begin(), done.end(), texture), done.end());
+	}
+}
+
+void TextureStreamer::update()
+{
+	// Levels of buffers the GPU has finished reading are resident, polled without waiting
+	TextureUploadBuffer* free = 0;
+	for(size_t i = 0; i < buffers.size(); i++) {
+		TextureUploadBuffer& buffer = buffers[i];
+		if(buffer.fence) {
+			GLenum status = glClientWaitSync(buffer.fence, 0, 0);
+			if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+			glDeleteSync(buffer.fence);
+			buffer.fence = 0;
+			for(size_t l = 0; l < buffer.levelsDone.size(); l++) {
+				std::map<GLuint, unsigned>::iterator pending = pendingLevels.find(buffer.levelsDone[l]);
+				if(pending != pendingLevels.end() && --pending->second == 0) pendingLevels.erase(pending);
+				levelsUploaded++;
+			}
+			buffer.levelsDone.clear();
+		}
+		if(!free) free = &buffer;
+	}
+	if(queue.empty()) return;
+	// Every buffer is still being read, uploading now would stall
+	if(!free) return;
+
+	// Copy whole rows of the queued levels into the buffer until a budget runs out, at least one row per frame
+	Uint64 start = SDL_GetPerformanceCounter();
+	size_t capacity = std::max(byteBudget, queue.front().rowBytes);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, free->pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+	unsigned char* mapped = (unsigned char*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(!mapped) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+	// Rows copied this frame, data is the offset into the buffer
+	chunks.clear();
+	size_t bytes = 0;
+	while(!queue.empty()) {
+		TextureUpload& upload = queue.front();
+		unsigned rows = std::min(upload.rows - upload.nextRow, (unsigned) ((capacity - bytes) / upload.rowBytes));
+		if(rows == 0) break;
+		memcpy(mapped + bytes, upload.data + upload.rowBytes * upload.nextRow, upload.rowBytes * rows);
+		TextureUpload chunk = upload;
+		chunk.rows = rows;
+		chunk.data = (const unsigned char*) bytes;
+		chunks.push_back(chunk);
+		bytes += upload.rowBytes * rows;
+		upload.nextRow += rows;
+		if(upload.nextRow == upload.rows) {
+			free->levelsDone.push_back(upload.texture);
+			queue.pop_front();
+		}
+		if((double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() >= timeBudget) break;
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// Levels are tightly packed, rows of RGB levels aren't 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	GLuint bound = 0;
+	for(size_t i = 0; i < chunks.size(); i++) {
+		TextureUpload& chunk = chunks[i];
+		if(chunk.texture != bound) {
+			bound = chunk.texture;
+			glBindTexture(GL_TEXTURE_2D_ARRAY, bound);
+		}
+		unsigned y = chunk.nextRow * chunk.rowHeight;
+		unsigned height = std::min(chunk.rows * chunk.rowHeight, chunk.height - y);
+		if(chunk.compressed) {
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, chunk.level, 0, y, chunk.layer, chunk.width, height, 1,
+					chunk.format, (GLsizei) (chunk.rowBytes * chunk.rows), chunk.data);
+		} else {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, chunk.level, 0, y, chunk.layer, chunk.width, height, 1, chunk.format,
+					GL_UNSIGNED_BYTE, chunk.data);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	free->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	bytesUploaded += bytes;
+	framesUploading++;
+	maxFrameSeconds = std::max(maxFrameSeconds, (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency());
+}
+
+bool TextureStreamer::isUploading(GLuint texture)
+{
+	return pendingLevels.find(texture) != pendingLevels.end();
+}
+
+GLuint TextureStreamer::getPlaceholder()
+{
+	return placeholder;
+}
+
+void TextureStreamer::printStats(std::ostream& os)
+{
+	if(framesUploading == 0 && pendingLevels.empty()) return;
+	os << "textures streamed: " << levelsUploaded << " layer levels, " << bytesUploaded / (1024.0 * 1024.0) << " MB in "
+			<< framesUploading << " frames, max " << 1000.0 * maxFrameSeconds << " ms per frame, "
+			<< queue.size() << " layer levels waiting" << std::endl;
+	bytesUploaded = levelsUploaded = framesUploading = 0;
+	maxFrameSeconds = 0.0;
+}
@@ -0,0 +1,118 @@
+#include "Common.h"
+#include "ThreadPool.h"
+
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned numThreads)
+{
+	if(numThreads == 0) numThreads = (unsigned) std::max(SDL_GetCPUCount(), 1);
+	stopping = false;
+	mutex = SDL_CreateMutex();
+	taskAvailable = SDL_CreateCond();
+	for(unsigned i = 0; i < numThreads; i++) {
+		SDL_Thread* thread = SDL_CreateThread(workerMain, "WorkerThread", (void*)this);
+		if(!thread) {
+			std::cerr << "Unable to create worker thread: " << SDL_GetError() << std::endl;
+			break;
+		}
+		threads.push_back(thread);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	SDL_LockMutex(mutex);
+	stopping = true;
+	SDL_CondBroadcast(taskAvailable);
+	SDL_UnlockMutex(mutex);
+
+	for(size_t i = 0; i < threads.size(); i++) {
+		SDL_WaitThread(threads[i], NULL);
+	}
+	SDL_DestroyCond(taskAvailable);
+	SDL_DestroyMutex(mutex);
+}
+
+// One parallelFor, owned by the caller and every helper task it queued. A helper that starts after the call
+// returned finds no indices left and drops its reference without calling fn.
+struct ParallelForState
+{
+	ParallelForState(size_t count, const std::function<void(size_t)>& fn) : count(count), fn(fn)
+	{
+		SDL_AtomicSet(&next, 0);
+		SDL_AtomicSet(&finished, 0);
+		done = SDL_CreateSemaphore(0);
+	}
+	~ParallelForState()
+	{
+		SDL_DestroySemaphore(done);
+	}
+	void run()
+	{
+		for(int i = SDL_AtomicAdd(&next, 1); (size_t) i < count; i = SDL_AtomicAdd(&next, 1)) {
+			fn((size_t) i);
+			if((size_t) SDL_AtomicAdd(&finished, 1) + 1 == count) SDL_SemPost(done);
+		}
+	}
+
+	SDL_atomic_t next;
+	SDL_atomic_t finished;
+	size_t count;
+	const std::function<void(size_t)>& fn;
+	// Posted when the last index finished
+	SDL_sem* done;
+};
+
+int ThreadPool::workerMain(void* poolPtr)
+{
+	ThreadPool* pool = (ThreadPool*) poolPtr;
+	for(;;) {
+		SDL_LockMutex(pool->mutex);
+		while(pool->tasks.empty() && !pool->stopping) {
+			SDL_CondWait(pool->taskAvailable, pool->mutex);
+		}
+		if(pool->tasks.empty()) {
+			// stopping and nothing left to run
+			SDL_UnlockMutex(pool->mutex);
+			return 0;
+		}
+		std::function<void()> task = pool->tasks.front();
+		pool->tasks.pop_front();
+		SDL_UnlockMutex(pool->mutex);
+
+		task();
+	}
+}
+
+void ThreadPool::enqueue(const std::function<void()>& task)
+{
+	if(threads.empty()) {
+		task();
+		return;
+	}
+	SDL_LockMutex(mutex);
+	tasks.push_back(task);
+	SDL_CondSignal(taskAvailable);
+	SDL_UnlockMutex(mutex);
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+	if(count == 0) return;
+
+	// Workers and the caller pull indices from a shared counter until it runs past count
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>(count, fn);
+	size_t numHelpers = std::min((size_t) threads.size(), count - 1);
+	for(size_t i = 0; i < numHelpers; i++) {
+		enqueue([state]() { state->run(); });
+	}
+	state->run();
+
+	// Only indices still running on helpers are waited for, helpers queued behind other tasks find none left
+	SDL_SemWait(state->done);
+}
+
+unsigned ThreadPool::getNumThreads()
+{
+	return (unsigned) threads.size();
+}
@@ -2,6 +2,15 @@
 #include "SceneNode.h"
 #include "Renderer.h"
 
+// The number parser test places numbers in front of an unmapped page
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 class MyGLApp
 {
 public:
@@ -251,6 +260,14 @@ void MyGLApp::keyDown(SDL_Keycode& key)
 	case SDLK_g:
 		windowGrab = windowGrab ? false : true;
 		break;
+	case SDLK_i:
+		renderer.multiDrawIndirect = !renderer.multiDrawIndirect;
+		std::cout << "multi draw indirect " << (renderer.multiDrawIndirect ? "on" : "off") << std::endl;
+		break;
+	case SDLK_b:
+		renderer.bvhCulling = !renderer.bvhCulling;
+		std::cout << "bounding volume hierarchy culling " << (renderer.bvhCulling ? "on" : "off") << std::endl;
+		break;
 	case SDLK_h:
 		showCursor = showCursor ? false : true;
 		if(showCursor) {
@@ -289,6 +306,10 @@ void MyGLApp::start()
 
 	bool sceneFinishedLoading = false;
 	bool closeOnLoad = configLoader->getBool("closeOnLoad");
+	bool verbose = renderer.configLoader->getBool("renderer.verbose");
+	Uint32 lastStatsTime = SDL_GetTicks();
+	bool reloadModels = renderer.configLoader->getBool("renderer.reloadChangedModels");
+	Uint32 lastReloadCheckTime = SDL_GetTicks();
 
 	/* Get mouse position */
 	while (runLevel > 0)
@@ -394,6 +415,28 @@ void MyGLApp::start()
 			}
 		} else if(sceneFinishedLoading) {
 			renderer.render(camera);
+
+			// Print culling stats for one frame per second
+			if(verbose && SDL_GetTicks() - lastStatsTime >= 1000) {
+				lastStatsTime = SDL_GetTicks();
+				std::cout << "triangles drawn: " << renderer.trianglesDrawn << ", culled: " << renderer.trianglesCulled;
+				if(renderer.bvhCulling) std::cout << ", bvh nodes visited: " << renderer.bvhNodesVisited;
+				std::cout << std::endl;
+				std::cout << "draws: " << renderer.renderStats.draws << " in " << renderer.renderStats.drawCalls
+						<< (renderer.multiDrawIndirect && GLAD_GL_VERSION_4_3 ? " indirect" : "") << " draw calls, submitted in "
+						<< 1000.0 * renderer.renderStats.submitSeconds << " ms, state changes: " << renderer.renderStats.passes
+						<< " passes, " << renderer.renderStats.programs << " programs, " << renderer.renderStats.textures
+						<< " textures, " << renderer.renderStats.layers << " layers" << std::endl;
+				if(renderer.scenePager) renderer.scenePager->printStats(std::cout);
+				if(renderer.textureStreamer) renderer.textureStreamer->printStats(std::cout);
+				if(renderer.textureResidency) renderer.textureResidency->printStats(std::cout);
+			}
+
+			// Pick up edits to the models while the scene is shown
+			if(reloadModels && SDL_GetTicks() - lastReloadCheckTime >= 1000) {
+				lastReloadCheckTime = SDL_GetTicks();
+				renderer.reloadChangedModels();
+			}
 		}
 
 		SDL_GL_SwapWindow(window);
@@ -412,12 +455,320 @@ void MyGLApp::start()
 	}
 }
 
+// Time culling random spheres one node at a time against batch culling and a hierarchy over the same spheres.
+// Node records are reused past 100k so a million of them doesn't need gigabytes, the SoA arrays are full size.
+static void benchmarkCulling()
+{
+	const size_t nodePool = 100000;
+	const size_t sizes[] = {10000, 100000, 1000000};
+	glm::mat4 projection = glm::perspective(45.0f, 16.0f / 9.0f, 0.1f, 10000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+	Frustum frustum;
+	frustum.extractFrustum(view, projection);
+
+	srand(1);
+	std::vector<SceneNode> nodes(nodePool);
+	for(size_t i = 0; i < nodePool; i++) {
+		nodes[i].lx = (float) (rand() % 20000 - 10000) / 10.f;
+		nodes[i].ly = (float) (rand() % 20000 - 10000) / 10.f;
+		nodes[i].lz = (float) (rand() % 20000 - 10000) / 10.f;
+		nodes[i].boundingSphere = 0.5f + (float) (rand() % 100) / 20.f;
+	}
+
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t count = sizes[s];
+		SphereBounds bounds;
+		bounds.x.resize(count);
+		bounds.y.resize(count);
+		bounds.z.resize(count);
+		bounds.radius.resize(count);
+		for(size_t i = 0; i < count; i++) {
+			SceneNode& node = nodes[i % nodePool];
+			bounds.x[i] = node.lx;
+			bounds.y[i] = node.ly;
+			bounds.z[i] = node.lz;
+			bounds.radius[i] = node.boundingSphere;
+		}
+		std::vector<uint32_t> visible(count);
+		// Enough repetitions for about ten million sphere tests per method
+		size_t repeats = std::max((size_t) 1, (size_t) 10000000 / count);
+
+		size_t perNodeVisible = 0;
+		Uint64 start = SDL_GetPerformanceCounter();
+		for(size_t r = 0; r < repeats; r++) {
+			perNodeVisible = 0;
+			for(size_t i = 0; i < count; i++) {
+				SceneNode& node = nodes[i % nodePool];
+				if(frustum.spherePartiallyInFrustum(node.lx, node.ly, node.lz, node.boundingSphere) > 0) {
+					visible[perNodeVisible++] = (uint32_t) i;
+				}
+			}
+		}
+		double perNodeSeconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / repeats;
+
+		size_t batchVisible = 0;
+		start = SDL_GetPerformanceCounter();
+		for(size_t r = 0; r < repeats; r++) batchVisible = frustum.spheresPartiallyInFrustum(bounds, &visible[0]);
+		double batchSeconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / repeats;
+
+		BoundingVolumeHierarchy hierarchy;
+		start = SDL_GetPerformanceCounter();
+		hierarchy.build(bounds);
+		double buildSeconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+		size_t hierarchyVisible = 0;
+		start = SDL_GetPerformanceCounter();
+		for(size_t r = 0; r < repeats; r++) hierarchyVisible = hierarchy.cull(frustum, bounds, &visible[0]);
+		double hierarchySeconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / repeats;
+
+		std::cout << count << " nodes, " << batchVisible << " visible: per node " << 1000.0 * perNodeSeconds << " ms, batch "
+				<< 1000.0 * batchSeconds << " ms, " << perNodeSeconds / batchSeconds << "x faster, bvh "
+				<< 1000.0 * hierarchySeconds << " ms visiting " << hierarchy.getNodesVisited() << " of "
+				<< hierarchy.getNodes().size() << " boxes, built in " << 1000.0 * buildSeconds << " ms" << std::endl;
+		if(perNodeVisible != batchVisible) {
+			std::cerr << "Batch culling found " << batchVisible << " visible nodes, per node culling " << perNodeVisible << std::endl;
+		}
+		if(hierarchyVisible != perNodeVisible) {
+			std::cerr << "Hierarchy culling found " << hierarchyVisible << " visible nodes, per node culling " << perNodeVisible << std::endl;
+		}
+	}
+}
+
+// Compare the .obj number parser to (float)strtod bit for bit, its end pointer must be right past the number.
+// Mismatches are counted, the first few are printed.
+static void checkParsedNumber(const char* token, bool padded, size_t& failures)
+{
+	const char* end;
+	float parsed = tinyobj::ParseFloat(token, &end, padded);
+	char* expectedEnd;
+	float expected = (float) strtod(token, &expectedEnd);
+	if(memcmp(&parsed, &expected, sizeof(float)) == 0 && end == expectedEnd) return;
+	if(failures < 20) {
+		std::cerr << "Parsed " << std::string(token, strcspn(token, " \n")) << (padded ? "" : " unpadded") << " as "
+				<< parsed << " ending at " << end - token << ", strtod gives " << expected << " ending at "
+				<< expectedEnd - token << std::endl;
+	}
+	failures++;
+}
+
+// Parse a line of .obj data in a heap buffer of its exact size with the memory and stream loaders, where it is not
+// padded, and check the vertex they read
+static void checkLoadedNumber(const char* number, size_t& failures)
+{
+	std::string line = std::string("v ") + number + " 0 0\nf 1 1 1\n";
+	char* buffer = new char[line.size()];
+	memcpy(buffer, line.data(), line.size());
+	float expected = (float) strtod(number, NULL);
+	for(int stream = 0; stream < 2; stream++) {
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t> materials;
+		std::string err;
+		tinyobj::MaterialFileReader materialReader("");
+		bool loaded;
+		if(stream) {
+			std::istringstream objStream(line);
+			loaded = tinyobj::LoadObj(shapes, materials, err, objStream, materialReader, true, false);
+		} else {
+			loaded = tinyobj::LoadObjFromMemory(shapes, materials, err, buffer, line.size(), materialReader, true, false);
+		}
+		if(loaded && shapes.size() == 1 && memcmp(&shapes[0].mesh.positions[0], &expected, sizeof(float)) == 0) continue;
+		if(failures < 20) std::cerr << "Loaded " << number << (stream ? " from a stream" : " from memory") << " wrong" << std::endl;
+		failures++;
+	}
+	delete[] buffer;
+}
+
+// Accuracy suite of the SIMD number parser of the .obj loader: random decimals, the edges of the exact fast path
+// for up to 19 digit mantissas below 2^53 with exponents in [-22, 22], numbers ending right before an unmapped
+// page, where its vector loads must not cross over, and numbers at both ends of unpadded heap buffers, which it must
+// not read outside of. Build with -fsanitize=address for the last check to catch anything.
+// Returns the number of mismatches.
+static size_t testNumberParser()
+{
+	const char* edges[] = {
+		"0", "-0", "0.0", "-0.0", "000000000000000000001", "0.5", "0.1", "-0.1", "0.30000000000000004",
+		"16777216", "16777217", "16777216.5", "16777218.999999999",
+		"9007199254740991", "9007199254740992", "9007199254740993", "9007199254740994",
+		"900719925474099.3", "9.007199254740993", "4.5035996273704955e15",
+		"1234567890123456", "12345678901234567", "123456789012345678", "1234567890123456789",
+		"12345678901234567890", "1.2345678901234567890123",
+		"1e22", "1e23", "1e-22", "1e-23", "1E+22", "1e+023", "9007199254740991e22", "9007199254740991e-22",
+		"9007199254740992e22", "9007199254740993e-22", "0.0000000000000000000001", "1.00000000000000000000001",
+		"3.4028234e38", "3.4028235e38", "3.4028236e38", "1e39", "1.17549435e-38", "1.4e-45", "7e-46", "1e-50",
+		"2.2250738585072014e-308", "1.7976931348623157e308", "-123.456e-7", "5e-324", ".5", "-.25", "7.", "1e0"
+	};
+	size_t numEdges = sizeof(edges) / sizeof(edges[0]);
+	size_t failures = 0;
+	// Padded like the loader's line buffers
+	char paddedToken[TINYOBJ_PARSE_PADDING + 128 + TINYOBJ_PARSE_PADDING] = {0};
+	char* token = paddedToken + TINYOBJ_PARSE_PADDING;
+
+	for(size_t i = 0; i < numEdges; i++) {
+		snprintf(token, 128, "%s\n", edges[i]);
+		checkParsedNumber(token, true, failures);
+	}
+
+	// Random decimals with up to 20 integer and fraction digits and optional exponents
+	const size_t numRandom = 2000000;
+	srand(1);
+	for(size_t i = 0; i < numRandom; i++) {
+		char* p = token;
+		if(rand() % 4 == 0) *p++ = '-';
+		int intDigits = rand() % 21, fracDigits = rand() % 21;
+		for(int d = 0; d < intDigits; d++) *p++ = (char) ('0' + rand() % 10);
+		if(fracDigits > 0 || intDigits == 0) {
+			*p++ = '.';
+			for(int d = 0; d < std::max(fracDigits, 1); d++) *p++ = (char) ('0' + rand() % 10);
+		}
+		if(rand() % 3 == 0) p += sprintf(p, "e%d", rand() % 101 - 50);
+		*p++ = '\n';
+		*p = '\0';
+		checkParsedNumber(token, true, failures);
+	}
+
+	// Every edge and some random numbers ending at the last byte before a page that can't be read
+	const size_t page = 4096;
+#ifdef _WIN32
+	char* pages = (char*) VirtualAlloc(NULL, 2 * page, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	DWORD oldProtection;
+	bool guarded = pages && VirtualProtect(pages + page, page, PAGE_NOACCESS, &oldProtection);
+#else
+	char* pages = (char*) mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(pages == MAP_FAILED) pages = 0;
+	bool guarded = pages && mprotect(pages + page, page, PROT_NONE) == 0;
+#endif
+	if(!guarded) {
+		std::cerr << "Unable to set up a guard page, skipping the page boundary checks" << std::endl;
+	} else {
+		for(size_t i = 0; i < numEdges + 1000; i++) {
+			if(i < numEdges) {
+				snprintf(token, 128, "%s\n", edges[i]);
+			} else {
+				snprintf(token, 128, "%d.%de%d\n", rand() - RAND_MAX / 2, rand(), rand() % 61 - 30);
+			}
+			// The loader always leaves a newline or terminator after a number, here it is the page's last byte
+			size_t length = strlen(token);
+			char* placed = pages + page - length;
+			memcpy(placed, token, length);
+			const char* end;
+			// Mapped pages count as padded
+			float parsed = tinyobj::ParseFloat(placed, &end, true);
+			float expected = (float) strtod(token, NULL);
+			if(memcmp(&parsed, &expected, sizeof(float)) != 0 || end != pages + page - 1) {
+				if(failures < 20) std::cerr << "Parsed " << std::string(token, length - 1) << " as " << parsed << " before a page boundary" << std::endl;
+				failures++;
+			}
+		}
+	}
+#ifdef _WIN32
+	if(pages) VirtualFree(pages, 0, MEM_RELEASE);
+#else
+	if(pages) munmap(pages, 2 * page);
+#endif
+
+	// Every edge as the first and last number of a heap buffer of the exact size, parsed in place and by the loaders
+	for(size_t i = 0; i < numEdges; i++) {
+		size_t length = strlen(edges[i]);
+		char* buffer = new char[2 * length + 2];
+		memcpy(buffer, edges[i], length);
+		buffer[length] = ' ';
+		memcpy(buffer + length + 1, edges[i], length);
+		buffer[2 * length + 1] = '\n';
+		checkParsedNumber(buffer, false, failures);
+		checkParsedNumber(buffer + length + 1, false, failures);
+		delete[] buffer;
+		checkLoadedNumber(edges[i], failures);
+	}
+
+	std::cout << numEdges << " edge cases, " << numRandom << " random decimals" << (guarded ? ", page boundaries" : "")
+			<< " and heap buffer ends checked against strtod, " << failures << " mismatches" << std::endl;
+	return failures;
+}
+
+static bool isSameShape(const tinyobj::shape_t& a, const tinyobj::shape_t& b)
+{
+	return a.name == b.name && a.group == b.group && a.mesh.positions == b.mesh.positions
+			&& a.mesh.normals == b.mesh.normals && a.mesh.texcoords == b.mesh.texcoords && a.mesh.indices == b.mesh.indices
+			&& a.mesh.num_vertices == b.mesh.num_vertices && a.mesh.material_ids == b.mesh.material_ids
+			&& memcmp(a.min_index, b.min_index, sizeof(a.min_index)) == 0
+			&& memcmp(a.max_index, b.max_index, sizeof(a.max_index)) == 0;
+}
+
+// Time flattening the face groups of a generated .obj with many small groups, with the hash table vertex cache
+// against the std::map every group used before it. Returns false if they produce different shapes.
+static bool benchmarkVertexCache()
+{
+	// Groups of 4x4 quads sharing their v, vt and vn records
+	const int numGroups = 10000, grid = 4;
+	std::string obj;
+	char line[256];
+	int base = 0;
+	for(int g = 0; g < numGroups; g++) {
+		snprintf(line, sizeof(line), "g group%d\n", g);
+		obj += line;
+		for(int y = 0; y <= grid; y++) {
+			for(int x = 0; x <= grid; x++) {
+				snprintf(line, sizeof(line), "v %d %d %d\nvt %g %g\nvn 0 0 1\n", x + g * grid, y, g % 7, x / (float) grid, y / (float) grid);
+				obj += line;
+			}
+		}
+		for(int y = 0; y < grid; y++) {
+			for(int x = 0; x < grid; x++) {
+				int a = base + y * (grid + 1) + x + 1, b = a + 1, c = b + grid + 1, d = a + grid + 1;
+				snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+				obj += line;
+			}
+		}
+		base += (grid + 1) * (grid + 1);
+	}
+
+	// Best of a few runs of each
+	std::vector<tinyobj::shape_t> mapShapes, hashShapes;
+	double mapSeconds = 0.0, hashSeconds = 0.0;
+	std::string err;
+	for(int run = 0; run < 3; run++) {
+		double seconds;
+		mapShapes.clear();
+		if(!tinyobj::FlattenObjFaceGroups(mapShapes, err, obj.data(), obj.size(), true, seconds)) {
+			std::cerr << "Unable to load the generated model: " << err << std::endl;
+			return false;
+		}
+		mapSeconds = run == 0 ? seconds : std::min(mapSeconds, seconds);
+		hashShapes.clear();
+		tinyobj::FlattenObjFaceGroups(hashShapes, err, obj.data(), obj.size(), false, seconds);
+		hashSeconds = run == 0 ? seconds : std::min(hashSeconds, seconds);
+	}
+
+	size_t corners = 0;
+	for(size_t i = 0; i < hashShapes.size(); i++) corners += hashShapes[i].mesh.indices.size();
+	std::cout << numGroups << " groups, " << obj.size() / (1024.0 * 1024.0) << " MB, " << corners << " face corners: std::map "
+			<< 1000.0 * mapSeconds << " ms, vertex_cache " << 1000.0 * hashSeconds << " ms, "
+			<< mapSeconds / hashSeconds << "x faster" << std::endl;
+
+	bool same = mapShapes.size() == hashShapes.size();
+	for(size_t i = 0; same && i < hashShapes.size(); i++) same = isSameShape(mapShapes[i], hashShapes[i]);
+	if(!same) std::cerr << "The vertex caches produced different shapes" << std::endl;
+	return same;
+}
+
 int main(int argc, char** argv)
 {
 #define MAX_OBJ_FILENAME 500;
 	std::string  modelName;
+	if (argc == 2 && std::string(argv[1]) == "--benchmark-culling") {
+		benchmarkCulling();
+		return 0;
+	}
+	if (argc == 2 && std::string(argv[1]) == "--benchmark-vertex-cache") {
+		return benchmarkVertexCache() ? 0 : 1;
+	}
+	if (argc == 2 && std::string(argv[1]) == "--test-number-parser") {
+		return testNumberParser() == 0 ? 0 : 1;
+	}
 	if (argc != 2) {
 		std::cerr << "Usage: " << argv[0] << " <model.obj>" << std::endl;
+		std::cerr << "       " << argv[0] << " --benchmark-culling" << std::endl;
+		std::cerr << "       " << argv[0] << " --benchmark-vertex-cache" << std::endl;
+		std::cerr << "       " << argv[0] << " --test-number-parser" << std::endl;
 #if _DEBUG
 		modelName = std::string("test.obj");
 #else